@@ -6,30 +6,64 @@
 #include <iostream>
 #include <vector>
 #include <algorithm>
+#include <cmath>
+#include <deque>
+#include <cstdint>
+#include <functional>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <random>
+#include <unordered_map>
+#include <unordered_set>
+#include "gap_split.hpp"
+#include "pairwise.hpp"
+#include "radix_sort.hpp"
+#include "union_find.hpp"
+#include "kdtree/kdtree.cpp"
+#include "vptree/vptree.cpp"
+#include "geo/cell_index.cpp"
+#include "hnsw/hnsw.cpp"
 
 namespace density {
 
     template <typename T>
     class DBSCAN {
 
-    private:
+    protected:
         T m_epsilon;
         long int m_min_points;
         T (* m_distance)(std::vector<T>, std::vector<T>);
 
-        void expand_cluster(const std::vector<std::vector<T> > &distance_matrix, const int index, std::vector<int> index_neighbors, std::vector<int> &clusters, int cluster_id) {
-            std::vector<int> seed_neighbors = index_neighbors, n_neighbors, visited;
-            visited.push_back(index);
-            std::vector<T> neighbor;
+    private:
+        // set by fit: labels of the fitted data and of its core points;
+        // the cores are in a KD-tree for euclidean distances, otherwise
+        // sorted by distance to m_core_pivot
+        std::vector<int> m_labels;
+        std::vector<int> m_core_labels;
+        KDTree<T> m_core_tree;
+        std::vector<T> m_core_pivot;
+        std::vector<std::vector<T> > m_core_points;
+        std::vector<T> m_core_references;
+
+        void expand_cluster(const pairwise::CSRMatrix<T> &neighbor_graph, std::vector<int> index_neighbors, std::vector<int> &clusters, int cluster_id) {
+            // a point is queued only when it leaves the unvisited state (-2),
+            // so every point is expanded at most once
+            std::vector<int> seed_neighbors, n_neighbors;
             int n_index, n_index_cluster, seed;
+            for(auto n_it = index_neighbors.begin(); n_it != index_neighbors.end(); ++n_it) {
+                n_index_cluster = clusters.at(*n_it);
+                if (n_index_cluster == -1 || n_index_cluster == -2) {
+                    if (n_index_cluster == -2) {
+                        seed_neighbors.push_back(*n_it);
+                    }
+                    clusters.at(*n_it) = cluster_id;
+                }
+            }
             while (!seed_neighbors.empty()) {
                 seed = seed_neighbors.back();
                 seed_neighbors.pop_back();
-                if(std::find(visited.begin(), visited.end(), seed) != visited.end()) {
-                    continue;
-                }
-                visited.push_back(seed);
-                n_neighbors = neighbors(distance_matrix, seed);
+                n_neighbors = neighbors(neighbor_graph, seed);
                 if (static_cast<long int>(n_neighbors.size()) < m_min_points) {
                     continue;
                 }
@@ -46,39 +80,48 @@ namespace density {
             }
         }
 
-        std::vector<int> neighbors(const std::vector<std::vector<T> > &distance_matrix, size_t index) {
-            T distance;
-            std::vector<int> output;
-            std::vector<T> row = distance_matrix.at(index);
-            for(auto it = row.begin(); it != row.end(); ++it) {
-                int index = std::distance(row.begin(), it);
-                distance = row.at(index);
-                if (distance < m_epsilon) {
-                    output.push_back(index);
-                }
+        std::vector<int> neighbors(const pairwise::CSRMatrix<T> &neighbor_graph, size_t index) {
+            const size_t begin = neighbor_graph.offsets[index], end = neighbor_graph.offsets[index + 1];
+            return std::vector<int>(neighbor_graph.indices.begin() + begin, neighbor_graph.indices.begin() + end);
+        }
+
+        virtual pairwise::CSRMatrix<T> calculate_neighbors(const std::vector<std::vector<T> > &data) {
+            // eps-neighborhood of every point (itself included), computed once
+            if (distance::is_euclidean(m_distance)) {
+                KDTree<T> tree(data);
+                return tree.template self_join<T>(m_epsilon);
             }
-            return output;
+            if (distance::is_haversine(m_distance) && !data.empty() && data[0].size() == 2) {
+                // (latitude, longitude) points with eps in kilometers
+                const GeoCellIndex<T> index(data, m_epsilon);
+                return index.threshold_graph(m_epsilon);
+            }
+            return pairwise::pdist_threshold<T>(data, m_distance, m_epsilon);
         }
 
-        virtual std::vector<std::vector<T> > calculate_distances(const std::vector<std::vector<T> > &data) {
-            size_t data_size = data.size(), i = 0, j = 0;
-            std::vector<std::vector<T> > output(data_size);
-            for(i = 0; i < data_size; ++i) {
-                std::vector<T> row(data_size);
-                output.at(i) = row;
+        std::vector<int> cluster(const pairwise::CSRMatrix<T> &neighbor_graph) {
+            const std::size_t sample_count = neighbor_graph.size();
+            std::vector<int> clusters(sample_count);
+
+            for(auto it = clusters.begin(); it != clusters.end(); ++it) {
+                *it = -2;
             }
-            #pragma omp parallel for if(data_size > 2000) private(i, j) shared(data)
-            for (i = 0; i < data_size; ++i) {
-                std::vector<T> point1 = data.at(i), point2;
-                for(j = i; j < data_size; ++j) {
-                    T dist = m_distance(point1, data.at(j));
-                    #pragma omp critical
-                    output[i][j] = dist;
-                    #pragma omp critical
-                    output[j][i] = dist;
+
+            int cluster_id = 0;
+            for(size_t index = 0; index < sample_count; ++index) {
+                if (clusters.at(index) != -2) {
+                    continue;
+                }
+                std::vector<int> point_neighbors = neighbors(neighbor_graph, index);
+                if (static_cast<long int>(point_neighbors.size()) < m_min_points) {
+                    clusters.at(index) = -1;
+                    continue;
                 }
+                clusters.at(index) = cluster_id;
+                expand_cluster(neighbor_graph, point_neighbors, clusters, cluster_id);
+                cluster_id += 1;
             }
-            return output;
+            return clusters;
         }
 
     public:
@@ -109,29 +152,921 @@ namespace density {
         }
 
         std::vector<int> predict(std::vector<std::vector<T> > data) {
-            const std::size_t sample_count = data.size();
-            std::vector<int> clusters(sample_count);
+            return cluster(this->calculate_neighbors(data));
+        }
 
-            for(auto it = clusters.begin(); it != clusters.end(); ++it) {
-                *it = -2;
+        // Clusters a precomputed eps-neighborhood graph, every point in its
+        // own row, e.g. the threshold_graph of an NNDescent kNN graph for
+        // data the trees do not help with.  A kNN graph caps neighborhoods
+        // at k + 1 points, so min_points should stay within that.
+        std::vector<int> predict_graph(const pairwise::CSRMatrix<T> &neighbor_graph) {
+            return cluster(neighbor_graph);
+        }
+
+        void fit(const std::vector<std::vector<T> > &data) {
+            // cluster data and keep its core points so that assign can label
+            // new points later
+            const pairwise::CSRMatrix<T> neighbor_graph = this->calculate_neighbors(data);
+            m_labels = cluster(neighbor_graph);
+            std::vector<size_t> cores;
+            for (size_t index = 0; index < data.size(); ++index) {
+                if (static_cast<long int>(neighbor_graph.degree(index)) >= m_min_points) {
+                    cores.push_back(index);
+                }
+            }
+            m_core_points.clear();
+            m_core_references.clear();
+            m_core_labels.clear();
+            m_core_tree = KDTree<T>();
+            if (cores.empty()) {
+                return;
+            }
+            if (distance::is_euclidean(m_distance)) {
+                std::vector<std::vector<T> > core_points(cores.size());
+                m_core_labels.reserve(cores.size());
+                for (size_t i = 0; i < cores.size(); ++i) {
+                    core_points[i] = data[cores[i]];
+                    m_core_labels.push_back(m_labels[cores[i]]);
+                }
+                m_core_tree = KDTree<T>(core_points);
+                return;
             }
+            // the pivot is the core farthest from the first one, which
+            // spreads the references out
+            size_t pivot = cores.front();
+            T farthest = 0;
+            for (auto it = cores.begin(); it != cores.end(); ++it) {
+                T value = m_distance(data[*it], data[cores.front()]);
+                if (value > farthest) {
+                    farthest = value;
+                    pivot = *it;
+                }
+            }
+            m_core_pivot = data[pivot];
+            std::vector<std::pair<T, size_t> > references(cores.size());
+            for (size_t i = 0; i < cores.size(); ++i) {
+                references[i] = std::make_pair(m_distance(data[cores[i]], m_core_pivot), cores[i]);
+            }
+            std::sort(references.begin(), references.end());
+            m_core_points.reserve(cores.size());
+            m_core_references.reserve(cores.size());
+            m_core_labels.reserve(cores.size());
+            for (auto it = references.begin(); it != references.end(); ++it) {
+                m_core_references.push_back(it->first);
+                m_core_points.push_back(data[it->second]);
+                m_core_labels.push_back(m_labels[it->second]);
+            }
+        }
 
-            const std::vector<std::vector<T> > distance_matrix = this->calculate_distances(data);
-            int cluster_id = 0;
+        // labels of the data passed to fit
+        const std::vector<int> & getLabels() {
+            return this->m_labels;
+        }
+
+        std::vector<int> assign(const std::vector<std::vector<T> > &data) {
+            // label of the nearest fitted core point within epsilon, or -1:
+            // one bounded nearest query in the core tree, or else, by the
+            // triangle inequality, a scan of the cores whose distance to the
+            // pivot is within epsilon of the point's
+            const long int sample_count = static_cast<long int>(data.size());
+            std::vector<int> clusters(data.size(), -1);
+            if (m_core_labels.empty()) {
+                return clusters;
+            }
+            long int i = 0;
+            if (m_core_tree.size() > 0) {
+                auto accept = [](const size_t) { return true; };
+                auto cost = [](const size_t, const double distance) { return distance; };
+                #pragma omp parallel for if(sample_count > 2000)
+                for (i = 0; i < sample_count; ++i) {
+                    const size_t nearest = m_core_tree.nearest_if(data[i], accept, cost, m_epsilon).second;
+                    if (nearest != std::numeric_limits<size_t>::max()) {
+                        clusters[i] = m_core_labels[nearest];
+                    }
+                }
+                return clusters;
+            }
+            #pragma omp parallel for if(sample_count > 2000)
+            for (i = 0; i < sample_count; ++i) {
+                const T reference = m_distance(data[i], m_core_pivot);
+                T closest = m_epsilon;
+                auto it = std::lower_bound(m_core_references.begin(), m_core_references.end(), reference - m_epsilon);
+                for (; it != m_core_references.end() && *it - reference < m_epsilon; ++it) {
+                    const size_t core = static_cast<size_t>(std::distance(m_core_references.begin(), it));
+                    T value = m_distance(data[i], m_core_points[core]);
+                    if (value < closest) {
+                        closest = value;
+                        clusters[i] = m_core_labels[core];
+                    }
+                }
+            }
+            return clusters;
+        }
+    };
+
+    template <typename T>
+    class TIDBSCAN: public DBSCAN<T> {
+        /*
+        DBSCAN for metrics without a spatial index (canberra, chebyshev,
+        hamming, ...).  Points are sorted by their distance to a pivot
+        point; by the triangle inequality |d(p, x) - d(p, y)| <= d(x, y), so
+        the epsilon-neighbors of a point lie in a window of that order no
+        wider than epsilon either side.  Further pivots tighten the bound
+        and reject most candidates in the window before the distance is
+        computed.  Pivots are chosen farthest-first.
+
+        The result equals DBSCAN's as long as the distance is a metric.
+
+        Original paper: TI-DBSCAN: Clustering with DBSCAN by Means of the
+        Triangle Inequality (Kryszkiewicz, Lasek 2010)
+        */
+
+    private:
+        size_t m_pivot_count;
+
+        std::vector<size_t> choose_pivots(const std::vector<std::vector<T> > &data) {
+            const size_t sample_count = data.size();
+            std::vector<size_t> output;
+            std::vector<T> closest(sample_count, std::numeric_limits<T>::max());
+            // start from the point farthest from the first one
+            size_t pivot = 0;
+            for (size_t i = 0; i < sample_count; ++i) {
+                if (this->m_distance(data[i], data[0]) > this->m_distance(data[pivot], data[0])) {
+                    pivot = i;
+                }
+            }
+            while (output.size() < std::min(m_pivot_count, sample_count)) {
+                output.push_back(pivot);
+                for (size_t i = 0; i < sample_count; ++i) {
+                    closest[i] = std::min(closest[i], this->m_distance(data[i], data[pivot]));
+                }
+                pivot = static_cast<size_t>(std::distance(closest.begin(), std::max_element(closest.begin(), closest.end())));
+            }
+            return output;
+        }
+
+        pairwise::CSRMatrix<T> calculate_neighbors(const std::vector<std::vector<T> > &data) {
+            const size_t sample_count = data.size();
+            std::vector<std::vector<pairwise::Edge<T> > > buffers(pairwise::thread_count());
+            if (sample_count < 2) {
+                return pairwise::edges_to_csr<T>(sample_count, buffers, true, true);
+            }
+            const std::vector<size_t> pivots = choose_pivots(data);
+            const size_t pivot_count = pivots.size();
+
+            // pivot distances of every point, row per point in pivot-0 order
+            std::vector<T> references(sample_count * pivot_count);
+            std::vector<size_t> order(sample_count);
+            const long int count = static_cast<long int>(sample_count);
+            long int i = 0;
+            #pragma omp parallel for if(count > 2000)
+            for (i = 0; i < count; ++i) {
+                for (size_t p = 0; p < pivot_count; ++p) {
+                    references[i * pivot_count + p] = this->m_distance(data[i], data[pivots[p]]);
+                }
+            }
+            std::iota(order.begin(), order.end(), 0);
+            std::sort(order.begin(), order.end(), [&](const size_t a, const size_t b) {
+                return references[a * pivot_count] < references[b * pivot_count];
+            });
+            std::vector<T> sorted_references(sample_count * pivot_count);
+            for (size_t k = 0; k < sample_count; ++k) {
+                std::copy(references.begin() + order[k] * pivot_count, references.begin() + (order[k] + 1) * pivot_count, sorted_references.begin() + k * pivot_count);
+            }
+
+            const T epsilon = this->m_epsilon;
+            #pragma omp parallel for if(count > 2000) schedule(dynamic, 64)
+            for (i = 0; i < count; ++i) {
+                std::vector<pairwise::Edge<T> > &buffer = buffers[pairwise::thread_id()];
+                const T *reference = &sorted_references[i * pivot_count];
+                for (size_t k = i + 1; k < sample_count; ++k) {
+                    const T *candidate = &sorted_references[k * pivot_count];
+                    if (candidate[0] - reference[0] >= epsilon) {
+                        break;
+                    }
+                    bool pruned = false;
+                    for (size_t p = 1; p < pivot_count && !pruned; ++p) {
+                        pruned = std::abs(candidate[p] - reference[p]) >= epsilon;
+                    }
+                    if (pruned) {
+                        continue;
+                    }
+                    T value = this->m_distance(data[order[i]], data[order[k]]);
+                    if (value < epsilon) {
+                        pairwise::Edge<T> edge = {order[i], order[k], value};
+                        buffer.push_back(edge);
+                    }
+                }
+            }
+            return pairwise::edges_to_csr<T>(sample_count, buffers, true, true);
+        }
+
+    public:
+        TIDBSCAN(const T epsilon, const long int min_points, T (* distance_func)(std::vector<T>, std::vector<T>), const size_t pivot_count = 3): DBSCAN<T>(epsilon, min_points, distance_func) {
+            assert(pivot_count > 0);
+            m_pivot_count = pivot_count;
+        }
+
+        void setPivotCount(const size_t pivotCount) {
+            this->m_pivot_count = pivotCount;
+        }
+
+        size_t getPivotCount() {
+            return this->m_pivot_count;
+        }
+    };
+
+    template <typename T>
+    class VPTreeDBSCAN: public DBSCAN<T> {
+        /*
+        DBSCAN with the epsilon-neighborhoods found by a vantage-point tree
+        (see VPTree), for metrics the KD-tree cannot index (canberra,
+        chebyshev, angular, haversine, ...).  Every point is queried in
+        parallel and subtrees are pruned by the triangle inequality, so the
+        result equals DBSCAN's as long as the distance is a metric.
+
+        Original paper: Data Structures and Algorithms for Nearest Neighbor
+        Search in General Metric Spaces (Yianilos 1993)
+        */
+
+    private:
+        size_t m_leaf_size;
+
+        // neighborhoods through a tree over whichever row functor
+        // distance::with_row_distance picks
+        struct TreeNeighbors {
+            const std::vector<std::vector<T> > &data;
+            const T epsilon;
+            const size_t leaf_size;
+
+            template <typename Distance>
+            pairwise::CSRMatrix<T> operator()(const Distance &distance) const {
+                const VPTree<T, Distance> tree(data, distance, leaf_size);
+                return tree.threshold_graph(epsilon);
+            }
+        };
+
+        pairwise::CSRMatrix<T> calculate_neighbors(const std::vector<std::vector<T> > &data) {
+            const TreeNeighbors visit = {data, this->m_epsilon, m_leaf_size};
+            return distance::with_row_distance(this->m_distance, visit);
+        }
+
+    public:
+        VPTreeDBSCAN(const T epsilon, const long int min_points, T (* distance_func)(std::vector<T>, std::vector<T>), const size_t leaf_size = 16): DBSCAN<T>(epsilon, min_points, distance_func) {
+            assert(leaf_size > 0);
+            m_leaf_size = leaf_size;
+        }
+
+        void setLeafSize(const size_t leafSize) {
+            this->m_leaf_size = leafSize;
+        }
+
+        size_t getLeafSize() {
+            return this->m_leaf_size;
+        }
+    };
+
+    template <typename T>
+    class HNSWDBSCAN: public DBSCAN<T> {
+        /*
+        DBSCAN with approximate epsilon-neighborhoods found in an HNSW graph
+        (see HNSW), for high-dimensional data that no tree prunes well.  A
+        neighborhood is walked from the nearest points found through links
+        between points within epsilon, so now and then a neighbor is missed
+        and a cluster splits or a point turns to noise where DBSCAN would
+        not; a larger ef makes that rarer.
+
+        Original paper: Efficient and robust approximate nearest neighbor
+        search using Hierarchical Navigable Small World graphs (Malkov,
+        Yashunin 2016)
+        */
+
+    private:
+        size_t m_max_links;
+        size_t m_ef;
+
+        // neighborhoods through a graph over whichever row functor
+        // distance::with_row_distance picks
+        struct GraphNeighbors {
+            const std::vector<std::vector<T> > &data;
+            const T epsilon;
+            const size_t max_links;
+            const size_t ef;
+
+            template <typename Distance>
+            pairwise::CSRMatrix<T> operator()(const Distance &distance) const {
+                HNSW<T, Distance> index(data, distance, max_links);
+                index.set_ef(ef);
+                return index.threshold_graph(epsilon);
+            }
+        };
+
+        pairwise::CSRMatrix<T> calculate_neighbors(const std::vector<std::vector<T> > &data) {
+            const GraphNeighbors visit = {data, this->m_epsilon, m_max_links, m_ef};
+            return distance::with_row_distance(this->m_distance, visit);
+        }
+
+    public:
+        HNSWDBSCAN(const T epsilon, const long int min_points, T (* distance_func)(std::vector<T>, std::vector<T>), const size_t max_links = 16, const size_t ef = 64): DBSCAN<T>(epsilon, min_points, distance_func) {
+            assert(max_links > 1);
+            assert(ef > 0);
+            m_max_links = max_links;
+            m_ef = ef;
+        }
+
+        void setMaxLinks(const size_t maxLinks) {
+            this->m_max_links = maxLinks;
+        }
+
+        size_t getMaxLinks() {
+            return this->m_max_links;
+        }
+
+        void setEf(const size_t ef) {
+            this->m_ef = ef;
+        }
+
+        size_t getEf() {
+            return this->m_ef;
+        }
+    };
+
+    template <typename T>
+    class IncrementalDBSCAN {
+        /*
+        DBSCAN kept up to date under point insertions and deletions.  Points
+        are bucketed in a grid of epsilon-sized cells, so an update only
+        queries the neighborhoods it touches.  An insertion can promote
+        neighbors to core points and merge clusters.  A deletion can demote
+        them and split a cluster; a split is found by searching the core
+        graph from the cores around the deleted point.
+
+        The grid prunes on per-coordinate differences, so the distance must
+        be at least the largest coordinate difference (any Minkowski
+        distance, e.g. euclidean or manhattan).  A query visits 3^d cells,
+        which suits low dimensional data such as coordinates.
+
+        Ids of removed points are reused by later insertions.
+
+        Original paper: Incremental Clustering for Mining in a Data
+        Warehousing Environment (Ester, Kriegel, Sander, Wimmer, Xu 1998)
+        */
+
+    private:
+        struct CellHash {
+            size_t operator()(const std::vector<long int> &cell) const {
+                size_t output = 0;
+                for (auto it = cell.begin(); it != cell.end(); ++it) {
+                    output ^= std::hash<long int>()(*it) + 0x9e3779b9 + (output << 6) + (output >> 2);
+                }
+                return output;
+            }
+        };
+
+        T m_epsilon;
+        long int m_min_points;
+        T (* m_distance)(std::vector<T>, std::vector<T>);
+        std::vector<std::vector<T> > m_points;
+        std::vector<bool> m_active;
+        std::vector<size_t> m_free;
+        // eps-neighborhood size of each point, itself included
+        std::vector<long int> m_counts;
+        // cluster handle of each point (resolved through m_handles), SIZE_MAX
+        // for noise
+        std::vector<size_t> m_clusters;
+        UnionFind m_handles;
+        std::unordered_map<std::vector<long int>, std::vector<size_t>, CellHash> m_grid;
+        // search marks and owners used by split
+        std::vector<size_t> m_visited;
+        std::vector<size_t> m_owner;
+        size_t m_visit;
+
+        std::vector<long int> cell(const std::vector<T> &point) {
+            std::vector<long int> output(point.size());
+            for (size_t i = 0; i < point.size(); ++i) {
+                output[i] = static_cast<long int>(std::floor(point[i] / m_epsilon));
+            }
+            return output;
+        }
+
+        std::vector<size_t> region_query(const std::vector<T> &point) {
+            const size_t dimensions = point.size();
+            const std::vector<long int> center = cell(point);
+            std::vector<long int> offset(dimensions, -1), key(dimensions);
+            std::vector<size_t> output;
+            while (true) {
+                for (size_t i = 0; i < dimensions; ++i) {
+                    key[i] = center[i] + offset[i];
+                }
+                auto bucket = m_grid.find(key);
+                if (bucket != m_grid.end()) {
+                    for (auto it = bucket->second.begin(); it != bucket->second.end(); ++it) {
+                        if (m_distance(m_points[*it], point) < m_epsilon) {
+                            output.push_back(*it);
+                        }
+                    }
+                }
+                size_t i = 0;
+                while (i < dimensions && offset[i] == 1) {
+                    offset[i] = -1;
+                    ++i;
+                }
+                if (i == dimensions) {
+                    break;
+                }
+                ++offset[i];
+            }
+            return output;
+        }
+
+        bool is_core(const size_t index) {
+            return m_counts[index] >= m_min_points;
+        }
+
+        size_t core_cluster(const std::vector<size_t> &point_neighbors) {
+            for (auto it = point_neighbors.begin(); it != point_neighbors.end(); ++it) {
+                if (is_core(*it)) {
+                    return m_clusters[*it];
+                }
+            }
+            return SIZE_MAX;
+        }
+
+        void promote(const size_t index, const std::vector<size_t> &point_neighbors) {
+            // index just became a core point: join every cluster it touches
+            size_t handle = SIZE_MAX;
+            for (auto it = point_neighbors.begin(); it != point_neighbors.end(); ++it) {
+                if (*it == index || !is_core(*it) || m_clusters[*it] == SIZE_MAX) {
+                    continue;
+                }
+                handle = handle == SIZE_MAX ? m_handles.find(m_clusters[*it]) : m_handles.unite(handle, m_clusters[*it]);
+            }
+            if (handle == SIZE_MAX) {
+                handle = m_handles.add();
+            }
+            m_clusters[index] = handle;
+            for (auto it = point_neighbors.begin(); it != point_neighbors.end(); ++it) {
+                if (!is_core(*it) && m_clusters[*it] == SIZE_MAX) {
+                    m_clusters[*it] = handle;
+                }
+            }
+        }
+
+        struct Search {
+            std::vector<size_t> frontier;
+            std::vector<size_t> component;
+            std::vector<size_t> borders;
+        };
+
+        void absorb(Search &into, Search &from) {
+            if (into.component.size() + into.frontier.size() < from.component.size() + from.frontier.size()) {
+                std::swap(into, from);
+            }
+            into.frontier.insert(into.frontier.end(), from.frontier.begin(), from.frontier.end());
+            into.component.insert(into.component.end(), from.component.begin(), from.component.end());
+            into.borders.insert(into.borders.end(), from.borders.begin(), from.borders.end());
+            from = Search();
+        }
+
+        void split(const std::vector<size_t> &seeds) {
+            // seeds are the cores of one cluster that were connected through
+            // demoted points.  A search of the core graph starts from every
+            // seed and they advance in turns, merging when they meet.  A search
+            // that runs out has found a piece cut off from the cluster, which
+            // gets a new handle; once one search is left it holds the rest of
+            // the cluster and keeps the old handle.  The work is bounded by
+            // the pieces cut off rather than by the whole cluster.
+            const size_t root = m_handles.find(m_clusters[seeds.front()]);
+            const size_t search_count = seeds.size();
+            std::vector<Search> searches(search_count);
+            UnionFind merged(search_count);
+            ++m_visit;
+            for (size_t i = 0; i < search_count; ++i) {
+                searches[i].frontier.push_back(seeds[i]);
+                m_visited[seeds[i]] = m_visit;
+                m_owner[seeds[i]] = i;
+            }
+
+            std::vector<size_t> active(search_count), pieces;
+            std::iota(active.begin(), active.end(), 0);
+            while (active.size() > 1) {
+                std::vector<size_t> next;
+                for (auto it = active.begin(); it != active.end(); ++it) {
+                    const size_t s = *it;
+                    if (merged.find(s) != s) {
+                        continue;
+                    }
+                    if (searches[s].frontier.empty()) {
+                        pieces.push_back(s);
+                        continue;
+                    }
+                    const size_t core = searches[s].frontier.back();
+                    searches[s].frontier.pop_back();
+                    searches[s].component.push_back(core);
+                    std::vector<size_t> core_neighbors = region_query(m_points[core]);
+                    size_t current = s;
+                    for (auto n_it = core_neighbors.begin(); n_it != core_neighbors.end(); ++n_it) {
+                        if (!is_core(*n_it)) {
+                            if (m_clusters[*n_it] != SIZE_MAX && m_handles.find(m_clusters[*n_it]) == root) {
+                                searches[current].borders.push_back(*n_it);
+                            }
+                        } else if (m_visited[*n_it] != m_visit) {
+                            m_visited[*n_it] = m_visit;
+                            m_owner[*n_it] = current;
+                            searches[current].frontier.push_back(*n_it);
+                        } else {
+                            const size_t other = merged.find(m_owner[*n_it]);
+                            if (other != current) {
+                                const size_t joined = merged.unite(current, other);
+                                absorb(searches[joined], searches[joined == current ? other : current]);
+                                current = joined;
+                            }
+                        }
+                    }
+                    next.push_back(current);
+                }
+                // a search can be listed twice after merging within a turn
+                std::sort(next.begin(), next.end());
+                next.erase(std::unique(next.begin(), next.end()), next.end());
+                active.clear();
+                for (auto it = next.begin(); it != next.end(); ++it) {
+                    if (merged.find(*it) == *it) {
+                        active.push_back(*it);
+                    }
+                }
+            }
+            if (active.empty() && !pieces.empty()) {
+                // every piece ran out in the same turn, the last keeps the handle
+                pieces.pop_back();
+            }
+            for (auto it = pieces.begin(); it != pieces.end(); ++it) {
+                const size_t handle = m_handles.add();
+                const Search &piece = searches[*it];
+                for (auto c_it = piece.component.begin(); c_it != piece.component.end(); ++c_it) {
+                    m_clusters[*c_it] = handle;
+                }
+                for (auto b_it = piece.borders.begin(); b_it != piece.borders.end(); ++b_it) {
+                    m_clusters[*b_it] = handle;
+                }
+            }
+        }
+
+    public:
+        IncrementalDBSCAN(const T epsilon, const long int min_points, T (* distance_func)(std::vector<T>, std::vector<T>)) {
+            assert(epsilon > 0);
+            assert(min_points > 0);
+            m_epsilon = epsilon;
+            m_min_points = min_points;
+            m_distance = distance_func;
+            m_visit = 0;
+        }
+        virtual ~IncrementalDBSCAN() {};
+
+        T getEpsilon() {
+            return this->m_epsilon;
+        }
+
+        long int getMinPoints() {
+            return this->m_min_points;
+        }
+
+        size_t size() {
+            return m_points.size() - m_free.size();
+        }
+
+        bool contains(const size_t index) {
+            return index < m_points.size() && m_active[index];
+        }
+
+        size_t insert(const std::vector<T> &point) {
             size_t index;
-            for(auto it = data.begin(); it != data.end(); ++it) {
-                index = std::distance(data.begin(), it);
-                if (clusters.at(index) != -2) {
+            if (m_free.empty()) {
+                index = m_points.size();
+                m_points.push_back(point);
+                m_active.push_back(true);
+                m_counts.push_back(0);
+                m_clusters.push_back(SIZE_MAX);
+                m_visited.push_back(0);
+                m_owner.push_back(0);
+            } else {
+                index = m_free.back();
+                m_free.pop_back();
+                m_points[index] = point;
+                m_active[index] = true;
+                m_clusters[index] = SIZE_MAX;
+            }
+            m_grid[cell(point)].push_back(index);
+
+            const std::vector<size_t> point_neighbors = region_query(point);
+            m_counts[index] = static_cast<long int>(point_neighbors.size());
+            std::vector<size_t> promoted;
+            for (auto it = point_neighbors.begin(); it != point_neighbors.end(); ++it) {
+                if (*it == index) {
+                    if (is_core(index)) {
+                        promoted.push_back(index);
+                    }
+                } else if (++m_counts[*it] == m_min_points) {
+                    promoted.push_back(*it);
+                }
+            }
+            for (auto it = promoted.begin(); it != promoted.end(); ++it) {
+                promote(*it, *it == index ? point_neighbors : region_query(m_points[*it]));
+            }
+            if (m_clusters[index] == SIZE_MAX) {
+                m_clusters[index] = core_cluster(point_neighbors);
+            }
+            return index;
+        }
+
+        void remove(const size_t index) {
+            assert(contains(index));
+            const std::vector<size_t> point_neighbors = region_query(m_points[index]);
+            std::vector<size_t> &bucket = m_grid[cell(m_points[index])];
+            *std::find(bucket.begin(), bucket.end(), index) = bucket.back();
+            bucket.pop_back();
+            if (bucket.empty()) {
+                m_grid.erase(cell(m_points[index]));
+            }
+
+            std::vector<size_t> demoted;
+            if (is_core(index)) {
+                demoted.push_back(index);
+            }
+            for (auto it = point_neighbors.begin(); it != point_neighbors.end(); ++it) {
+                if (*it != index && m_counts[*it]-- == m_min_points) {
+                    demoted.push_back(*it);
+                }
+            }
+            m_active[index] = false;
+            m_counts[index] = 0;
+            m_clusters[index] = SIZE_MAX;
+            m_free.push_back(index);
+
+            // cores left around the demoted points, grouped by cluster, and
+            // the non-core points that may have lost their cluster
+            std::map<size_t, std::vector<size_t> > seeds;
+            std::vector<size_t> orphans;
+            for (auto it = demoted.begin(); it != demoted.end(); ++it) {
+                const std::vector<size_t> demoted_neighbors = *it == index ? point_neighbors : region_query(m_points[*it]);
+                for (auto n_it = demoted_neighbors.begin(); n_it != demoted_neighbors.end(); ++n_it) {
+                    if (*n_it == index) {
+                        continue;
+                    }
+                    if (is_core(*n_it)) {
+                        seeds[m_handles.find(m_clusters[*n_it])].push_back(*n_it);
+                    } else {
+                        orphans.push_back(*n_it);
+                    }
+                }
+            }
+            for (auto it = seeds.begin(); it != seeds.end(); ++it) {
+                std::vector<size_t> &group = it->second;
+                std::sort(group.begin(), group.end());
+                group.erase(std::unique(group.begin(), group.end()), group.end());
+                if (group.size() > 1) {
+                    split(group);
+                }
+            }
+            std::sort(orphans.begin(), orphans.end());
+            orphans.erase(std::unique(orphans.begin(), orphans.end()), orphans.end());
+            for (auto it = orphans.begin(); it != orphans.end(); ++it) {
+                m_clusters[*it] = core_cluster(region_query(m_points[*it]));
+            }
+        }
+
+        std::vector<int> labels() {
+            // cluster per id numbered by first appearance, -1 for noise and
+            // removed ids
+            std::vector<int> output(m_points.size(), -1);
+            std::unordered_map<size_t, int> cluster_ids;
+            for (size_t index = 0; index < m_points.size(); ++index) {
+                if (!m_active[index] || m_clusters[index] == SIZE_MAX) {
                     continue;
                 }
-                std::vector<int> point_neighbors = neighbors(distance_matrix, index);
-                if (static_cast<long int>(point_neighbors.size()) < m_min_points) {
-                    clusters.at(index) = -1;
+                const size_t root = m_handles.find(m_clusters[index]);
+                auto it = cluster_ids.insert(std::make_pair(root, static_cast<int>(cluster_ids.size())));
+                output[index] = it.first->second;
+            }
+            return output;
+        }
+    };
+
+    enum class CoreSampling {
+        UNIFORM,
+        K_CENTER
+    };
+
+    template <typename T>
+    class SampledDBSCAN {
+        /*
+        DBSCAN++: core-ness is only checked for m sampled points instead of
+        all n, which cuts the neighborhood queries from n to m.  Sampled
+        cores closer than epsilon form the clusters, and every point joins
+        the cluster of its nearest core if that core is within epsilon,
+        otherwise it is noise.
+
+        Samples are drawn uniformly, or by K-center greedy, which repeatedly
+        takes the point farthest from those already chosen and so covers the
+        data more evenly for the same m.
+
+        Original paper: DBSCAN++: Towards fast and scalable density
+        clustering (Jang, Jiang 2019)
+        */
+
+    private:
+        T m_epsilon;
+        long int m_min_points;
+        size_t m_sample_count;
+        CoreSampling m_sampling;
+        unsigned int m_seed;
+        T (* m_distance)(std::vector<T>, std::vector<T>);
+        std::vector<size_t> m_core_indices;
+
+        std::vector<size_t> uniform_sample(const size_t sample_count, std::mt19937 &generator) {
+            // Floyd's algorithm: m distinct indices without an O(n) buffer
+            std::unordered_set<size_t> chosen;
+            const size_t m = std::min(m_sample_count, sample_count);
+            for (size_t j = sample_count - m; j < sample_count; ++j) {
+                size_t candidate = std::uniform_int_distribution<size_t>(0, j)(generator);
+                if (!chosen.insert(candidate).second) {
+                    chosen.insert(j);
+                }
+            }
+            std::vector<size_t> output(chosen.begin(), chosen.end());
+            std::sort(output.begin(), output.end());
+            return output;
+        }
+
+        std::vector<size_t> k_center_sample(const std::vector<std::vector<T> > &data, std::mt19937 &generator) {
+            const size_t sample_count = data.size();
+            const size_t m = std::min(m_sample_count, sample_count);
+            std::vector<size_t> output;
+            output.reserve(m);
+            std::vector<T> closest(sample_count, std::numeric_limits<T>::max());
+            size_t center = std::uniform_int_distribution<size_t>(0, sample_count - 1)(generator);
+            const long int count = static_cast<long int>(sample_count);
+            while (output.size() < m) {
+                output.push_back(center);
+                const std::vector<T> &point = data[center];
+                long int i = 0;
+                #pragma omp parallel for if(count > 2000)
+                for (i = 0; i < count; ++i) {
+                    T value = m_distance(data[i], point);
+                    if (value < closest[i]) {
+                        closest[i] = value;
+                    }
+                }
+                center = static_cast<size_t>(std::distance(closest.begin(), std::max_element(closest.begin(), closest.end())));
+                if (closest[center] <= 0) {
+                    // every remaining point duplicates a chosen one
+                    break;
+                }
+            }
+            std::sort(output.begin(), output.end());
+            return output;
+        }
+
+        bool is_core(const std::vector<std::vector<T> > &data, const std::vector<T> &point) {
+            long int count = 0;
+            for (auto it = data.begin(); it != data.end(); ++it) {
+                if (m_distance(*it, point) < m_epsilon && ++count >= m_min_points) {
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    public:
+        SampledDBSCAN(const T epsilon, const long int min_points, const size_t sample_count, T (* distance_func)(std::vector<T>, std::vector<T>), const CoreSampling sampling = CoreSampling::UNIFORM) {
+            assert(epsilon > 0);
+            assert(min_points > 0);
+            assert(sample_count > 0);
+            m_epsilon = epsilon;
+            m_min_points = min_points;
+            m_sample_count = sample_count;
+            m_distance = distance_func;
+            m_sampling = sampling;
+            m_seed = std::mt19937::default_seed;
+        }
+        virtual ~SampledDBSCAN() {};
+
+        void setEpsilon(const T epsilon) {
+            this->m_epsilon = epsilon;
+        }
+
+        T getEpsilon() {
+            return this->m_epsilon;
+        }
+
+        void setMinPoints(const long int minPoints) {
+            this->m_min_points = minPoints;
+        }
+
+        long int getMinPoints() {
+            return this->m_min_points;
+        }
+
+        void setSampleCount(const size_t sampleCount) {
+            this->m_sample_count = sampleCount;
+        }
+
+        size_t getSampleCount() {
+            return this->m_sample_count;
+        }
+
+        void setSeed(const unsigned int seed) {
+            this->m_seed = seed;
+        }
+
+        // sampled points that turned out to be cores in the last predict
+        const std::vector<size_t> & getCoreIndices() {
+            return this->m_core_indices;
+        }
+
+        std::vector<int> predict(const std::vector<std::vector<T> > &data) {
+            const size_t sample_count = data.size();
+            std::vector<int> clusters(sample_count, -1);
+            m_core_indices.clear();
+            if (sample_count == 0) {
+                return clusters;
+            }
+
+            std::mt19937 generator(m_seed);
+            const std::vector<size_t> samples = m_sampling == CoreSampling::K_CENTER ? k_center_sample(data, generator) : uniform_sample(sample_count, generator);
+            const long int samples_size = static_cast<long int>(samples.size());
+            // with euclidean distances the core tests and the assignment
+            // are tree queries instead of scans
+            const bool euclidean = distance::is_euclidean(m_distance);
+            KDTree<T> tree;
+            if (euclidean) {
+                tree = KDTree<T>(data);
+            }
+            const size_t min_points = static_cast<size_t>(m_min_points);
+            std::vector<char> core(samples.size(), 0);
+            long int i = 0;
+            #pragma omp parallel for if(samples_size > 16) schedule(dynamic)
+            for (i = 0; i < samples_size; ++i) {
+                if (euclidean) {
+                    core[i] = tree.count_within(data[samples[i]], m_epsilon, min_points, true) >= min_points;
+                } else {
+                    core[i] = is_core(data, data[samples[i]]);
+                }
+            }
+            std::vector<std::vector<T> > cores;
+            for (size_t j = 0; j < samples.size(); ++j) {
+                if (core[j]) {
+                    m_core_indices.push_back(samples[j]);
+                    cores.push_back(data[samples[j]]);
+                }
+            }
+            if (cores.empty()) {
+                return clusters;
+            }
+
+            // clusters are the connected components of the sampled cores
+            KDTree<T> core_tree;
+            pairwise::CSRMatrix<T> core_graph;
+            if (euclidean) {
+                core_tree = KDTree<T>(cores);
+                core_graph = core_tree.template self_join<T>(m_epsilon, false, false);
+            } else {
+                core_graph = pairwise::pdist_threshold<T>(cores, m_distance, m_epsilon, 0, false);
+            }
+            UnionFind components(cores.size());
+            for (size_t a = 0; a < cores.size(); ++a) {
+                for (size_t k = core_graph.offsets[a]; k < core_graph.offsets[a + 1]; ++k) {
+                    components.unite(a, core_graph.indices[k]);
+                }
+            }
+            std::vector<int> core_clusters(cores.size());
+            std::unordered_map<size_t, int> cluster_ids;
+            for (size_t a = 0; a < cores.size(); ++a) {
+                auto it = cluster_ids.insert(std::make_pair(components.find(a), static_cast<int>(cluster_ids.size())));
+                core_clusters[a] = it.first->second;
+            }
+
+            const long int count = static_cast<long int>(sample_count);
+            const long int core_count = static_cast<long int>(cores.size());
+            #pragma omp parallel for if(count > 2000) schedule(dynamic, 256)
+            for (i = 0; i < count; ++i) {
+                if (euclidean) {
+                    // nearest core closer than epsilon, if any
+                    auto accept = [](const size_t) { return true; };
+                    auto cost = [](const size_t, const double distance) { return distance; };
+                    const size_t nearest = core_tree.nearest_if(data[i], accept, cost, m_epsilon).second;
+                    if (nearest != std::numeric_limits<size_t>::max()) {
+                        clusters[i] = core_clusters[nearest];
+                    }
                     continue;
                 }
-                clusters.at(index) = cluster_id;
-                expand_cluster(distance_matrix, index, point_neighbors, clusters, cluster_id);
-                cluster_id += 1;
+                T closest = m_epsilon;
+                for (long int a = 0; a < core_count; ++a) {
+                    T value = m_distance(data[i], cores[a]);
+                    if (value < closest) {
+                        closest = value;
+                        clusters[i] = core_clusters[a];
+                    }
+                }
             }
             return clusters;
         }
@@ -143,70 +1078,109 @@ namespace density {
         // sorted.  Can be used for clustering events based on when they occurred
         // can be used for online clustering where new points are sorted relative
         // to existing points
+        //
+        // Neighborhoods (within epsilon, inclusive) are windows of the sorted
+        // data whose ends only move forward, so counting all of them is O(n)
+        // with no allocation.  Cores closer than epsilon chain into a cluster;
+        // any other point within epsilon of a core joins the cluster of the
+        // nearest core before it, otherwise of the one after it.
+        //
+        // Nothing reaches across a gap wider than epsilon, so large inputs are
+        // cut at such gaps (see gap_boundaries), the chunks are labelled on
+        // separate threads and their cluster ids offset by a prefix sum of
+        // the cluster counts.
 
     private:
         T m_epsilon;
         unsigned long int m_min_points;
+        size_t m_chunk_count;
 
-        std::vector<size_t> neighbors(const std::vector<T> &data, size_t &max_index) {
-            size_t sample_count = data.size();
-            T current_point = data.at(max_index), neighbor;
-            T distance = 0.0;
-            size_t neighbor_index = max_index;
-            std::vector<size_t> output;
-            output.push_back(max_index);
-            while (distance < m_epsilon && neighbor_index > 0) {
-                --neighbor_index;
-                neighbor = data.at(neighbor_index);
-                distance = abs(neighbor - current_point);
-                if (distance > m_epsilon) {
-                    break;
+    protected:
+        // labels the sorted data[0..count) with clusters numbered from 0 (-1
+        // for noise) and returns the number of clusters
+        int label(const T *data, const size_t count, int *clusters) {
+            size_t low = 0, high = 0, last_core = SIZE_MAX;
+            int cluster_id = -1;
+            for (size_t i = 0; i < count; ++i) {
+                while (data[i] - data[low] > m_epsilon) {
+                    ++low;
+                }
+                high = std::max(high, i);
+                while (high + 1 < count && data[high + 1] - data[i] <= m_epsilon) {
+                    ++high;
+                }
+                clusters[i] = -1;
+                if (high - low + 1 >= m_min_points) {
+                    if (last_core == SIZE_MAX || data[i] - data[last_core] > m_epsilon) {
+                        ++cluster_id;
+                    }
+                    clusters[i] = cluster_id;
+                    last_core = i;
                 }
-                output.push_back(neighbor_index);
             }
-            distance = 0.0;
-            neighbor_index = max_index;
-            while (distance < m_epsilon && neighbor_index < sample_count - 1) {
-                ++neighbor_index;
-                neighbor = data.at(neighbor_index);
-                distance = abs(neighbor - current_point);
-                if (distance > m_epsilon) {
-                    break;
+
+            // border points are stored as -2 - cluster until both sweeps are
+            // done, so they are not mistaken for cores
+            last_core = SIZE_MAX;
+            for (size_t i = 0; i < count; ++i) {
+                if (clusters[i] >= 0) {
+                    last_core = i;
+                } else if (last_core != SIZE_MAX && data[i] - data[last_core] <= m_epsilon) {
+                    clusters[i] = -2 - clusters[last_core];
                 }
-                output.push_back(neighbor_index);
             }
-            return output;
+            size_t next_core = SIZE_MAX;
+            for (size_t i = count; i-- > 0;) {
+                if (clusters[i] >= 0) {
+                    next_core = i;
+                } else if (clusters[i] == -1 && next_core != SIZE_MAX && data[next_core] - data[i] <= m_epsilon) {
+                    clusters[i] = -2 - clusters[next_core];
+                }
+            }
+            for (size_t i = 0; i < count; ++i) {
+                if (clusters[i] < -1) {
+                    clusters[i] = -2 - clusters[i];
+                }
+            }
+            return cluster_id + 1;
         }
 
-        void expand_cluster(const std::vector<T> &data, size_t &max_index, std::vector<size_t> index_neighbors, std::vector<int> &clusters, int cluster_id) {
-            std::vector<size_t> seed_neighbors = index_neighbors, n_neighbors;
-            std::vector<T> neighbor;
-            size_t sample_count = data.size();
-            while (max_index < sample_count) {
-                n_neighbors = neighbors(data, max_index);
-                if (static_cast<unsigned long int>(n_neighbors.size()) < m_min_points) {
-                    clusters.at(max_index) = -1;
-                    break;
+        void label_chunks(const T *data, const size_t count, int *clusters) {
+            const T epsilon = m_epsilon;
+            const std::vector<size_t> starts = gap_boundaries(data, count, m_chunk_count > 0 ? m_chunk_count : default_chunk_count(count), [epsilon](const T previous, const T next) {
+                return next - previous > epsilon;
+            });
+            const long int chunks = static_cast<long int>(starts.size()) - 1;
+            std::vector<int> offsets(chunks + 1, 0);
+            #pragma omp parallel for if(chunks > 1)
+            for (long int chunk = 0; chunk < chunks; ++chunk) {
+                offsets[chunk + 1] = label(data + starts[chunk], starts[chunk + 1] - starts[chunk], clusters + starts[chunk]);
+            }
+            std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+            #pragma omp parallel for if(chunks > 1)
+            for (long int chunk = 1; chunk < chunks; ++chunk) {
+                for (size_t i = starts[chunk]; i < starts[chunk + 1]; ++i) {
+                    if (clusters[i] >= 0) {
+                        clusters[i] += offsets[chunk];
+                    }
                 }
-                clusters.at(max_index) = cluster_id;
-                ++max_index;
             }
         }
 
     public:
-        DBPack(const T epsilon, const unsigned long int min_points) {
+        DBPack(const T epsilon, const unsigned long int min_points): m_chunk_count(0) {
             assert(epsilon > 0);
             assert(min_points > 0);
             m_epsilon = epsilon;
             m_min_points = min_points;
         }
-        ~DBPack() {};
+        virtual ~DBPack() {};
 
-        void setEpsilon(const long int epsilon) {
+        void setEpsilon(const T epsilon) {
             this->m_epsilon = epsilon;
         }
 
-        long int getEpsilon() {
+        T getEpsilon() {
             return this->m_epsilon;
         }
 
@@ -218,26 +1192,210 @@ namespace density {
             return this->m_min_points;
         }
 
+        // chunks to split large inputs into, 0 for one per thread
+        void setChunkCount(const size_t chunkCount) {
+            this->m_chunk_count = chunkCount;
+        }
+
+        size_t getChunkCount() {
+            return this->m_chunk_count;
+        }
+
         std::vector<int> predict(const std::vector<T> &data) {
-            const std::size_t sample_count = data.size();
-            std::vector<int> clusters(sample_count);
-            size_t max_index = 0;
-            int cluster_id = 0;
-            while (max_index < sample_count) {
-                std::vector<size_t> point_neighbors = this->neighbors(data, max_index);
-                if (static_cast<unsigned long int>(point_neighbors.size()) < m_min_points) {
-                    clusters.at(max_index) = -1;
-                    ++max_index;
-                    continue;
-                }
-                clusters.at(max_index) = cluster_id;
-                expand_cluster(data, max_index, point_neighbors, clusters, cluster_id);
-                ++cluster_id;
-                ++max_index;
+            std::vector<int> clusters(data.size());
+            label_chunks(data.data(), data.size(), clusters.data());
+            return clusters;
+        }
+
+        std::vector<int> predict_unsorted(const std::vector<T> &data) {
+            // sorts a copy with a radix sort, then writes each label back
+            // through the sorting permutation; clusters are numbered in
+            // ascending order of value
+            const size_t sample_count = data.size();
+            const std::vector<size_t> order = sorting::radix_argsort(data);
+            std::vector<T> sorted(sample_count);
+            for (size_t i = 0; i < sample_count; ++i) {
+                sorted[i] = data[order[i]];
+            }
+            std::vector<int> sorted_clusters(sample_count), clusters(sample_count);
+            label_chunks(sorted.data(), sample_count, sorted_clusters.data());
+            for (size_t i = 0; i < sample_count; ++i) {
+                clusters[order[i]] = sorted_clusters[i];
             }
             return clusters;
+        }
+    };
+
+    template <typename T>
+    class StreamingDBPack {
+        // DBPack over a stream of values pushed in ascending order, such as
+        // event timestamps.  A point's neighborhood is known once a value more
+        // than epsilon past it arrives, and a cluster is finished once every
+        // point within epsilon of its last core is known, so only a ring
+        // buffer of the points within epsilon of that frontier is kept.
+        // Memory is bounded by the densest epsilon window, whatever the
+        // length of the stream.  Labels match DBPack::predict on the whole
+        // stream.
+
+    public:
+        struct Cluster {
+            long int id;
+            T start;
+            T end;
+            size_t count;
+        };
+
+    private:
+        T m_epsilon;
+        unsigned long int m_min_points;
+
+        // ring buffer with a power of two capacity holding the points from
+        // absolute index m_offset to m_size
+        std::vector<T> m_buffer;
+        size_t m_head;
+        size_t m_offset;
+        size_t m_size;
+
+        // neighborhood window [m_low, m_high] of the last finalized point,
+        // the next point to finalize and the first point since the last core
+        // not yet in a cluster
+        size_t m_low;
+        size_t m_high;
+        size_t m_next;
+        size_t m_pending;
+
+        bool m_open;
+        T m_last_core;
+        Cluster m_cluster;
+        long int m_cluster_count;
+        std::deque<Cluster> m_finished;
+
+        T & at(const size_t index) {
+            return m_buffer[(m_head + index - m_offset) & (m_buffer.size() - 1)];
+        }
+
+        void grow() {
+            std::vector<T> buffer(std::max<size_t>(16, 2 * m_buffer.size()));
+            for (size_t index = m_offset; index < m_size; ++index) {
+                buffer[index - m_offset] = at(index);
+            }
+            m_buffer.swap(buffer);
+            m_head = 0;
+        }
+
+        void trim(const size_t index) {
+            if (!m_buffer.empty()) {
+                m_head = (m_head + index - m_offset) & (m_buffer.size() - 1);
+            }
+            m_offset = index;
+        }
+
+        void close() {
+            m_finished.push_back(m_cluster);
+            m_open = false;
+        }
+
+        void finalize(const size_t index) {
+            const T value = at(index);
+            if (m_open && value - m_last_core > m_epsilon) {
+                close();
+            }
+            while (value - at(m_low) > m_epsilon) {
+                ++m_low;
+            }
+            m_high = std::max(m_high, index);
+            while (m_high + 1 < m_size && at(m_high + 1) - value <= m_epsilon) {
+                ++m_high;
+            }
 
+            if (m_high - m_low + 1 >= m_min_points) {
+                if (!m_open) {
+                    // unassigned points since the last cluster that are
+                    // within epsilon before this core join it
+                    const size_t first = std::max(m_pending, m_low);
+                    m_cluster.id = m_cluster_count++;
+                    m_cluster.start = at(first);
+                    m_cluster.count = index - first;
+                    m_open = true;
+                }
+                m_last_core = value;
+            } else if (!m_open || value - m_last_core > m_epsilon) {
+                return;
+            }
+            m_cluster.end = value;
+            ++m_cluster.count;
+            m_pending = index + 1;
+        }
+
+        void advance(const bool flush) {
+            while (m_next < m_size && (flush || at(m_size - 1) - at(m_next) > m_epsilon)) {
+                finalize(m_next++);
+            }
+            if (m_open && (m_next == m_size ? flush : at(m_next) - m_last_core > m_epsilon)) {
+                close();
+            }
+            // points before the window of the last finalized point can
+            // neither be counted nor join a later core
+            m_pending = std::max(m_pending, m_low);
+            trim(m_low);
+        }
+
+    public:
+        StreamingDBPack(const T epsilon, const unsigned long int min_points): m_head(0), m_offset(0), m_size(0), m_low(0), m_high(0), m_next(0), m_pending(0), m_open(false), m_last_core(), m_cluster(), m_cluster_count(0) {
+            assert(epsilon > 0);
+            assert(min_points > 0);
+            m_epsilon = epsilon;
+            m_min_points = min_points;
+        }
+        virtual ~StreamingDBPack() {};
+
+        T getEpsilon() {
+            return this->m_epsilon;
+        }
+
+        long int getMinPoints() {
+            return this->m_min_points;
+        }
+
+        // number of points pushed so far
+        size_t size() const {
+            return m_size;
+        }
+
+        // number of points currently buffered
+        size_t buffered() const {
+            return m_size - m_offset;
+        }
+
+        void push(const T value) {
+            assert(m_size == m_offset || value >= at(m_size - 1));
+            if (m_size - m_offset == m_buffer.size()) {
+                grow();
+            }
+            ++m_size;
+            at(m_size - 1) = value;
+            advance(false);
+        }
+
+        // ends the stream, finishing every open cluster; later pushes start
+        // a new stream whose cluster ids continue from this one
+        void flush() {
+            advance(true);
+            m_low = m_high = m_next = m_pending = m_size;
+            trim(m_size);
+        }
+
+        bool has_finished() const {
+            return !m_finished.empty();
+        }
 
+        // oldest finished cluster not yet taken; clusters wait here until
+        // taken, so drain them to keep memory bounded
+        Cluster pop_finished() {
+            assert(has_finished());
+            Cluster cluster = m_finished.front();
+            m_finished.pop_front();
+            return cluster;
         }
     };
 
@@ -3,10 +3,15 @@
 
 #include <vector>
 #include <math.h>
+#include <cstddef>
 #include <limits>
 
 namespace distance {
 
+    // mean radius of the Earth, for the great-circle distances
+    const double EARTH_RADIUS_KM = 6371.0088;
+    const double EARTH_RADIUS_M = 6371008.8;
+
     template <typename T>
     T sad(std::vector<T> point1, std::vector<T> point2) {
         // Sum of Absolute Difference (SAD)
@@ -157,6 +162,99 @@ namespace distance {
         return distance;
     }
 
+    template <typename T>
+    T angular(std::vector<T> point1, std::vector<T> point2) {
+        // Angle between the vectors, scaled to [0, 1].  Unlike 1 - cos, this
+        // is a metric; a cosine distance c is an angular distance
+        // acos(1 - c) / pi.
+        std::size_t dimension1 = point1.size();
+        std::size_t dimension2 = point2.size();
+        if (dimension1 != dimension2){
+            return -1;
+        }
+        T x_sum = 0.0;
+        T y_sum = 0.0;
+        T xy_sum = 0.0;
+        for (std::size_t i = 0; i < dimension1; i++){
+            xy_sum += point1[i] * point2[i];
+            x_sum += point1[i] * point1[i];
+            y_sum += point2[i] * point2[i];
+        }
+        T similarity = xy_sum / sqrt(x_sum * y_sum);
+        similarity = similarity > 1 ? 1 : (similarity < -1 ? -1 : similarity);
+        return acos(similarity) / M_PI;
+    }
+
+    template <typename T>
+    T haversine(std::vector<T> point1, std::vector<T> point2) {
+        // Great-circle distance in kilometers between (latitude, longitude)
+        // points given in degrees
+        if (point1.size() != 2 || point2.size() != 2){
+            return -1;
+        }
+        const T radians = M_PI / 180.0;
+        T dlat = (point2[0] - point1[0]) * radians;
+        T dlon = (point2[1] - point1[1]) * radians;
+        T a = pow(sin(dlat / 2), 2) + cos(point1[0] * radians) * cos(point2[0] * radians) * pow(sin(dlon / 2), 2);
+        return 2 * EARTH_RADIUS_KM * asin(sqrt(a > 1 ? 1 : a));
+    }
+
+    // whether distance_func is euclidean, which estimators can then answer
+    // with a KD-tree
+    template <typename T>
+    bool is_euclidean(T (* distance_func)(std::vector<T>, std::vector<T>)) {
+        return distance_func == euclidean<T>;
+    }
+
+    template <typename T, typename R>
+    bool is_euclidean(R (*)(std::vector<T>, std::vector<T>)) {
+        return false;
+    }
+
+    // whether distance_func is one of the metrics with a row functor below,
+    // which the metric indices can then call without copying rows
+    template <typename T>
+    bool is_canberra(T (* distance_func)(std::vector<T>, std::vector<T>)) {
+        return distance_func == canberra<T>;
+    }
+
+    template <typename T, typename R>
+    bool is_canberra(R (*)(std::vector<T>, std::vector<T>)) {
+        return false;
+    }
+
+    template <typename T>
+    bool is_chebyshev(T (* distance_func)(std::vector<T>, std::vector<T>)) {
+        return distance_func == chebyshev<T>;
+    }
+
+    template <typename T, typename R>
+    bool is_chebyshev(R (*)(std::vector<T>, std::vector<T>)) {
+        return false;
+    }
+
+    template <typename T>
+    bool is_angular(T (* distance_func)(std::vector<T>, std::vector<T>)) {
+        return distance_func == angular<T>;
+    }
+
+    template <typename T, typename R>
+    bool is_angular(R (*)(std::vector<T>, std::vector<T>)) {
+        return false;
+    }
+
+    // whether distance_func is haversine, which estimators can then answer
+    // with a GeoCellIndex
+    template <typename T>
+    bool is_haversine(T (* distance_func)(std::vector<T>, std::vector<T>)) {
+        return distance_func == haversine<T>;
+    }
+
+    template <typename T, typename R>
+    bool is_haversine(R (*)(std::vector<T>, std::vector<T>)) {
+        return false;
+    }
+
     template <class T, class T2>
     T hausdorff(std::vector<T> &point1, std::vector<T> &point2, T (* distance_func)(T, T)) {
         std::size_t point1_size = point1.size();
@@ -204,6 +302,140 @@ namespace distance {
     }
 
 
+    /*
+    Functors over raw rows of dims values, called as
+    distance(row1, row2, dims), for the metric indices (VPTree, ...).  All
+    of them are metrics, so indices may prune with the triangle
+    inequality.
+    */
+
+    struct Euclidean {
+        template <typename T>
+        double operator()(const T *point1, const T *point2, const std::size_t dims) const {
+            double distance = 0.0;
+            for (std::size_t i = 0; i < dims; i++){
+                double value = point1[i] - point2[i];
+                distance += value * value;
+            }
+            return sqrt(distance);
+        }
+    };
+
+    struct Manhattan {
+        template <typename T>
+        double operator()(const T *point1, const T *point2, const std::size_t dims) const {
+            double distance = 0.0;
+            for (std::size_t i = 0; i < dims; i++){
+                distance += fabs(static_cast<double>(point1[i]) - point2[i]);
+            }
+            return distance;
+        }
+    };
+
+    struct Chebyshev {
+        template <typename T>
+        double operator()(const T *point1, const T *point2, const std::size_t dims) const {
+            double distance = 0.0;
+            for (std::size_t i = 0; i < dims; i++){
+                double value = fabs(static_cast<double>(point1[i]) - point2[i]);
+                if (value > distance) {
+                    distance = value;
+                }
+            }
+            return distance;
+        }
+    };
+
+    struct Canberra {
+        template <typename T>
+        double operator()(const T *point1, const T *point2, const std::size_t dims) const {
+            // terms where both values are zero count as zero
+            double distance = 0.0;
+            for (std::size_t i = 0; i < dims; i++){
+                double denominator = fabs(static_cast<double>(point1[i])) + fabs(static_cast<double>(point2[i]));
+                if (denominator > 0) {
+                    distance += fabs(static_cast<double>(point1[i]) - point2[i]) / denominator;
+                }
+            }
+            return distance;
+        }
+    };
+
+    struct Angular {
+        // see angular; zero vectors are at distance 0 of each other and 0.5
+        // of everything else
+        template <typename T>
+        double operator()(const T *point1, const T *point2, const std::size_t dims) const {
+            double x_sum = 0.0, y_sum = 0.0, xy_sum = 0.0;
+            for (std::size_t i = 0; i < dims; i++){
+                xy_sum += static_cast<double>(point1[i]) * point2[i];
+                x_sum += static_cast<double>(point1[i]) * point1[i];
+                y_sum += static_cast<double>(point2[i]) * point2[i];
+            }
+            if (x_sum == 0 || y_sum == 0) {
+                return x_sum == y_sum ? 0.0 : 0.5;
+            }
+            double similarity = xy_sum / sqrt(x_sum * y_sum);
+            similarity = similarity > 1 ? 1 : (similarity < -1 ? -1 : similarity);
+            return acos(similarity) / M_PI;
+        }
+    };
+
+    struct Haversine {
+        // great-circle distance between (latitude, longitude) rows in
+        // degrees, in the unit of radius (kilometers by default)
+        double radius;
+
+        explicit Haversine(const double radius = EARTH_RADIUS_KM): radius(radius) {};
+
+        template <typename T>
+        double operator()(const T *point1, const T *point2, const std::size_t) const {
+            const double radians = M_PI / 180.0;
+            double dlat = (static_cast<double>(point2[0]) - point1[0]) * radians;
+            double dlon = (static_cast<double>(point2[1]) - point1[1]) * radians;
+            double a = pow(sin(dlat / 2), 2) + cos(point1[0] * radians) * cos(point2[0] * radians) * pow(sin(dlon / 2), 2);
+            return 2 * radius * asin(sqrt(a > 1 ? 1 : a));
+        }
+    };
+
+    template <typename T, typename R = T>
+    struct Function {
+        // adapts the std::vector distances of this namespace; copies both
+        // rows on every call, so only for those without a functor above
+        R (* distance)(std::vector<T>, std::vector<T>);
+
+        explicit Function(R (* distance_func)(std::vector<T>, std::vector<T>)): distance(distance_func) {};
+
+        double operator()(const T *point1, const T *point2, const std::size_t dims) const {
+            return distance(std::vector<T>(point1, point1 + dims), std::vector<T>(point2, point2 + dims));
+        }
+    };
+
+
+    // Calls visit(distance) with the row functor above that matches
+    // distance_func, or with Function<T, R> for any other distance, and
+    // returns what visit does; visit needs a template operator() taking
+    // the functor, so indices over the known metrics do not copy rows.
+    template <typename T, typename R, typename Visitor>
+    auto with_row_distance(R (* distance_func)(std::vector<T>, std::vector<T>), const Visitor &visit) -> decltype(visit(Function<T, R>(distance_func))) {
+        if (is_euclidean(distance_func)) {
+            return visit(Euclidean());
+        }
+        if (is_canberra(distance_func)) {
+            return visit(Canberra());
+        }
+        if (is_chebyshev(distance_func)) {
+            return visit(Chebyshev());
+        }
+        if (is_angular(distance_func)) {
+            return visit(Angular());
+        }
+        if (is_haversine(distance_func)) {
+            return visit(Haversine());
+        }
+        return visit(Function<T, R>(distance_func));
+    }
+
     namespace binary {
         template <typename T>
         T yuleqDistance(std::vector<T> obj1, std::vector<T> obj2) {
@@ -7,6 +7,11 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include "pairwise.hpp"
+#include "memberships.hpp"
+#include "kdtree/kdtree.cpp"
+#include "vptree/vptree.cpp"
+#include "geo/cell_index.cpp"
 
 
 inline std::vector<size_t> vector_intersection(std::vector<size_t> &v1, std::vector<size_t> &v2){
@@ -40,47 +45,63 @@ namespace density {
         protected:
             unsigned long int m_min_points;
             double (* m_distance)(std::vector<T>, std::vector<T>);
+            bool m_metric_tree;
 
-            virtual std::vector<size_t> neighbors(const std::vector<std::vector<T> > &distance_matrix, const size_t index, const double &epsilon) {
+            virtual std::vector<size_t> neighbors(const pairwise::CSRMatrix<double> &neighbor_graph, const size_t index, const double &epsilon) {
                 std::vector<size_t> output;
-                std::vector<T> row = distance_matrix.at(index);
-                for(auto it = row.begin(); it != row.end(); ++it) {
-                    size_t index = std::distance(row.begin(), it);
-                    if (*it < epsilon) {
-                        output.push_back(index);
+                const size_t end = neighbor_graph.offsets[index + 1];
+                for(size_t k = neighbor_graph.offsets[index]; k < end; ++k) {
+                    if (neighbor_graph.values[k] < epsilon) {
+                        output.push_back(neighbor_graph.indices[k]);
                     }
                 }
                 return output;
             }
 
-            virtual std::vector<std::vector<double> > calculate_distances(const std::vector<std::vector<T> > &data) {
-                size_t data_size = data.size(), i = 0, j = 0;
-                std::vector<std::vector<double> > output(data_size);
+            double neighbor_distance(const pairwise::CSRMatrix<double> &neighbor_graph, const size_t i, const size_t j) {
+                // distance between two points of the same max-epsilon neighborhood
+                const size_t position = neighbor_graph.find(i, j);
+                assert(position < neighbor_graph.nonzeros());
+                return neighbor_graph.values[position];
+            }
 
+            // neighborhoods through a tree over whichever row functor
+            // distance::with_row_distance picks
+            struct TreeNeighbors {
+                const std::vector<std::vector<T> > &data;
+                const double max_epsilon;
 
-                for(i = 0; i < data_size; ++i) {
-                    std::vector<double> row(data_size);
-                    output.at(i) = row;
+                template <typename Distance>
+                pairwise::CSRMatrix<double> operator()(const Distance &distance) const {
+                    const VPTree<T, Distance> tree(data, distance);
+                    return tree.threshold_graph(max_epsilon);
                 }
-                #pragma omp parallel for if(data_size > 2000) private(i, j) shared(data)
-                for (i = 0; i < data_size; ++i) {
-                    std::vector<T> point1, point2;
-                    point1 = data.at(i);
-                    for(j = i; j < data_size; ++j) {
-                        point2 = data.at(j);
-                        double dist;
-                        if (j == i || point1 == point2) {
-                            dist = 0;
-                        } else {
-                            dist = m_distance(point1, point2);
-                        }
-                        #pragma omp critical
-                        output[i][j] = dist;
-                        #pragma omp critical
-                        output[j][i] = dist;
-                    }
+            };
+
+            virtual pairwise::CSRMatrix<double> calculate_neighbors(const std::vector<std::vector<T> > &data, const double &max_epsilon) {
+                // every neighborhood the estimators query is bounded by
+                // max_epsilon, so only those pairs are kept
+                if (distance::is_euclidean(m_distance)) {
+                    KDTree<T> tree(data);
+                    return tree.template self_join<double>(max_epsilon);
                 }
-                return output;
+                if (distance::is_haversine(m_distance) && !data.empty() && data[0].size() == 2) {
+                    const GeoCellIndex<T> index(data, max_epsilon);
+                    return index.threshold_graph(max_epsilon);
+                }
+                if (m_metric_tree) {
+                    // only valid when the distance is a metric
+                    const TreeNeighbors visit = {data, max_epsilon};
+                    return distance::with_row_distance(m_distance, visit);
+                }
+                double (* distance_func)(std::vector<T>, std::vector<T>) = m_distance;
+                auto distance = [distance_func](const std::vector<T> &point1, const std::vector<T> &point2) {
+                    if (point1 == point2) {
+                        return 0.0;
+                    }
+                    return distance_func(point1, point2);
+                };
+                return pairwise::pdist_threshold<double>(data, distance, max_epsilon);
             }
 
         public:
@@ -88,8 +109,21 @@ namespace density {
                 assert(min_points > 0);
                 m_min_points = min_points;
                 m_distance = distance_func;
+                m_metric_tree = false;
             }
             virtual ~BaseDBSCAN() {};
+
+            // Find neighborhoods with a VPTree instead of all pairs.  Only for
+            // distances that are metrics (chebyshev, canberra, angular,
+            // haversine, ...), as the tree prunes with the triangle
+            // inequality.
+            void setMetricTree(const bool metricTree) {
+                this->m_metric_tree = metricTree;
+            }
+
+            bool getMetricTree() {
+                return this->m_metric_tree;
+            }
             std::vector<std::map<int, double> > predict(std::vector<std::vector<T> > &data) {
                 std::vector<std::map<int, double> > clusters;
                 return clusters;
@@ -105,7 +139,7 @@ namespace density {
             unsigned long int m_max_points;
             double (* m_distance)(std::vector<T>, std::vector<T>);
 
-            void expand_cluster(const std::vector<std::vector<T> > &distance_matrix, const size_t index, std::vector<size_t> index_neighbors, std::vector<std::map<int, double> > &clusters, int cluster_id) {
+            void expand_cluster(const pairwise::CSRMatrix<double> &neighbor_graph, const size_t index, std::vector<size_t> index_neighbors, MembershipBuilder<double, int> &clusters, int cluster_id) {
                 std::vector<size_t> seed_neighbors = index_neighbors, n_neighbors, n_n_neighbors, visited;
                 visited.push_back(index);
                 std::vector<T> neighbor;
@@ -120,7 +154,7 @@ namespace density {
                         continue;
                     }
                     visited.push_back(seed);
-                    n_neighbors = this->neighbors(distance_matrix, seed, m_epsilon);
+                    n_neighbors = this->neighbors(neighbor_graph, seed, m_epsilon);
                     if (n_neighbors.size() >= m_min_points) {
                         for(auto n_it = n_neighbors.begin(); n_it != n_neighbors.end(); ++n_it) {
                             n_index = *n_it;
@@ -129,20 +163,20 @@ namespace density {
                             }
                             seed_neighbors.push_back(n_index);
                         }
-                        clusters.at(seed)[cluster_id] = membership(n_neighbors);
+                        clusters.set(seed, cluster_id, membership(n_neighbors));
                     }
-                    assigned = clusters.at(seed).empty() || clusters.at(seed).find(-1) != clusters.at(seed).end();
+                    assigned = clusters.empty(seed) || clusters.noise(seed);
                     if (assigned) {
                         min_membership = 1.0;
                         for(auto n_it = n_neighbors.begin(); n_it != n_neighbors.end(); ++n_it) {
                             n_index = *n_it;
-                            n_n_neighbors = this->neighbors(distance_matrix, n_index, m_epsilon);
+                            n_n_neighbors = this->neighbors(neighbor_graph, n_index, m_epsilon);
                             cluster_membership = membership(n_n_neighbors);
                             if (cluster_membership > 0 && cluster_membership < min_membership) {
                                 min_membership = cluster_membership;
                             }
                         }
-                        clusters.at(seed)[cluster_id] = min_membership;
+                        clusters.set(seed, cluster_id, min_membership);
                     }
                 }
             }
@@ -171,33 +205,42 @@ namespace density {
                 }
                 ~CoreDBSCAN() {};
 
-                std::vector<std::map<int, double> > predict(const std::vector<std::vector<T> > &data) {
+                // memberships of every point, noise as cluster -1
+                Memberships<double, int> cluster_memberships(const std::vector<std::vector<T> > &data) {
                     const std::size_t sample_count = data.size();
-                    std::vector<std::map<int, double> > clusters(sample_count);
+                    MembershipBuilder<double, int> clusters(sample_count);
 
                     int cluster_id = 0;
                     int index;
                     double cluster_membership;
 
-                    const std::vector<std::vector<double> > distance_matrix = this->calculate_distances(data);
+                    const pairwise::CSRMatrix<double> neighbor_graph = this->calculate_neighbors(data, m_epsilon);
                     for(auto it = data.begin(); it != data.end(); ++it) {
                         index = std::distance(data.begin(), it);
-                        if (!clusters.at(index).empty()) {
+                        if (!clusters.empty(index)) {
                             continue;
                         }
 
-                        std::vector<size_t> point_neighbors = this->neighbors(distance_matrix, index, m_epsilon);
+                        std::vector<size_t> point_neighbors = this->neighbors(neighbor_graph, index, m_epsilon);
                         if (point_neighbors.size() < m_min_points) {
-                            clusters.at(index)[-1] = 1.0;
+                            clusters.set(index, -1, 1.0);
                         }
                         else {
                             cluster_membership = membership(point_neighbors);
-                            clusters.at(index)[cluster_id] = cluster_membership;
-                            expand_cluster(distance_matrix, index, point_neighbors, clusters, cluster_id);
+                            clusters.set(index, cluster_id, cluster_membership);
+                            expand_cluster(neighbor_graph, index, point_neighbors, clusters, cluster_id);
                             cluster_id += 1;
                          }
                     }
-                    return clusters;
+                    return clusters.build();
+                }
+
+                std::vector<std::map<int, double> > predict(const std::vector<std::vector<T> > &data) {
+                    return cluster_memberships(data).to_maps();
+                }
+
+                Memberships<float, int> predict_csr(const std::vector<std::vector<T> > &data) {
+                    return Memberships<float, int>(cluster_memberships(data));
                 }
         };
 
@@ -210,11 +253,11 @@ namespace density {
             unsigned long int m_min_points;
             double (* m_distance)(std::vector<T>, std::vector<T>);
 
-            void expand_cluster(const std::vector<std::vector<T> > &distance_matrix, const size_t index, std::vector<size_t> index_neighbors, std::vector<std::map<int, double> > &clusters, int cluster_id, std::vector<bool> &visited) {
+            void expand_cluster(const pairwise::CSRMatrix<double> &neighbor_graph, const size_t index, std::vector<size_t> index_neighbors, MembershipBuilder<double, int> &clusters, int cluster_id, std::vector<bool> &visited) {
                 std::vector<size_t> n_neighbors, fuzzy_border_points, n_fuzzy_border_points;
-                clusters.at(index)[cluster_id] = 1.0;
+                clusters.set(index, cluster_id, 1.0);
                 std::vector<size_t> core = {index};
-                fuzzy_border_points = this->neighbors(distance_matrix, index, m_max_epsilon);
+                fuzzy_border_points = this->neighbors(neighbor_graph, index, m_max_epsilon);
                 // remove core points from  fuzzy border points
                 for(auto it = index_neighbors.begin(); it != index_neighbors.end(); ++it) {
                     fuzzy_border_points.erase(std::remove(fuzzy_border_points.begin(), fuzzy_border_points.end(), *it), fuzzy_border_points.end());
@@ -226,9 +269,9 @@ namespace density {
                 for(i = 0; i < index_neighbors.size(); ++i) {
                     seed = index_neighbors.at(i);
                     visited.at(seed) = true;
-                    n_neighbors = this->neighbors(distance_matrix, seed, m_min_epsilon);
+                    n_neighbors = this->neighbors(neighbor_graph, seed, m_min_epsilon);
                     if (n_neighbors.size() > m_min_points) {
-                        n_fuzzy_border_points = this->neighbors(distance_matrix, seed, m_max_epsilon);
+                        n_fuzzy_border_points = this->neighbors(neighbor_graph, seed, m_max_epsilon);
                         for(auto it = n_neighbors.begin(); it != n_neighbors.end(); ++it) {
                             if(std::find(index_neighbors.begin(), index_neighbors.end(), *it) == index_neighbors.end()) {
                                 index_neighbors.push_back(*it);
@@ -239,7 +282,7 @@ namespace density {
                         // union all fuzzy border points
                         fuzzy_border_points = vector_union(fuzzy_border_points, n_fuzzy_border_points);
                         // add seed as core point to cluster
-                        clusters.at(seed)[cluster_id] = 1.0;
+                        clusters.set(seed, cluster_id, 1.0);
                         core.push_back(seed);
                     } else {
                         fuzzy_border_points.push_back(seed);
@@ -254,24 +297,28 @@ namespace density {
                 // process fuzzy border points
                 i = 0;
                 size_t fuzzy_border_point_count = fuzzy_border_points.size();
+                // memberships are computed in parallel and recorded after
+                std::vector<double> border_memberships(fuzzy_border_point_count);
                 #pragma omp parallel for if(fuzzy_border_point_count > 500) private(i, n_neighbors)
                 for(i = 0; i < fuzzy_border_point_count; ++i) {
                     size_t point_index = fuzzy_border_points[i];
-                    n_neighbors = this->neighbors(distance_matrix, point_index, m_max_epsilon);
+                    n_neighbors = this->neighbors(neighbor_graph, point_index, m_max_epsilon);
                     // getting neighbors that are also core objects
                     std::vector<size_t> neighbor_core = vector_intersection(n_neighbors, core);
                     double min_membership = 1.0;
                     for(auto n_it = neighbor_core.begin(); n_it != neighbor_core.end(); ++n_it) {
                         size_t n_seed = *n_it;
-                        double distance = distance_matrix.at(point_index).at(n_seed);
+                        double distance = this->neighbor_distance(neighbor_graph, point_index, n_seed);
                         double cluster_membership = membership(distance);
                         if (cluster_membership > 0 && cluster_membership < min_membership) {
                             min_membership = cluster_membership;
                         }
                     }
-                    clusters.at(point_index)[cluster_id] = min_membership;
+                    border_memberships[i] = min_membership;
+                }
+                for(i = 0; i < fuzzy_border_point_count; ++i) {
+                    clusters.set(fuzzy_border_points[i], cluster_id, border_memberships[i]);
                 }
-
             }
 
             double membership(const double distance) {
@@ -297,9 +344,10 @@ namespace density {
             }
             ~BorderDBSCAN() {};
             
-            std::vector<std::map<int, double> > predict(const std::vector<std::vector<T> > &data) {
+            // memberships of every point, noise as cluster -1
+            Memberships<double, int> cluster_memberships(const std::vector<std::vector<T> > &data) {
                 const std::size_t sample_count = data.size();
-                std::vector<std::map<int, double> > clusters(sample_count);
+                MembershipBuilder<double, int> clusters(sample_count);
                 std::vector<bool> visited(sample_count);
                 std::vector<int> point_types(sample_count);
                 int index;
@@ -307,7 +355,7 @@ namespace density {
                     index = std::distance(data.begin(), it);
                     visited[index] = false;
                 }
-                const std::vector<std::vector<double> > distance_matrix = this->calculate_distances(data);
+                const pairwise::CSRMatrix<double> neighbor_graph = this->calculate_neighbors(data, m_max_epsilon);
                 int cluster_id = 0;
                 for(auto it = data.begin(); it != data.end(); ++it) {
                     index = std::distance(data.begin(), it);
@@ -316,15 +364,23 @@ namespace density {
                     }
 
                     visited.at(index) = true;
-                    std::vector<size_t> point_neighbors = this->neighbors(distance_matrix, index, m_min_epsilon);
+                    std::vector<size_t> point_neighbors = this->neighbors(neighbor_graph, index, m_min_epsilon);
                     if (point_neighbors.size() <= m_min_points) {
-                        clusters.at(index)[-1] = 1.0;
+                        clusters.set(index, -1, 1.0);
                     } else {
-                        expand_cluster(distance_matrix, index, point_neighbors, clusters, cluster_id, visited);
+                        expand_cluster(neighbor_graph, index, point_neighbors, clusters, cluster_id, visited);
                         cluster_id += 1;
                      }
                 }
-                return clusters;
+                return clusters.build();
+            }
+
+            std::vector<std::map<int, double> > predict(const std::vector<std::vector<T> > &data) {
+                return cluster_memberships(data).to_maps();
+            }
+
+            Memberships<float, int> predict_csr(const std::vector<std::vector<T> > &data) {
+                return Memberships<float, int>(cluster_memberships(data));
             }
         };
 
@@ -337,7 +393,7 @@ namespace density {
             unsigned long int m_min_points;
             unsigned long int m_max_points;
 
-            void expand_cluster(const std::vector<std::vector<T> > &distance_matrix, const size_t index, std::vector<size_t> index_neighbors, std::vector<std::map<int, double> > &clusters, int cluster_id, std::vector<bool> &visited) {
+            void expand_cluster(const pairwise::CSRMatrix<double> &neighbor_graph, const size_t index, std::vector<size_t> index_neighbors, MembershipBuilder<double, int> &clusters, int cluster_id, std::vector<bool> &visited) {
                 std::vector<size_t> n_neighbors, n_n_neighbors, core = {index};
                 visited.push_back(index);
                 std::vector<T> neighbor;
@@ -348,8 +404,8 @@ namespace density {
                 for(i = 0; i < index_neighbors.size(); ++i) {
                     seed = index_neighbors.at(i);
                     visited.at(seed) = true;
-                    n_neighbors = this->neighbors(distance_matrix, seed, m_max_epsilon);
-                    n_density = density(distance_matrix, seed, n_neighbors);
+                    n_neighbors = this->neighbors(neighbor_graph, seed, m_max_epsilon);
+                    n_density = density(neighbor_graph, seed, n_neighbors);
                     n_core_membership = core_membership(n_density);
                     if (n_core_membership > 0) {
                         // core point, adding neighbor to seeds if not already a seed
@@ -359,14 +415,14 @@ namespace density {
                             }
                         }
                         core.push_back(seed);
-                        clusters.at(seed)[cluster_id] = n_core_membership;
+                        clusters.set(seed, cluster_id, n_core_membership);
                     } else {
                         // border point
                         double min_membership = 1.0;
                         for (auto n_it = n_neighbors.begin(); n_it != n_neighbors.end(); ++n_it) {
-                            n_distance_membership = distance_membership(distance_matrix.at(seed).at(*n_it));
-                            n_n_neighbors = this->neighbors(distance_matrix, *n_it, m_max_epsilon);
-                            n_density = density(distance_matrix, *n_it, n_n_neighbors);
+                            n_distance_membership = distance_membership(this->neighbor_distance(neighbor_graph, seed, *n_it));
+                            n_n_neighbors = this->neighbors(neighbor_graph, *n_it, m_max_epsilon);
+                            n_density = density(neighbor_graph, *n_it, n_n_neighbors);
                             n_core_membership = core_membership(n_density);
                             if (n_core_membership <= 0 || n_distance_membership <= 0) {
                                 continue;
@@ -378,7 +434,7 @@ namespace density {
                                 min_membership = n_distance_membership;
                             }
                         }
-                        clusters.at(seed)[cluster_id] = min_membership;
+                        clusters.set(seed, cluster_id, min_membership);
                     }
                 }
             }
@@ -405,11 +461,10 @@ namespace density {
                 return neighbor_difference / min_max_difference;
             }
 
-            double density(const std::vector<std::vector<T> > &distance_matrix, const int index, const std::vector<size_t> &neighbors) {
+            double density(const pairwise::CSRMatrix<double> &neighbor_graph, const int index, const std::vector<size_t> &neighbors) {
                 double output = 0.0;
-                const std::vector<double> row = distance_matrix.at(index);
                 for(auto it = neighbors.begin(); it != neighbors.end(); ++it) {
-                    output += distance_membership(row.at(*it));
+                    output += distance_membership(this->neighbor_distance(neighbor_graph, index, *it));
                 }
                 return output;
             }
@@ -430,9 +485,10 @@ namespace density {
                 m_distance = distance_func;
             }
             ~DBSCAN() {};
-            std::vector<std::map<int, double> > predict(std::vector<std::vector<T> > &data) {
+            // memberships of every point, noise as cluster -1
+            Memberships<double, int> cluster_memberships(std::vector<std::vector<T> > &data) {
                 const std::size_t sample_count = data.size();
-                std::vector<std::map<int, double> > clusters(sample_count);
+                MembershipBuilder<double, int> clusters(sample_count);
                 std::vector<bool> visited(sample_count);
                 std::vector<int> point_types(sample_count);
 
@@ -442,7 +498,7 @@ namespace density {
                     visited[index] = false;
                 }
 
-                const std::vector<std::vector<double> > distance_matrix = this->calculate_distances(data);
+                const pairwise::CSRMatrix<double> neighbor_graph = this->calculate_neighbors(data, m_max_epsilon);
                 int cluster_id = 0;
                 double index_density;
                 double index_core_membership;
@@ -452,18 +508,26 @@ namespace density {
                         continue;
                     }
                     visited.at(index) = true;
-                    std::vector<size_t> point_neighbors = this->neighbors(distance_matrix, index, m_max_epsilon);
-                    index_density = density(distance_matrix, index, point_neighbors);
+                    std::vector<size_t> point_neighbors = this->neighbors(neighbor_graph, index, m_max_epsilon);
+                    index_density = density(neighbor_graph, index, point_neighbors);
                     index_core_membership = core_membership(index_density);
                     if (index_core_membership == 0) {
-                        clusters.at(index)[-1] = 1.0;
+                        clusters.set(index, -1, 1.0);
                     } else {
                         cluster_id += 1;
-                        clusters.at(index)[cluster_id] = index_core_membership;
-                        expand_cluster(distance_matrix, index, point_neighbors, clusters, cluster_id, visited);
+                        clusters.set(index, cluster_id, index_core_membership);
+                        expand_cluster(neighbor_graph, index, point_neighbors, clusters, cluster_id, visited);
                      }
                 }
-                return clusters;
+                return clusters.build();
+            }
+
+            std::vector<std::map<int, double> > predict(std::vector<std::vector<T> > &data) {
+                return cluster_memberships(data).to_maps();
+            }
+
+            Memberships<float, int> predict_csr(std::vector<std::vector<T> > &data) {
+                return Memberships<float, int>(cluster_memberships(data));
             }
         };
     }
@@ -6,7 +6,10 @@
 #include <vector>
 #include <algorithm>
 #include <map>
+#include <numeric>
 #include <stdlib.h>
+#include "gap_split.hpp"
+#include "memberships.hpp"
 
 namespace density {
 
@@ -20,20 +23,21 @@ namespace density {
             T2 m_min_points;
 
         protected:
-            virtual std::vector<size_t> neighbors(const std::vector<T1> &data, size_t index, const T1 &epsilon) {
+            // neighbors of data[index] among the sample_count sorted values
+            // at data, which is a chunk of the input and not a copy
+            virtual std::vector<size_t> neighbors(const T1 *data, const size_t sample_count, size_t index, const T1 &epsilon) {
                 std::vector<size_t> output;
-                T1 start_point = data.at(index);
-                for(size_t i = index; i > 0; --i) {
-                    T1 distance = abs(start_point - data.at(i));
+                T1 start_point = data[index];
+                for(size_t i = index + 1; i-- > 0;) {
+                    T1 distance = abs(start_point - data[i]);
                     if (distance >= epsilon) {
                         break;
                     }
                     output.push_back(i);
                 }
 
-                size_t sample_count = data.size();
                 for(size_t i = index + 1; i < sample_count; ++i) {
-                    T1 distance = abs(start_point - data.at(i));
+                    T1 distance = abs(start_point - data[i]);
                     if (distance >= epsilon) {
                         break;
                     }
@@ -51,6 +55,65 @@ namespace density {
 
             virtual ~BaseDBPack() {};
 
+        protected:
+            // clusters of the sample_count sorted values at data on their
+            // own, numbered from 0
+            virtual void predict_chunk(const T1 *data, const size_t sample_count, MembershipBuilder<T1, T2> &clusters) = 0;
+
+            // gaps at least this wide are never crossed by predict_chunk
+            virtual T1 separation() {
+                return m_min_eps;
+            }
+
+            Memberships<T1, T2> predict_chunks(const std::vector<T1> &data) {
+                // cuts the data at gaps of at least separation(), runs
+                // predict_chunk on each chunk on its own thread and joins the
+                // chunks' rows, offsetting each chunk's cluster ids by the
+                // clusters before it
+                const size_t sample_count = data.size();
+                const T1 gap = this->separation();
+                const std::vector<size_t> starts = gap_boundaries(data.data(), sample_count, default_chunk_count(sample_count), [gap](const T1 previous, const T1 next) {
+                    return next - previous >= gap;
+                });
+                const long int chunks = static_cast<long int>(starts.size()) - 1;
+                std::vector<Memberships<T1, T2> > chunk_clusters(chunks);
+                std::vector<T2> offsets(chunks + 1, 0);
+                std::vector<size_t> positions(chunks + 1, 0);
+                #pragma omp parallel for if(chunks > 1)
+                for (long int chunk = 0; chunk < chunks; ++chunk) {
+                    const size_t chunk_size = starts[chunk + 1] - starts[chunk];
+                    MembershipBuilder<T1, T2> builder(chunk_size);
+                    this->predict_chunk(data.data() + starts[chunk], chunk_size, builder);
+                    chunk_clusters[chunk] = builder.build();
+                    for (size_t k = 0; k < chunk_clusters[chunk].nonzeros(); ++k) {
+                        offsets[chunk + 1] = std::max(offsets[chunk + 1], static_cast<T2>(chunk_clusters[chunk].clusters[k] + 1));
+                    }
+                    positions[chunk + 1] = chunk_clusters[chunk].nonzeros();
+                }
+                std::partial_sum(offsets.begin(), offsets.end(), offsets.begin());
+                std::partial_sum(positions.begin(), positions.end(), positions.begin());
+
+                Memberships<T1, T2> clusters;
+                clusters.offsets.resize(sample_count + 1);
+                clusters.offsets[sample_count] = positions[chunks];
+                clusters.clusters.resize(positions[chunks]);
+                clusters.values.resize(positions[chunks]);
+                #pragma omp parallel for if(chunks > 1)
+                for (long int chunk = 0; chunk < chunks; ++chunk) {
+                    const Memberships<T1, T2> &part = chunk_clusters[chunk];
+                    for (size_t i = 0; i < part.size(); ++i) {
+                        clusters.offsets[starts[chunk] + i] = positions[chunk] + part.offsets[i];
+                    }
+                    for (size_t k = 0; k < part.nonzeros(); ++k) {
+                        clusters.clusters[positions[chunk] + k] = part.clusters[k] < 0 ? part.clusters[k] : part.clusters[k] + offsets[chunk];
+                    }
+                    std::copy(part.values.begin(), part.values.end(), clusters.values.begin() + positions[chunk]);
+                }
+                return clusters;
+            }
+
+        public:
+
             void setMinEpsilon(const T1 epsilon) {
                 this->m_min_eps = epsilon;
             }
@@ -67,7 +130,7 @@ namespace density {
                 return this->m_min_points;
             }
 
-            std::vector<std::map<T2, T1> > predict(const std::vector<T1> data) {
+            std::vector<std::map<T2, T1> > predict(const std::vector<T1> &data) {
                 const std::size_t sample_count = data.size();
                 std::vector<std::map<T2, T1> > clusters(sample_count);
                 return clusters;
@@ -84,38 +147,57 @@ namespace density {
 
         protected:
             T1 core_membership(size_t neighbor_count) {
-                if (neighbor_count >= m_max_points) {
+                if (neighbor_count >= static_cast<size_t>(m_max_points)) {
                     return 1.0;
-                } else if (neighbor_count <= m_min_points) {
+                } else if (neighbor_count <= static_cast<size_t>(m_min_points)) {
                     return 0.0;
                 }
                 T1 difference = m_max_points - m_min_points;
                 return (neighbor_count - m_min_points) / difference;
             }
 
-            void expand_cluster(const std::vector<T1> &data, size_t &max_index, std::vector<size_t> neighbors, std::vector<std::map<T2, T1> > &clusters, const T2 cluster) {
-                clusters.at(max_index)[cluster] = this->core_membership(neighbors.size());
-                const size_t sample_count = data.size();
-                ++max_index;
-                while (max_index < sample_count) {
-                    if(std::find(neighbors.begin(), neighbors.end(), max_index) == neighbors.end()) {
+            void expand_cluster(const T1 *data, const size_t sample_count, size_t &max_index, std::vector<size_t> neighbors, MembershipBuilder<T1, T2> &clusters, const T2 cluster) {
+                clusters.set(max_index, cluster, this->core_membership(neighbors.size()));
+                while (max_index + 1 < sample_count) {
+                    const size_t index = max_index + 1;
+                    if(std::find(neighbors.begin(), neighbors.end(), index) == neighbors.end()) {
                         break;
                     }
-                    std::vector<size_t> n_neighbors = this->neighbors(data, max_index, this->m_min_eps);
-                    if (n_neighbors.size() > m_min_points) {
-                        clusters.at(max_index)[cluster] = this->core_membership(n_neighbors.size());
+                    std::vector<size_t> n_neighbors = this->neighbors(data, sample_count, index, this->m_min_eps);
+                    if (n_neighbors.size() > static_cast<size_t>(m_min_points)) {
+                        clusters.set(index, cluster, this->core_membership(n_neighbors.size()));
                     } else {
                         T1 min_membership = 1.0;
                         for (size_t i = 0; i < n_neighbors.size(); ++i) {
-                            std::vector<size_t> n_n_neighbors = this->neighbors(data, neighbors[i], this->m_min_eps);
+                            std::vector<size_t> n_n_neighbors = this->neighbors(data, sample_count, n_neighbors[i], this->m_min_eps);
                             T1 membership = this->core_membership(n_n_neighbors.size());
                             if (membership > 0.0 && membership < min_membership) {
                                 min_membership = membership;
                             }
                         }
-                        clusters.at(max_index)[cluster] = min_membership;
+                        clusters.set(index, cluster, min_membership);
                     }
                     neighbors = n_neighbors;
+                    max_index = index;
+                }
+            }
+
+            T1 separation() {
+                return m_min_eps;
+            }
+
+            void predict_chunk(const T1 *data, const size_t sample_count, MembershipBuilder<T1, T2> &clusters) {
+                size_t cluster = 0;
+                size_t max_index = 0;
+                while (max_index < sample_count) {
+                    std::vector<size_t> neighbors = this->neighbors(data, sample_count, max_index, m_min_eps);
+                    if (neighbors.size() <= static_cast<size_t>(m_min_points)) {
+                        clusters.set(max_index, -1, 1.0);
+                    } else {
+                        this->expand_cluster(data, sample_count, max_index, neighbors, clusters, cluster);
+                        ++cluster;
+                    }
+                    ++max_index;
                 }
             }
 
@@ -138,22 +220,13 @@ namespace density {
                 return this->m_max_points;
             }
 
-            std::vector<std::map<T2, T1> > predict(const std::vector<T1> data) {
-                const std::size_t sample_count = data.size();
-                std::vector<std::map<T2, T1> > clusters(sample_count);
-                size_t cluster = 0;
-                size_t max_index = 0;
-                while (max_index < sample_count) {
-                    std::vector<size_t> neighbors = this->neighbors(data, max_index, m_min_eps);
-                    if (neighbors.size() <= m_min_points) {
-                        clusters.at(max_index)[-1] = 1.0;
-                    } else {
-                        this->expand_cluster(data, max_index, neighbors, clusters, cluster);
-                        ++cluster;
-                    }
-                    ++max_index;
-                }
-                return clusters;
+            std::vector<std::map<T2, T1> > predict(const std::vector<T1> &data) {
+                return this->predict_chunks(data).to_maps();
+            }
+
+            // predict as flat rows, see Memberships
+            Memberships<float, int> predict_csr(const std::vector<T1> &data) {
+                return Memberships<float, int>(this->predict_chunks(data));
             }
         };
 
@@ -177,9 +250,8 @@ namespace density {
                 return neighbor_difference / min_max_difference;
             }
 
-            void expand_cluster(const std::vector<T1> &data, size_t &max_index, std::vector<size_t> neighbors, std::vector<std::map<T2, T1> > &clusters, const T2 cluster) {
-                const size_t sample_count = data.size();
-                clusters.at(max_index)[cluster] = 1.0;
+            void expand_cluster(const T1 *data, const size_t sample_count, size_t &max_index, std::vector<size_t> neighbors, MembershipBuilder<T1, T2> &clusters, const T2 cluster) {
+                clusters.set(max_index, cluster, 1.0);
                 ++max_index;
                 for (size_t i = max_index; i < sample_count; ++i) {
                     // if not a core neighbor of the previous point, stop
@@ -187,36 +259,57 @@ namespace density {
                         break;
                     }
                     // if does not have the minimum number of neighbors to be a core point, stop
-                    std::vector<size_t> n_neighbors = this->neighbors(data, i, m_min_eps);
-                    if (n_neighbors.size() < m_min_points) {
+                    std::vector<size_t> n_neighbors = this->neighbors(data, sample_count, i, m_min_eps);
+                    if (n_neighbors.size() < static_cast<size_t>(m_min_points)) {
                         break;
                     }
                     neighbors = n_neighbors;
                     max_index = i;
-                    clusters.at(i)[cluster] = 1.0;
+                    clusters.set(i, cluster, 1.0);
                 }
             }
 
-            void expand_border_forward(const std::vector<T1> &data, size_t core_index, std::vector<std::map<T2, T1> > &clusters, const T2 cluster) {
-                const size_t sample_count = data.size();
-                const T1 core_point = data.at(core_index);
+            void expand_border_forward(const T1 *data, const size_t sample_count, size_t core_index, MembershipBuilder<T1, T2> &clusters, const T2 cluster) {
+                const T1 core_point = data[core_index];
                 for (size_t i = core_index; i < sample_count; ++i) {
-                    T1 distance = abs(core_point - data.at(i));
+                    T1 distance = abs(core_point - data[i]);
                     if (distance >= m_max_eps) {
                         break;
                     }
-                    clusters.at(i)[cluster] = this->border_membership(distance);
+                    clusters.set(i, cluster, this->border_membership(distance));
                 }
             }
 
-            void expand_border_backward(const std::vector<T1> &data, const size_t core_index, std::vector<std::map<T2, T1> > &clusters, const T2 cluster) {
-                const T1 core_point = data.at(core_index);
-                for (size_t i = core_index - 1; i > 0; i--) {
-                    T1 distance = abs(core_point - data.at(i));
+            void expand_border_backward(const T1 *data, const size_t core_index, MembershipBuilder<T1, T2> &clusters, const T2 cluster) {
+                const T1 core_point = data[core_index];
+                for (size_t i = core_index; i-- > 0;) {
+                    T1 distance = abs(core_point - data[i]);
                     if (distance >= m_max_eps) {
                         break;
                     }
-                    clusters.at(i)[cluster] = this->border_membership(distance);
+                    clusters.set(i, cluster, this->border_membership(distance));
+                }
+            }
+
+            T1 separation() {
+                return m_max_eps;
+            }
+
+            void predict_chunk(const T1 *data, const size_t sample_count, MembershipBuilder<T1, T2> &clusters) {
+                T2 cluster = 0;
+                size_t max_index = 0;
+                while (max_index < sample_count) {
+                    std::vector<size_t> neighbors = this->neighbors(data, sample_count, max_index, m_min_eps);
+                    if (neighbors.size() >= static_cast<size_t>(m_min_points)) {
+
+                        this->expand_border_backward(data, max_index, clusters, cluster);
+                        this->expand_cluster(data, sample_count, max_index, neighbors, clusters, cluster);
+                        this->expand_border_forward(data, sample_count, max_index, clusters, cluster);
+                        ++cluster;
+                    } else {
+                        clusters.set(max_index, -1, 1.0);
+                    }
+                    ++max_index;
                 }
             }
 
@@ -239,30 +332,25 @@ namespace density {
                 return this->m_max_eps;
             }
 
-            std::vector<std::map<T2, T1> > predict(std::vector<T1> data) {
-                const std::size_t sample_count = data.size();
-                std::vector<std::map<T2, T1> > clusters(sample_count);
-                T2 cluster = 0;
-                size_t max_index = 0;
-                while (max_index < sample_count) {\
-                    std::vector<size_t> neighbors = this->neighbors(data, max_index, m_min_eps);
-                    if (neighbors.size() >= m_min_points) {
+            std::vector<std::map<T2, T1> > predict(const std::vector<T1> &data) {
+                return this->predict_chunks(data).to_maps();
+            }
 
-                        this->expand_border_backward(data, max_index, clusters, cluster);
-                        this->expand_cluster(data, max_index, neighbors, clusters, cluster);
-                        this->expand_border_forward(data, max_index, clusters, cluster);
-                        ++cluster;
-                    } else {
-                        clusters.at(max_index)[-1] = 1.0;
-                    }
-                    ++max_index;
-                }
-                return clusters;
+            // predict as flat rows, see Memberships
+            Memberships<float, int> predict_csr(const std::vector<T1> &data) {
+                return Memberships<float, int>(this->predict_chunks(data));
             }
         };
 
         template <class T1, class T2>
         class DBPack: public BaseDBPack<T1, T2> {
+            // fuzzy::DBSCAN on sorted values: a point's density is the sum
+            // of the distance memberships of the points within m_max_eps of
+            // it, itself included, and its core membership ramps from 0 at
+            // m_min_points to 1 at m_max_points.  Cores within m_max_eps of
+            // each other share a cluster, and every other point belongs to
+            // each cluster of its core neighbors with the least of their
+            // core and distance memberships, or is noise.
         private:
             T1 m_min_eps;
             T1 m_max_eps;
@@ -270,16 +358,105 @@ namespace density {
             T2 m_max_points;
         protected:
 
-            void expand_cluster(const std::vector<T1> &data) {
+            T1 core_membership(const T1 density) {
+                if (density >= m_max_points) {
+                    return 1.0;
+                } else if (density <= m_min_points) {
+                    return 0.0;
+                }
+                const T1 min_max_difference = m_max_points - m_min_points;
+                return (density - m_min_points) / min_max_difference;
+            }
 
+            T1 distance_membership(const T1 distance) {
+                if (distance <= m_min_eps) {
+                    return 1.0;
+                } else if (distance > m_max_eps) {
+                    return 0.0;
+                }
+                const T1 min_max_difference = m_max_eps - m_min_eps;
+                return (m_max_eps - distance) / min_max_difference;
             }
 
-            void expand_border_forward(const std::vector<T1> &data) {
+            // moves [low, high) from the window of the previous index to
+            // the points within m_max_eps of data[index]
+            void advance_window(const T1 *data, const size_t sample_count, const size_t index, size_t &low, size_t &high) {
+                while (data[index] - data[low] >= m_max_eps) {
+                    ++low;
+                }
+                if (high < index + 1) {
+                    high = index + 1;
+                }
+                while (high < sample_count && data[high] - data[index] < m_max_eps) {
+                    ++high;
+                }
+            }
 
+            T1 separation() {
+                return m_max_eps;
             }
 
-            void expand_border_backward(const std::vector<T1> &data) {
+            void predict_chunk(const T1 *data, const size_t sample_count, MembershipBuilder<T1, T2> &clusters) {
+                std::vector<T1> core_memberships(sample_count);
+                size_t low = 0;
+                size_t high = 0;
+                for (size_t i = 0; i < sample_count; ++i) {
+                    this->advance_window(data, sample_count, i, low, high);
+                    T1 density = 0.0;
+                    for (size_t j = low; j < high; ++j) {
+                        density += this->distance_membership(j < i ? data[i] - data[j] : data[j] - data[i]);
+                    }
+                    core_memberships[i] = this->core_membership(density);
+                }
 
+                // cores are numbered in order, a new cluster at every gap of
+                // m_max_eps or more since the previous core
+                std::vector<T2> core_clusters(sample_count, -1);
+                T2 cluster = -1;
+                size_t previous_core = 0;
+                for (size_t i = 0; i < sample_count; ++i) {
+                    if (core_memberships[i] <= 0.0) {
+                        continue;
+                    }
+                    if (cluster < 0 || data[i] - data[previous_core] >= m_max_eps) {
+                        ++cluster;
+                    }
+                    core_clusters[i] = cluster;
+                    previous_core = i;
+                }
+
+                low = 0;
+                high = 0;
+                for (size_t i = 0; i < sample_count; ++i) {
+                    if (core_clusters[i] >= 0) {
+                        clusters.set(i, core_clusters[i], core_memberships[i]);
+                        continue;
+                    }
+                    this->advance_window(data, sample_count, i, low, high);
+                    // the window's cores come in cluster order, so each
+                    // cluster's least membership is recorded once it ends
+                    T2 current = -1;
+                    T1 min_membership = 1.0;
+                    for (size_t j = low; j < high; ++j) {
+                        if (core_clusters[j] < 0) {
+                            continue;
+                        }
+                        if (core_clusters[j] != current) {
+                            if (current >= 0) {
+                                clusters.set(i, current, min_membership);
+                            }
+                            current = core_clusters[j];
+                            min_membership = 1.0;
+                        }
+                        const T1 distance = j < i ? data[i] - data[j] : data[j] - data[i];
+                        min_membership = std::min(min_membership, std::min(core_memberships[j], this->distance_membership(distance)));
+                    }
+                    if (current >= 0) {
+                        clusters.set(i, current, min_membership);
+                    } else {
+                        clusters.set(i, -1, 1.0);
+                    }
+                }
             }
 
         public:
@@ -295,10 +472,13 @@ namespace density {
             }
             ~DBPack() {};
 
-            std::vector<std::map<T2, T1> > predict(std::vector<T1> data) {
-                const std::size_t sample_count = data.size();
-                std::vector<std::map<T2, T1> > clusters(sample_count);
-                return clusters;
+            std::vector<std::map<T2, T1> > predict(const std::vector<T1> &data) {
+                return this->predict_chunks(data).to_maps();
+            }
+
+            // predict as flat rows, see Memberships
+            Memberships<float, int> predict_csr(const std::vector<T1> &data) {
+                return Memberships<float, int>(this->predict_chunks(data));
             }
         };
     }
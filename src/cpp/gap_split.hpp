@@ -0,0 +1,41 @@
+#ifndef GAP_SPLIT_H
+#define GAP_SPLIT_H
+
+#include <algorithm>
+#include <vector>
+#include "pairwise.hpp"
+
+namespace density {
+
+    // Splits sorted data[0..count) into at most chunk_count chunks, each
+    // starting at an i where separated(data[i - 1], data[i]), so that 1-D
+    // clusterings whose reach stops at such gaps can label every chunk on its
+    // own.  Each chunk searches for its start from an even split point
+    // without passing the next one, in parallel.  Returns the chunk starts
+    // followed by count.
+    template <typename T, typename Separated>
+    std::vector<size_t> gap_boundaries(const T *data, const size_t count, const size_t chunk_count, Separated separated) {
+        std::vector<size_t> starts(std::max<size_t>(chunk_count, 1), count);
+        starts[0] = 0;
+        const long int split_count = static_cast<long int>(starts.size());
+        #pragma omp parallel for if(split_count > 2)
+        for (long int chunk = 1; chunk < split_count; ++chunk) {
+            const size_t end = count / split_count * (chunk + 1) + count % split_count * (chunk + 1) / split_count;
+            for (size_t i = std::max<size_t>(1, count / split_count * chunk + count % split_count * chunk / split_count); i < end; ++i) {
+                if (separated(data[i - 1], data[i])) {
+                    starts[chunk] = i;
+                    break;
+                }
+            }
+        }
+        starts.erase(std::remove(starts.begin() + 1, starts.end(), count), starts.end());
+        starts.push_back(count);
+        return starts;
+    }
+
+    inline size_t default_chunk_count(const size_t count) {
+        return count > 2000 ? static_cast<size_t>(pairwise::thread_count()) : 1;
+    }
+}
+
+#endif /* GAP_SPLIT_H */
@@ -0,0 +1,202 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "cell_index.hpp"
+
+template <typename T>
+GeoCellIndex<T>::GeoCellIndex() : m_radius(distance::EARTH_RADIUS_KM), m_band_height(M_PI), m_bands(1) {}
+
+template <typename T>
+GeoCellIndex<T>::GeoCellIndex(const std::vector<std::vector<T> > &point_array, const double &cell_size, const double &radius)
+    : m_radius(radius) {
+    assert(cell_size > 0);
+    assert(radius > 0);
+    // bands and cells are numbered in 32 bits each; cells of the equator
+    // are at least 2 pi / 2^32 radians wide (1 cm on the Earth)
+    m_bands = static_cast<size_t>(std::ceil(M_PI * radius / cell_size));
+    m_bands = std::max<size_t>(1, std::min<size_t>(m_bands, static_cast<size_t>(1) << 31));
+    m_band_height = M_PI / m_bands;
+
+    const size_t count = point_array.size();
+    std::vector<double> angles(2 * count);
+    std::vector<double> units(3 * count);
+    std::vector<std::pair<uint64_t, size_t> > keys(count);
+    long int i = 0;
+    #pragma omp parallel for if(count > 2000)
+    for (i = 0; i < static_cast<long int>(count); i++) {
+        assert(point_array[i].size() >= 2);
+        locate(point_array[i].data(), &angles[2 * i], &units[3 * i]);
+        const size_t band = band_of(angles[2 * i]);
+        const size_t cells = cells_of(band);
+        const size_t cell = std::min(cells - 1, static_cast<size_t>((angles[2 * i + 1] + M_PI) / (2 * M_PI) * cells));
+        keys[i] = std::pair<uint64_t, size_t>(static_cast<uint64_t>(band) << 32 | cell, i);
+    }
+    std::sort(keys.begin(), keys.end());
+
+    m_keys.resize(count);
+    m_order.resize(count);
+    m_angles.resize(2 * count);
+    m_units.resize(3 * count);
+    #pragma omp parallel for if(count > 2000)
+    for (i = 0; i < static_cast<long int>(count); i++) {
+        const size_t index = keys[i].second;
+        m_keys[i] = keys[i].first;
+        m_order[i] = index;
+        std::copy(&angles[2 * index], &angles[2 * index] + 2, &m_angles[2 * i]);
+        std::copy(&units[3 * index], &units[3 * index] + 3, &m_units[3 * i]);
+    }
+}
+
+template <typename T>
+size_t GeoCellIndex<T>::size() const {
+    return m_order.size();
+}
+
+template <typename T>
+double GeoCellIndex<T>::radius() const {
+    return m_radius;
+}
+
+template <typename T>
+size_t GeoCellIndex<T>::band_of(const double &latitude) const {
+    const double band = std::floor((latitude + M_PI / 2) / m_band_height);
+    return band <= 0 ? 0 : std::min(m_bands - 1, static_cast<size_t>(band));
+}
+
+template <typename T>
+size_t GeoCellIndex<T>::cells_of(const size_t &band) const {
+    // as many cells as fit m_band_height wide along the poleward edge
+    const double low = -M_PI / 2 + band * m_band_height;
+    const double edge = std::min(M_PI / 2, std::max(std::fabs(low), std::fabs(low + m_band_height)));
+    const double cells = std::floor(2 * M_PI * std::cos(edge) / m_band_height);
+    return cells < 1 ? 1 : static_cast<size_t>(std::min(cells, 4294967295.0));
+}
+
+template <typename T>
+void GeoCellIndex<T>::locate(const T *pt, double *angles, double *unit) const {
+    const double radians = M_PI / 180.0;
+    const double latitude = pt[0] * radians;
+    double longitude = pt[1] * radians;
+    longitude -= 2 * M_PI * std::floor((longitude + M_PI) / (2 * M_PI));
+    angles[0] = latitude;
+    angles[1] = longitude;
+    unit[0] = std::cos(latitude) * std::cos(longitude);
+    unit[1] = std::cos(latitude) * std::sin(longitude);
+    unit[2] = std::sin(latitude);
+}
+
+template <typename T>
+template <typename Visitor>
+void GeoCellIndex<T>::neighborhood_(const double *angles, const double *unit, const double &rad, Visitor &visit) const {
+    if (rad < 0 || m_keys.empty()) {
+        return;
+    }
+    const double theta = rad / m_radius;
+    // squared chord of the radius; the cells are searched a hair wider
+    // than it so that rounding never drops a point on the edge
+    const double chord = theta >= M_PI ? 2.0 : 2 * std::sin(theta / 2);
+    const double limit = chord * chord;
+    const double reach = theta * (1 + 1e-9) + 1e-12;
+    const double latitude = angles[0];
+    const double longitude = angles[1];
+    const bool pole = latitude - reach <= -M_PI / 2 || latitude + reach >= M_PI / 2;
+    // widest longitude difference of a point within reach, away from poles
+    const double spread = pole ? M_PI : std::asin(std::min(1.0, std::sin(reach) / std::cos(latitude)));
+
+    auto scan = [this, unit, &limit, &visit](const uint64_t low, const uint64_t high) {
+        const size_t begin = std::lower_bound(m_keys.begin(), m_keys.end(), low) - m_keys.begin();
+        const size_t end = std::lower_bound(m_keys.begin() + begin, m_keys.end(), high) - m_keys.begin();
+        for (size_t position = begin; position < end; position++) {
+            const double *other = &m_units[3 * position];
+            const double dx = other[0] - unit[0];
+            const double dy = other[1] - unit[1];
+            const double dz = other[2] - unit[2];
+            const double d2 = dx * dx + dy * dy + dz * dz;
+            if (d2 <= limit) {
+                visit(position, 2 * m_radius * std::asin(std::min(1.0, std::sqrt(d2) / 2)));
+            }
+        }
+    };
+
+    const size_t first = band_of(latitude - reach);
+    const size_t last = band_of(latitude + reach);
+    for (size_t band = first; band <= last; band++) {
+        const uint64_t base = static_cast<uint64_t>(band) << 32;
+        const long int cells = static_cast<long int>(cells_of(band));
+        const long int low = static_cast<long int>(std::floor((longitude - spread + M_PI) / (2 * M_PI) * cells));
+        const long int high = static_cast<long int>(std::floor((longitude + spread + M_PI) / (2 * M_PI) * cells));
+        if (pole || high - low + 1 >= cells) {
+            scan(base, base + (static_cast<uint64_t>(1) << 32));
+        } else if (low < 0) {
+            scan(base + (low + cells), base + cells);
+            scan(base, base + high + 1);
+        } else if (high >= cells) {
+            scan(base + low, base + cells);
+            scan(base, base + (high - cells) + 1);
+        } else {
+            scan(base + low, base + high + 1);
+        }
+    }
+}
+
+template <typename T>
+template <typename Visitor>
+void GeoCellIndex<T>::neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) const {
+    assert(pt.size() >= 2);
+    double angles[2];
+    double unit[3];
+    locate(pt.data(), angles, unit);
+    auto visit_position = [this, &visit](const size_t position, const double d) {
+        visit(m_order[position], d);
+    };
+    neighborhood_(angles, unit, rad, visit_position);
+}
+
+template <typename T>
+std::vector<size_t> GeoCellIndex<T>::neighborhood_indices(const std::vector<T> &pt, const double &rad) const {
+    std::vector<size_t> output;
+    neighborhood_visit(pt, rad, [&output](const size_t index, const double) {
+        output.push_back(index);
+    });
+    return output;
+}
+
+template <typename T>
+size_t GeoCellIndex<T>::count_within(const std::vector<T> &pt, const double &rad) const {
+    size_t count = 0;
+    neighborhood_visit(pt, rad, [&count](const size_t, const double) {
+        count++;
+    });
+    return count;
+}
+
+template <typename T>
+template <typename S>
+pairwise::CSRMatrix<S> GeoCellIndex<T>::threshold_graph(const S &threshold, const bool include_self) const {
+    const size_t count = size();
+    std::vector<std::vector<pairwise::Edge<S> > > buffers(pairwise::thread_count());
+    long int i = 0;
+    // queries in key order, so neighboring queries scan the same cells;
+    // every pair is kept once, by its smaller index
+    #pragma omp parallel for if(count > 2000) schedule(dynamic, 256)
+    for (i = 0; i < static_cast<long int>(count); i++) {
+        std::vector<pairwise::Edge<S> > &buffer = buffers[pairwise::thread_id()];
+        const size_t index = m_order[i];
+        auto visit = [this, &buffer, &index, &threshold](const size_t position, const double d) {
+            const S value = static_cast<S>(d);
+            if (m_order[position] > index && value < threshold) {
+                pairwise::Edge<S> edge = {index, m_order[position], value};
+                buffer.push_back(edge);
+            }
+        };
+        neighborhood_(&m_angles[2 * i], &m_units[3 * i], static_cast<double>(threshold), visit);
+    }
+    return pairwise::edges_to_csr<S>(count, buffers, true, include_self);
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "../distance.hpp"
+#include "../pairwise.hpp"
+
+// Index of (latitude, longitude) points in degrees for great-circle radius
+// queries.  The sphere is cut into latitude bands about cell_size high, and
+// every band into as many longitude cells as fit cell_size wide along its
+// poleward edge, so no cell is narrower than cell_size and their number
+// follows the area.  Points are sorted by (band, cell): a query of radius r
+// visits the bands within r of its latitude and, in each, the run of cells
+// over the longitudes within r, which wraps around the antimeridian and
+// takes the whole band once the query reaches a pole.  Candidates are
+// compared as chords of the unit sphere.  cell_size and all distances are
+// in the unit of radius, kilometers by default (distance::EARTH_RADIUS_M for
+// meters); queries are fastest with cell_size near their radius.
+template <typename T>
+class GeoCellIndex {
+    double m_radius;
+    // height of the bands, in radians
+    double m_band_height;
+    size_t m_bands;
+    // band << 32 | cell of every point, ascending
+    std::vector<uint64_t> m_keys;
+    std::vector<size_t> m_order;
+    // in key order: latitude and longitude in radians, and unit vector
+    std::vector<double> m_angles;
+    std::vector<double> m_units;
+
+    size_t band_of(const double &latitude) const;
+    size_t cells_of(const size_t &band) const;
+
+    // latitude and longitude of pt in radians, the longitude in [-pi, pi),
+    // and its unit vector
+    void locate(const T *pt, double *angles, double *unit) const;
+
+    // Calls visit(position, distance) for every point within rad of the
+    // located query.
+    template <typename Visitor>
+    void neighborhood_(const double *angles, const double *unit, const double &rad,
+                       Visitor &visit) const;
+
+   public:
+    GeoCellIndex();
+    GeoCellIndex(const std::vector<std::vector<T> > &point_array, const double &cell_size,
+                 const double &radius = distance::EARTH_RADIUS_KM);
+
+    size_t size() const;
+    double radius() const;
+
+    // Calls visit(index, distance) for every point within rad of pt.
+    template <typename Visitor>
+    void neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) const;
+
+    std::vector<size_t> neighborhood_indices(const std::vector<T> &pt, const double &rad) const;
+
+    size_t count_within(const std::vector<T> &pt, const double &rad) const;
+
+    // Pairs of indexed points closer than threshold (strictly), in both
+    // directions, as pairwise::pdist_threshold with distance::haversine
+    // would return them; rows are searched in parallel.
+    template <typename S>
+    pairwise::CSRMatrix<S> threshold_graph(const S &threshold, const bool include_self = true) const;
+};
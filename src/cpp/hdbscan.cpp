@@ -0,0 +1 @@
+#include "hdbscan.hpp"
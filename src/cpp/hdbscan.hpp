@@ -0,0 +1,441 @@
+#ifndef HDBSCAN_H
+#define HDBSCAN_H
+
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "kdtree/kdtree.cpp"
+#include "union_find.hpp"
+
+namespace density {
+
+    struct LinkageNode {
+        // merge of two single-linkage nodes; ids below n are points, id n + k
+        // is the node created by the k-th merge
+        size_t left;
+        size_t right;
+        double distance;
+        size_t size;
+    };
+
+    struct CondensedEdge {
+        // parent is a cluster id (n is the root), child is a point (< n) or
+        // a cluster (>= n) leaving parent at density lambda = 1 / distance
+        size_t parent;
+        size_t child;
+        double lambda;
+        size_t size;
+    };
+
+    template <typename T>
+    class HDBSCAN {
+        /*
+        HDBSCAN*: builds the whole DBSCAN* hierarchy over every epsilon at once
+        and keeps the clusters that are most stable across it, so no epsilon
+        has to be chosen.
+
+        min_points: neighborhood size used for core distances (the point
+        itself included, as in DBSCAN)
+        min_cluster_size: smallest group of points still considered a cluster
+
+        Original paper: Density-Based Clustering Based on Hierarchical
+        Density Estimates (Campello, Moulavi, Sander 2013)
+        */
+
+    private:
+        long int m_min_points;
+        long int m_min_cluster_size;
+        std::vector<double> m_core_distances;
+        std::vector<LinkageNode> m_single_linkage_tree;
+        std::vector<CondensedEdge> m_condensed_tree;
+        std::vector<double> m_stabilities;
+
+        std::vector<std::pair<double, size_t> > nearest_neighbors(KDTree<T> &tree, const std::vector<std::vector<T> > &data, const size_t k) {
+            // k nearest neighbors of every point, row-major
+            std::vector<size_t> indices;
+            std::vector<double> distances;
+            tree.nearest_k_batch(data, k, indices, distances);
+            std::vector<std::pair<double, size_t> > output(indices.size());
+            for (size_t i = 0; i < output.size(); ++i) {
+                output[i] = std::make_pair(distances[i], indices[i]);
+            }
+            return output;
+        }
+
+        std::vector<std::pair<double, std::pair<size_t, size_t> > > minimum_spanning_tree(KDTree<T> &tree, const std::vector<std::vector<T> > &data, const std::vector<std::pair<double, size_t> > &neighbors, const size_t k) {
+            // Boruvka: every round each component takes its cheapest
+            // mutual-reachability edge to another component.  Candidates from
+            // the kNN lists give each component an upper bound, and one
+            // dual-tree pass (KDTree::nearest_foreign) finds every point's
+            // cheapest edge under it, pruning pairs of subtrees that lie in
+            // one component or cannot beat the bounds of the query subtree.
+            const size_t sample_count = data.size();
+            const size_t none = std::numeric_limits<size_t>::max();
+            const std::vector<double> &core = m_core_distances;
+            typedef std::pair<double, std::pair<size_t, size_t> > Edge;
+            std::vector<Edge> edges;
+            edges.reserve(sample_count - 1);
+            UnionFind components(sample_count);
+            std::vector<size_t> component(sample_count);
+            std::vector<std::pair<double, size_t> > nearest;
+            std::vector<double> bounds(sample_count);
+            std::vector<Edge> best(sample_count);
+
+            while (edges.size() + 1 < sample_count) {
+                for (size_t i = 0; i < sample_count; ++i) {
+                    component[i] = components.find(i);
+                }
+                std::fill(best.begin(), best.end(), std::make_pair(std::numeric_limits<double>::infinity(), std::make_pair(none, none)));
+                for (size_t i = 0; i < sample_count; ++i) {
+                    for (size_t j = i * k; j < (i + 1) * k; ++j) {
+                        const size_t q = neighbors[j].second;
+                        if (component[q] == component[i]) {
+                            continue;
+                        }
+                        Edge edge = std::make_pair(std::max(neighbors[j].first, std::max(core[i], core[q])), std::make_pair(std::min(i, q), std::max(i, q)));
+                        if (edge < best[component[i]]) {
+                            best[component[i]] = edge;
+                        }
+                    }
+                }
+
+                for (size_t i = 0; i < sample_count; ++i) {
+                    bounds[i] = best[component[i]].first;
+                }
+                nearest = tree.nearest_foreign(component, core, bounds);
+
+                // cheapest edge per component, ties broken by endpoint
+                for (size_t j = 0; j < sample_count; ++j) {
+                    if (nearest[j].second == none) {
+                        continue;
+                    }
+                    Edge edge = std::make_pair(nearest[j].first, std::make_pair(std::min(j, nearest[j].second), std::max(j, nearest[j].second)));
+                    if (edge < best[component[j]]) {
+                        best[component[j]] = edge;
+                    }
+                }
+
+                size_t added = 0;
+                for (size_t c = 0; c < sample_count; ++c) {
+                    if (best[c].second.first == none) {
+                        continue;
+                    }
+                    size_t a = best[c].second.first, b = best[c].second.second;
+                    if (components.find(a) == components.find(b)) {
+                        continue;
+                    }
+                    components.unite(a, b);
+                    edges.push_back(best[c]);
+                    ++added;
+                }
+                if (!added) {
+                    break;
+                }
+            }
+            return edges;
+        }
+
+        std::vector<std::pair<double, std::pair<size_t, size_t> > > graph_spanning_tree(const std::vector<size_t> &indices, const std::vector<double> &distances, const size_t k) {
+            // Kruskal over the mutual-reachability edges of a kNN graph;
+            // components the graph leaves apart are joined at infinite
+            // distance so the hierarchy still has a single root
+            const size_t sample_count = m_core_distances.size();
+            const size_t none = std::numeric_limits<size_t>::max();
+            const std::vector<double> &core = m_core_distances;
+            typedef std::pair<double, std::pair<size_t, size_t> > Edge;
+            std::vector<Edge> candidates;
+            candidates.reserve(sample_count * k);
+            for (size_t i = 0; i < sample_count; ++i) {
+                for (size_t j = i * k; j < (i + 1) * k; ++j) {
+                    const size_t q = indices[j];
+                    if (q == none || q == i) {
+                        continue;
+                    }
+                    candidates.push_back(std::make_pair(std::max(distances[j], std::max(core[i], core[q])), std::make_pair(std::min(i, q), std::max(i, q))));
+                }
+            }
+            std::sort(candidates.begin(), candidates.end());
+
+            std::vector<Edge> edges;
+            edges.reserve(sample_count - 1);
+            UnionFind components(sample_count);
+            for (auto &edge: candidates) {
+                if (components.find(edge.second.first) == components.find(edge.second.second)) {
+                    continue;
+                }
+                components.unite(edge.second.first, edge.second.second);
+                edges.push_back(edge);
+            }
+            for (size_t i = 1; i < sample_count && edges.size() + 1 < sample_count; ++i) {
+                if (components.find(0) != components.find(i)) {
+                    components.unite(0, i);
+                    edges.push_back(std::make_pair(std::numeric_limits<double>::infinity(), std::make_pair(static_cast<size_t>(0), i)));
+                }
+            }
+            return edges;
+        }
+
+        void single_linkage(std::vector<std::pair<double, std::pair<size_t, size_t> > > &edges, const size_t sample_count) {
+            std::sort(edges.begin(), edges.end());
+            m_single_linkage_tree.clear();
+            m_single_linkage_tree.reserve(edges.size());
+            UnionFind components(sample_count);
+            // single-linkage node currently representing each union-find root
+            std::vector<size_t> node(sample_count);
+            std::vector<size_t> node_size(2 * sample_count, 1);
+            for (size_t i = 0; i < sample_count; ++i) {
+                node[i] = i;
+            }
+            for (auto &edge: edges) {
+                size_t a = components.find(edge.second.first), b = components.find(edge.second.second);
+                size_t id = sample_count + m_single_linkage_tree.size();
+                LinkageNode merge = {node[a], node[b], edge.first, node_size[node[a]] + node_size[node[b]]};
+                node_size[id] = merge.size;
+                m_single_linkage_tree.push_back(merge);
+                node[components.unite(a, b)] = id;
+            }
+        }
+
+        void leaves(const size_t root, const size_t sample_count, std::vector<size_t> &output) {
+            std::vector<size_t> stack = {root};
+            while (!stack.empty()) {
+                size_t current = stack.back();
+                stack.pop_back();
+                if (current < sample_count) {
+                    output.push_back(current);
+                    continue;
+                }
+                const LinkageNode &merge = m_single_linkage_tree[current - sample_count];
+                stack.push_back(merge.left);
+                stack.push_back(merge.right);
+            }
+        }
+
+        void condense(const size_t sample_count) {
+            // Walk the single-linkage tree from the top.  A split only creates
+            // two new clusters when both sides have min_cluster_size points;
+            // otherwise the smaller side's points fall out of the cluster.
+            m_condensed_tree.clear();
+            if (m_single_linkage_tree.empty()) {
+                return;
+            }
+            const size_t min_size = static_cast<size_t>(m_min_cluster_size);
+            const size_t root = sample_count + m_single_linkage_tree.size() - 1;
+            std::vector<size_t> relabel(root + 1);
+            relabel[root] = sample_count;
+            size_t next_label = sample_count + 1;
+
+            std::vector<size_t> queue = {root};
+            std::vector<size_t> fallen;
+            for (size_t q = 0; q < queue.size(); ++q) {
+                const size_t current = queue[q];
+                const LinkageNode &merge = m_single_linkage_tree[current - sample_count];
+                const double lambda = merge.distance > 0 ? 1.0 / merge.distance : std::numeric_limits<double>::max();
+                const size_t parent = relabel[current];
+                const size_t children[2] = {merge.left, merge.right};
+                size_t sizes[2];
+                for (size_t c = 0; c < 2; ++c) {
+                    sizes[c] = children[c] < sample_count ? 1 : m_single_linkage_tree[children[c] - sample_count].size;
+                }
+                const bool large[2] = {sizes[0] >= min_size, sizes[1] >= min_size};
+
+                for (size_t c = 0; c < 2; ++c) {
+                    if (large[c] && large[1 - c]) {
+                        // true split
+                        relabel[children[c]] = next_label;
+                        CondensedEdge edge = {parent, next_label, lambda, sizes[c]};
+                        m_condensed_tree.push_back(edge);
+                        ++next_label;
+                        queue.push_back(children[c]);
+                    } else if (large[c]) {
+                        // the cluster continues through this child
+                        relabel[children[c]] = parent;
+                        if (children[c] >= sample_count) {
+                            queue.push_back(children[c]);
+                        }
+                    } else {
+                        fallen.clear();
+                        leaves(children[c], sample_count, fallen);
+                        for (size_t point: fallen) {
+                            CondensedEdge edge = {parent, point, lambda, 1};
+                            m_condensed_tree.push_back(edge);
+                        }
+                    }
+                }
+            }
+        }
+
+        std::vector<int> extract_clusters(const size_t sample_count) {
+            // excess of mass: keep a cluster unless its descendants together
+            // are more stable than it is; the root is never selected
+            std::vector<int> clusters(sample_count, -1);
+            if (m_condensed_tree.empty()) {
+                return clusters;
+            }
+            size_t cluster_count = 1;
+            for (auto &edge: m_condensed_tree) {
+                if (edge.child >= sample_count) {
+                    cluster_count = std::max(cluster_count, edge.child - sample_count + 1);
+                }
+            }
+            std::vector<double> birth(cluster_count, 0.0);
+            std::vector<size_t> parent(cluster_count, 0);
+            for (auto &edge: m_condensed_tree) {
+                if (edge.child >= sample_count) {
+                    birth[edge.child - sample_count] = edge.lambda;
+                    parent[edge.child - sample_count] = edge.parent - sample_count;
+                }
+            }
+            m_stabilities.assign(cluster_count, 0.0);
+            for (auto &edge: m_condensed_tree) {
+                size_t c = edge.parent - sample_count;
+                m_stabilities[c] += (edge.lambda - birth[c]) * edge.size;
+            }
+
+            // clusters are numbered top-down, so children always come after
+            // their parent
+            std::vector<double> subtree(m_stabilities);
+            std::vector<double> children(cluster_count, 0.0);
+            std::vector<bool> selected(cluster_count, false);
+            for (size_t c = cluster_count - 1; c > 0; --c) {
+                if (children[c] > subtree[c]) {
+                    subtree[c] = children[c];
+                } else {
+                    selected[c] = true;
+                }
+                children[parent[c]] += subtree[c];
+            }
+            // a selected ancestor wins over anything below it
+            std::vector<long int> selected_ancestor(cluster_count, -1);
+            std::vector<int> label(cluster_count, -1);
+            int label_count = 0;
+            for (size_t c = 1; c < cluster_count; ++c) {
+                long int inherited = selected_ancestor[parent[c]];
+                if (inherited >= 0) {
+                    selected_ancestor[c] = inherited;
+                } else if (selected[c]) {
+                    selected_ancestor[c] = c;
+                    label[c] = label_count++;
+                }
+            }
+            for (auto &edge: m_condensed_tree) {
+                if (edge.child >= sample_count) {
+                    continue;
+                }
+                long int ancestor = selected_ancestor[edge.parent - sample_count];
+                if (ancestor >= 0) {
+                    clusters[edge.child] = label[ancestor];
+                }
+            }
+            return clusters;
+        }
+
+    public:
+        HDBSCAN(const long int min_points, const long int min_cluster_size) {
+            assert(min_points > 0);
+            assert(min_cluster_size > 1);
+            m_min_points = min_points;
+            m_min_cluster_size = min_cluster_size;
+        }
+        virtual ~HDBSCAN() {};
+
+        void setMinPoints(const long int minPoints) {
+            this->m_min_points = minPoints;
+        }
+
+        long int getMinPoints() {
+            return this->m_min_points;
+        }
+
+        void setMinClusterSize(const long int minClusterSize) {
+            this->m_min_cluster_size = minClusterSize;
+        }
+
+        long int getMinClusterSize() {
+            return this->m_min_cluster_size;
+        }
+
+        const std::vector<double> & getCoreDistances() {
+            return this->m_core_distances;
+        }
+
+        const std::vector<LinkageNode> & getSingleLinkageTree() {
+            return this->m_single_linkage_tree;
+        }
+
+        const std::vector<CondensedEdge> & getCondensedTree() {
+            return this->m_condensed_tree;
+        }
+
+        // stability of every condensed cluster, indexed by cluster id - n
+        const std::vector<double> & getStabilities() {
+            return this->m_stabilities;
+        }
+
+        std::vector<int> predict(const std::vector<std::vector<T> > &data) {
+            const size_t sample_count = data.size();
+            m_core_distances.clear();
+            m_single_linkage_tree.clear();
+            m_condensed_tree.clear();
+            m_stabilities.clear();
+            if (sample_count < 2) {
+                return std::vector<int>(sample_count, -1);
+            }
+
+            KDTree<T> tree(data);
+            const size_t k = std::min(static_cast<size_t>(m_min_points), sample_count);
+            std::vector<std::pair<double, size_t> > neighbors = nearest_neighbors(tree, data, k);
+            m_core_distances.resize(sample_count);
+            for (size_t i = 0; i < sample_count; ++i) {
+                m_core_distances[i] = neighbors[(i + 1) * k - 1].first;
+            }
+            std::vector<std::pair<double, std::pair<size_t, size_t> > > edges = minimum_spanning_tree(tree, data, neighbors, k);
+            single_linkage(edges, sample_count);
+            condense(sample_count);
+            return extract_clusters(sample_count);
+        }
+
+        // HDBSCAN* over a precomputed k-nearest-neighbor graph instead of
+        // the points, given as the flat row-major n x k indices and
+        // distances NNDescent and KDTree::all_nearest_k return: row i
+        // without i itself, closest first, padded with
+        // std::numeric_limits<size_t>::max().  Core distances are read from
+        // the rows, so k should be at least min_points - 1, and the minimum
+        // spanning tree only uses the graph's edges: with an approximate or
+        // short graph the hierarchy can merge later than the exact one.
+        std::vector<int> predict_graph(const std::vector<size_t> &indices, const std::vector<double> &distances, const size_t k) {
+            assert(k > 0);
+            assert(indices.size() == distances.size() && indices.size() % k == 0);
+            const size_t sample_count = indices.size() / k;
+            m_core_distances.clear();
+            m_single_linkage_tree.clear();
+            m_condensed_tree.clear();
+            m_stabilities.clear();
+            if (sample_count < 2) {
+                return std::vector<int>(sample_count, -1);
+            }
+
+            // the point itself is its first neighbor, so the core distance
+            // is the (min_points - 1)-th of the row, or its last real one
+            m_core_distances.assign(sample_count, 0.0);
+            if (m_min_points > 1) {
+                const size_t position = std::min(static_cast<size_t>(m_min_points) - 1, k);
+                for (size_t i = 0; i < sample_count; ++i) {
+                    size_t j = i * k + position;
+                    while (j > i * k && std::isinf(distances[j - 1])) {
+                        --j;
+                    }
+                    m_core_distances[i] = j > i * k ? distances[j - 1] : 0.0;
+                }
+            }
+            std::vector<std::pair<double, std::pair<size_t, size_t> > > edges = graph_spanning_tree(indices, distances, k);
+            single_linkage(edges, sample_count);
+            condense(sample_count);
+            return extract_clusters(sample_count);
+        }
+    };
+}
+
+#endif /* HDBSCAN_H */
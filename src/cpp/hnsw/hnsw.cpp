@@ -0,0 +1,473 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "hnsw.hpp"
+
+template <typename T, typename Distance>
+HNSW<T, Distance>::HNSW(const Distance &distance, const size_t &max_links, const size_t &ef_construction,
+                        const unsigned int &seed)
+    : m_dims(0), m_max_links(max_links), m_ef_construction(ef_construction), m_ef(64),
+      m_level_scale(1.0 / std::log(static_cast<double>(max_links))), m_generator(seed),
+      m_distance(distance), m_entry(std::numeric_limits<size_t>::max()), m_top(0) {
+    assert(max_links > 1);
+    assert(ef_construction > 0);
+}
+
+template <typename T, typename Distance>
+HNSW<T, Distance>::HNSW(const std::vector<std::vector<T> > &point_array, const Distance &distance,
+                        const size_t &max_links, const size_t &ef_construction, const unsigned int &seed)
+    : HNSW(distance, max_links, ef_construction, seed) {
+    insert(point_array);
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::size() const {
+    return m_levels.size();
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::dimensions() const {
+    return m_dims;
+}
+
+template <typename T, typename Distance>
+void HNSW<T, Distance>::set_ef(const size_t &ef) {
+    assert(ef > 0);
+    m_ef = ef;
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::ef() const {
+    return m_ef;
+}
+
+template <typename T, typename Distance>
+const T *HNSW<T, Distance>::point(const size_t &node) const {
+    return m_points.data() + node * m_dims;
+}
+
+template <typename T, typename Distance>
+double HNSW<T, Distance>::distance_(const T *pt, const size_t &node) const {
+    return m_distance(pt, point(node), m_dims);
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::capacity(const size_t &layer) const {
+    return layer == 0 ? 2 * m_max_links : m_max_links;
+}
+
+template <typename T, typename Distance>
+size_t *HNSW<T, Distance>::links(const size_t &node, const size_t &layer) {
+    if (layer == 0) {
+        return &m_links[node * (2 * m_max_links + 1)];
+    }
+    return &m_upper_links[node][(layer - 1) * (m_max_links + 1)];
+}
+
+template <typename T, typename Distance>
+const size_t *HNSW<T, Distance>::links(const size_t &node, const size_t &layer) const {
+    if (layer == 0) {
+        return &m_links[node * (2 * m_max_links + 1)];
+    }
+    return &m_upper_links[node][(layer - 1) * (m_max_links + 1)];
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::draw_level() {
+    // P(level >= l) = M^-l
+    const double uniform = std::uniform_real_distribution<double>(0.0, 1.0)(m_generator);
+    return static_cast<size_t>(-std::log(std::max(uniform, std::numeric_limits<double>::min())) * m_level_scale);
+}
+
+template <typename T, typename Distance>
+void HNSW<T, Distance>::reset(Scratch &scratch) const {
+    if (scratch.marks.size() != size()) {
+        scratch.marks.assign(size(), 0);
+        scratch.mark = 0;
+    }
+    scratch.mark++;
+    if (scratch.mark == 0) {
+        std::fill(scratch.marks.begin(), scratch.marks.end(), 0);
+        scratch.mark = 1;
+    }
+}
+
+template <typename T, typename Distance>
+std::pair<double, size_t> HNSW<T, Distance>::descend(const T *pt, const size_t &layer) const {
+    std::pair<double, size_t> best(distance_(pt, m_entry), m_entry);
+    for (size_t level = m_top; level > layer; level--) {
+        bool moved = true;
+        while (moved) {
+            moved = false;
+            const size_t *neighbors = links(best.second, level);
+            for (size_t i = 1; i <= neighbors[0]; i++) {
+                const double d = distance_(pt, neighbors[i]);
+                if (d < best.first) {
+                    best = std::pair<double, size_t>(d, neighbors[i]);
+                    moved = true;
+                }
+            }
+        }
+    }
+    return best;
+}
+
+template <typename T, typename Distance>
+void HNSW<T, Distance>::search_layer(const T *pt, std::vector< std::pair<double, size_t> > &found,
+                                     const size_t &ef, const size_t &layer, Scratch &scratch) const {
+    // candidates is a min-heap of the nodes left to expand, found a
+    // max-heap of the ef closest so far
+    typedef std::pair<double, size_t> Entry;
+    std::vector<Entry> &candidates = scratch.candidates;
+    candidates.clear();
+    reset(scratch);
+    for (size_t i = 0; i < found.size(); i++) {
+        scratch.marks[found[i].second] = scratch.mark;
+        candidates.push_back(found[i]);
+    }
+    std::make_heap(candidates.begin(), candidates.end(), std::greater<Entry>());
+    std::make_heap(found.begin(), found.end());
+    while (found.size() > ef) {
+        std::pop_heap(found.begin(), found.end());
+        found.pop_back();
+    }
+
+    while (!candidates.empty()) {
+        std::pop_heap(candidates.begin(), candidates.end(), std::greater<Entry>());
+        const Entry current = candidates.back();
+        candidates.pop_back();
+        if (found.size() >= ef && current.first > found.front().first) {
+            break;
+        }
+        const size_t *neighbors = links(current.second, layer);
+        for (size_t i = 1; i <= neighbors[0]; i++) {
+            const size_t node = neighbors[i];
+            if (scratch.marks[node] == scratch.mark) {
+                continue;
+            }
+            scratch.marks[node] = scratch.mark;
+            const double d = distance_(pt, node);
+            if (found.size() < ef || d < found.front().first) {
+                candidates.push_back(Entry(d, node));
+                std::push_heap(candidates.begin(), candidates.end(), std::greater<Entry>());
+                found.push_back(Entry(d, node));
+                std::push_heap(found.begin(), found.end());
+                if (found.size() > ef) {
+                    std::pop_heap(found.begin(), found.end());
+                    found.pop_back();
+                }
+            }
+        }
+    }
+}
+
+template <typename T, typename Distance>
+void HNSW<T, Distance>::select(const std::vector< std::pair<double, size_t> > &candidates, const size_t &count,
+                               std::vector<size_t> &output) const {
+    output.clear();
+    for (size_t i = 0; i < candidates.size() && output.size() < count; i++) {
+        const T *pt = point(candidates[i].second);
+        bool keep = true;
+        for (size_t j = 0; j < output.size() && keep; j++) {
+            keep = distance_(pt, output[j]) >= candidates[i].first;
+        }
+        if (keep) {
+            output.push_back(candidates[i].second);
+        }
+    }
+}
+
+template <typename T, typename Distance>
+void HNSW<T, Distance>::link(const size_t &first, const size_t &last) {
+    const long int count = static_cast<long int>(last - first);
+    std::vector<std::vector<Link> > buffers(pairwise::thread_count());
+
+    // every new node searches the graph as it was before the batch and
+    // links itself; no old node links to a new one yet, so the searches
+    // never read what the others write
+    #pragma omp parallel if(count > 64)
+    {
+        Scratch scratch;
+        std::vector< std::pair<double, size_t> > found;
+        std::vector<size_t> chosen;
+        long int i = 0;
+        #pragma omp for schedule(dynamic, 16)
+        for (i = 0; i < count; i++) {
+            std::vector<Link> &buffer = buffers[pairwise::thread_id()];
+            const size_t node = first + i;
+            const size_t level = m_levels[node];
+            const size_t top = std::min(level, m_top);
+            const T *pt = point(node);
+            found.assign(1, descend(pt, top));
+            for (size_t layer = top + 1; layer-- > 0;) {
+                search_layer(pt, found, m_ef_construction, layer, scratch);
+                std::sort(found.begin(), found.end());
+                select(found, m_max_links, chosen);
+                size_t *own = links(node, layer);
+                own[0] = chosen.size();
+                for (size_t j = 0; j < chosen.size(); j++) {
+                    own[j + 1] = chosen[j];
+                    Link back = {layer, chosen[j], node, distance_(pt, chosen[j])};
+                    buffer.push_back(back);
+                }
+            }
+        }
+    }
+
+    // the links back, grouped by the node they leave from; a node over
+    // capacity keeps the selection of its old and new neighbors
+    std::vector<Link> back;
+    for (size_t b = 0; b < buffers.size(); b++) {
+        back.insert(back.end(), buffers[b].begin(), buffers[b].end());
+    }
+    std::sort(back.begin(), back.end(), [](const Link &a, const Link &b) {
+        return a.layer != b.layer ? a.layer < b.layer : (a.from != b.from ? a.from < b.from : a.to < b.to);
+    });
+    std::vector<size_t> groups;
+    for (size_t i = 0; i < back.size(); i++) {
+        if (i == 0 || back[i].layer != back[i - 1].layer || back[i].from != back[i - 1].from) {
+            groups.push_back(i);
+        }
+    }
+    groups.push_back(back.size());
+    const long int group_count = static_cast<long int>(groups.size()) - 1;
+    #pragma omp parallel if(back.size() > 2000)
+    {
+        std::vector< std::pair<double, size_t> > candidates;
+        std::vector<size_t> chosen;
+        long int g = 0;
+        #pragma omp for schedule(dynamic, 64)
+        for (g = 0; g < group_count; g++) {
+            const size_t layer = back[groups[g]].layer;
+            const size_t node = back[groups[g]].from;
+            size_t *own = links(node, layer);
+            const size_t added = groups[g + 1] - groups[g];
+            if (own[0] + added <= capacity(layer)) {
+                for (size_t i = groups[g]; i < groups[g + 1]; i++) {
+                    own[++own[0]] = back[i].to;
+                }
+                continue;
+            }
+            const T *pt = point(node);
+            candidates.clear();
+            for (size_t i = 1; i <= own[0]; i++) {
+                candidates.push_back(std::pair<double, size_t>(distance_(pt, own[i]), own[i]));
+            }
+            for (size_t i = groups[g]; i < groups[g + 1]; i++) {
+                candidates.push_back(std::pair<double, size_t>(back[i].distance, back[i].to));
+            }
+            std::sort(candidates.begin(), candidates.end());
+            select(candidates, capacity(layer), chosen);
+            own[0] = chosen.size();
+            std::copy(chosen.begin(), chosen.end(), own + 1);
+        }
+    }
+
+    for (size_t node = first; node < last; node++) {
+        if (m_levels[node] > m_top) {
+            m_top = m_levels[node];
+            m_entry = node;
+        }
+    }
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::insert(const std::vector<T> &pt) {
+    return insert(std::vector<std::vector<T> >(1, pt));
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::insert(const std::vector<std::vector<T> > &point_array) {
+    const size_t first = size();
+    if (point_array.empty()) {
+        return first;
+    }
+    if (first == 0) {
+        m_dims = point_array.front().size();
+    }
+    const size_t last = first + point_array.size();
+    m_points.resize(last * m_dims);
+    m_levels.resize(last);
+    m_links.resize(last * (2 * m_max_links + 1), 0);
+    m_upper_links.resize(last);
+    for (size_t node = first; node < last; node++) {
+        assert(point_array[node - first].size() == m_dims);
+        std::copy(point_array[node - first].begin(), point_array[node - first].end(), m_points.begin() + node * m_dims);
+        m_levels[node] = draw_level();
+        m_upper_links[node].assign(m_levels[node] * (m_max_links + 1), 0);
+    }
+
+    size_t done = first;
+    if (done == 0) {
+        m_entry = 0;
+        m_top = m_levels[0];
+        done = 1;
+    }
+    while (done < last) {
+        const size_t batch = std::min(last - done, std::max<size_t>(1, done / 10));
+        link(done, done + batch);
+        done += batch;
+    }
+    return first;
+}
+
+template <typename T, typename Distance>
+std::vector< std::pair<double, size_t> > HNSW<T, Distance>::search(const T *pt, const size_t &ef, Scratch &scratch) const {
+    std::vector< std::pair<double, size_t> > found;
+    if (size() == 0) {
+        return found;
+    }
+    found.assign(1, descend(pt, 0));
+    search_layer(pt, found, ef, 0, scratch);
+    std::sort(found.begin(), found.end());
+    return found;
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::nearest_index(const std::vector<T> &pt) const {
+    std::vector< std::pair<double, size_t> > found = nearest_k(pt, 1);
+    return found.empty() ? std::numeric_limits<size_t>::max() : found.front().second;
+}
+
+template <typename T, typename Distance>
+std::vector< std::pair<double, size_t> > HNSW<T, Distance>::nearest_k(const std::vector<T> &pt, const size_t &k) const {
+    Scratch scratch;
+    std::vector< std::pair<double, size_t> > found = search(pt.data(), std::max(m_ef, k), scratch);
+    if (found.size() > k) {
+        found.resize(k);
+    }
+    return found;
+}
+
+template <typename T, typename Distance>
+void HNSW<T, Distance>::nearest_k_batch(const std::vector<std::vector<T> > &points, const size_t &k,
+                                        std::vector<size_t> &indices, std::vector<double> &distances) const {
+    const long int count = static_cast<long int>(points.size());
+    indices.assign(points.size() * k, std::numeric_limits<size_t>::max());
+    distances.assign(points.size() * k, std::numeric_limits<double>::infinity());
+    #pragma omp parallel if(count > 64)
+    {
+        // one visit array per thread, reused by all of its queries
+        Scratch scratch;
+        long int i = 0;
+        #pragma omp for schedule(dynamic, 16)
+        for (i = 0; i < count; i++) {
+            const std::vector< std::pair<double, size_t> > found = search(points[i].data(), std::max(m_ef, k), scratch);
+            for (size_t j = 0; j < k && j < found.size(); j++) {
+                indices[i * k + j] = found[j].second;
+                distances[i * k + j] = found[j].first;
+            }
+        }
+    }
+}
+
+template <typename T, typename Distance>
+template <typename Visitor>
+void HNSW<T, Distance>::neighborhood_(const T *pt, const double &rad, Scratch &scratch, Visitor &visit) const {
+    // the nearest ones found within rad seed a walk over the links of
+    // layer 0 restricted to points within rad
+    std::vector< std::pair<double, size_t> > frontier;
+    const std::vector< std::pair<double, size_t> > found = search(pt, m_ef, scratch);
+    reset(scratch);
+    for (size_t i = 0; i < found.size() && found[i].first <= rad; i++) {
+        scratch.marks[found[i].second] = scratch.mark;
+        frontier.push_back(found[i]);
+    }
+    while (!frontier.empty()) {
+        const std::pair<double, size_t> current = frontier.back();
+        frontier.pop_back();
+        visit(current.second, current.first);
+        const size_t *neighbors = links(current.second, 0);
+        for (size_t i = 1; i <= neighbors[0]; i++) {
+            const size_t node = neighbors[i];
+            if (scratch.marks[node] == scratch.mark) {
+                continue;
+            }
+            scratch.marks[node] = scratch.mark;
+            const double d = distance_(pt, node);
+            if (d <= rad) {
+                frontier.push_back(std::pair<double, size_t>(d, node));
+            }
+        }
+    }
+}
+
+template <typename T, typename Distance>
+template <typename Visitor>
+void HNSW<T, Distance>::neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) const {
+    Scratch scratch;
+    neighborhood_(pt.data(), rad, scratch, visit);
+}
+
+template <typename T, typename Distance>
+std::vector<size_t> HNSW<T, Distance>::neighborhood_indices(const std::vector<T> &pt, const double &rad) const {
+    std::vector<size_t> output;
+    neighborhood_visit(pt, rad, [&output](const size_t index, const double) {
+        output.push_back(index);
+    });
+    return output;
+}
+
+template <typename T, typename Distance>
+size_t HNSW<T, Distance>::count_within(const std::vector<T> &pt, const double &rad) const {
+    size_t count = 0;
+    neighborhood_visit(pt, rad, [&count](const size_t, const double) {
+        count++;
+    });
+    return count;
+}
+
+template <typename T, typename Distance>
+template <typename S>
+pairwise::CSRMatrix<S> HNSW<T, Distance>::threshold_graph(const S &threshold, const bool include_self) const {
+    const size_t count = size();
+    const long int rows = static_cast<long int>(count);
+    // what every point's search finds, as rows of found points...
+    std::vector<std::vector<pairwise::Edge<S> > > buffers(pairwise::thread_count());
+    #pragma omp parallel if(count > 64)
+    {
+        Scratch scratch;
+        long int i = 0;
+        #pragma omp for schedule(dynamic, 16)
+        for (i = 0; i < rows; i++) {
+            std::vector<pairwise::Edge<S> > &buffer = buffers[pairwise::thread_id()];
+            const size_t index = static_cast<size_t>(i);
+            auto visit = [&buffer, &index, &threshold](const size_t node, const double d) {
+                const S value = static_cast<S>(d);
+                if (node != index && value < threshold) {
+                    pairwise::Edge<S> edge = {index, node, value};
+                    buffer.push_back(edge);
+                }
+            };
+            neighborhood_(point(index), static_cast<double>(threshold), scratch, visit);
+        }
+    }
+    const pairwise::CSRMatrix<S> found = pairwise::edges_to_csr<S>(count, buffers, false, false);
+
+    // ...made symmetric, a pair found from both ends kept once
+    for (size_t b = 0; b < buffers.size(); b++) {
+        buffers[b].clear();
+    }
+    long int i = 0;
+    #pragma omp parallel for if(count > 2000)
+    for (i = 0; i < rows; i++) {
+        std::vector<pairwise::Edge<S> > &buffer = buffers[pairwise::thread_id()];
+        const size_t index = static_cast<size_t>(i);
+        for (size_t position = found.offsets[index]; position < found.offsets[index + 1]; position++) {
+            const size_t other = found.indices[position];
+            if (other > index || found.find(other, index) == found.nonzeros()) {
+                pairwise::Edge<S> edge = {index, other, found.values[position]};
+                buffer.push_back(edge);
+            }
+        }
+    }
+    return pairwise::edges_to_csr<S>(count, buffers, true, include_self);
+}
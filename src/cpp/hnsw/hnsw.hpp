@@ -0,0 +1,144 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "../distance.hpp"
+#include "../pairwise.hpp"
+
+// Hierarchical navigable small world graph for approximate nearest
+// neighbor search over any distance functor distance(row1, row2, dims)
+// (see the functors of distance.hpp).  Every point lives on layer 0 and on
+// each layer above it with probability 1 / M; a search descends greedily
+// from the single point of the top layer and runs a best-first search of
+// ef candidates on layer 0.  Points are linked to up to M neighbors per
+// layer (2 M on layer 0), chosen by the heuristic that skips a candidate
+// closer to an already chosen neighbor than to the point, which keeps
+// links spread around it.
+//
+// Points are inserted in batches: every point of a batch searches the
+// graph as it stood before the batch, in parallel, and then the links back
+// to it are added grouped by the point they leave from, so the graph only
+// depends on the seed and the batches, never on the number of threads.
+//
+// Original paper: Efficient and robust approximate nearest neighbor search
+// using Hierarchical Navigable Small World graphs (Malkov, Yashunin 2016)
+template <typename T, typename Distance = distance::Euclidean>
+class HNSW {
+    size_t m_dims;
+    size_t m_max_links;
+    size_t m_ef_construction;
+    size_t m_ef;
+    // 1 / ln(M), the scale of the exponential draw of the levels
+    double m_level_scale;
+    std::mt19937 m_generator;
+    Distance m_distance;
+    std::vector<T> m_points;
+    std::vector<size_t> m_levels;
+    // every node's links of layer 0 as [count, 2 M slots], and of each
+    // layer above as [count, M slots]
+    std::vector<size_t> m_links;
+    std::vector<std::vector<size_t> > m_upper_links;
+    size_t m_entry;
+    size_t m_top;
+
+    struct Scratch {
+        // visit marks of the nodes, current when equal to mark
+        std::vector<unsigned int> marks;
+        unsigned int mark = 0;
+        std::vector< std::pair<double, size_t> > candidates;
+    };
+
+    struct Link {
+        size_t layer;
+        size_t from;
+        size_t to;
+        double distance;
+    };
+
+    const T *point(const size_t &node) const;
+    double distance_(const T *pt, const size_t &node) const;
+    size_t capacity(const size_t &layer) const;
+    size_t *links(const size_t &node, const size_t &layer);
+    const size_t *links(const size_t &node, const size_t &layer) const;
+    size_t draw_level();
+
+    void reset(Scratch &scratch) const;
+
+    // closest node to pt found greedily on the layers above layer
+    std::pair<double, size_t> descend(const T *pt, const size_t &layer) const;
+
+    // Best-first search of layer from the nodes of found, which it
+    // replaces with the (up to) ef closest nodes met, as a max-heap.
+    void search_layer(const T *pt, std::vector< std::pair<double, size_t> > &found,
+                      const size_t &ef, const size_t &layer, Scratch &scratch) const;
+
+    // Up to count of candidates (sorted closest first), each kept only if
+    // no kept one is closer to it than the query is.
+    void select(const std::vector< std::pair<double, size_t> > &candidates, const size_t &count,
+                std::vector<size_t> &output) const;
+
+    // Links the nodes [first, last), already stored, into the graph.
+    void link(const size_t &first, const size_t &last);
+
+    // ef closest nodes to pt on layer 0, closest first
+    std::vector< std::pair<double, size_t> > search(const T *pt, const size_t &ef, Scratch &scratch) const;
+
+    template <typename Visitor>
+    void neighborhood_(const T *pt, const double &rad, Scratch &scratch, Visitor &visit) const;
+
+   public:
+    explicit HNSW(const Distance &distance = Distance(), const size_t &max_links = 16,
+                  const size_t &ef_construction = 200, const unsigned int &seed = 5489u);
+    HNSW(const std::vector<std::vector<T> > &point_array, const Distance &distance = Distance(),
+         const size_t &max_links = 16, const size_t &ef_construction = 200,
+         const unsigned int &seed = 5489u);
+
+    size_t size() const;
+    size_t dimensions() const;
+
+    // candidates kept by the searches of the queries, at least k for a k
+    // nearest neighbor query; more is slower and finds more of the true
+    // neighbors
+    void set_ef(const size_t &ef);
+    size_t ef() const;
+
+    // Adds a point, whose id is the number of points before it.
+    size_t insert(const std::vector<T> &pt);
+
+    // Adds the points in parallel batches of up to a tenth of the graph;
+    // returns the id of the first.
+    size_t insert(const std::vector<std::vector<T> > &point_array);
+
+    // index of the (approximately) nearest point,
+    // std::numeric_limits<size_t>::max() if empty
+    size_t nearest_index(const std::vector<T> &pt) const;
+
+    // approximately k nearest points as (distance, index), closest first
+    std::vector< std::pair<double, size_t> > nearest_k(const std::vector<T> &pt, const size_t &k) const;
+
+    // nearest_k of every query in parallel, as flat row-major n x k arrays
+    // of indices and distances, closest first, padded with
+    // std::numeric_limits<size_t>::max() and infinity.
+    void nearest_k_batch(const std::vector<std::vector<T> > &points, const size_t &k,
+                         std::vector<size_t> &indices, std::vector<double> &distances) const;
+
+    // Calls visit(index, distance) for the points within rad of pt that
+    // are reached from the nearest ones found through links of points also
+    // within rad.  Approximate: a point the search misses is skipped.
+    template <typename Visitor>
+    void neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) const;
+
+    std::vector<size_t> neighborhood_indices(const std::vector<T> &pt, const double &rad) const;
+
+    size_t count_within(const std::vector<T> &pt, const double &rad) const;
+
+    // Pairs of indexed points closer than threshold (strictly) that either
+    // point's neighborhood search finds, in both directions; rows are
+    // searched in parallel.
+    template <typename S>
+    pairwise::CSRMatrix<S> threshold_graph(const S &threshold, const bool include_self = true) const;
+};
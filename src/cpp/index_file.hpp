@@ -0,0 +1,234 @@
+#ifndef INDEX_FILE_H
+#define INDEX_FILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+namespace index_file {
+
+    /*
+    Binary files of the spatial indices (KDTree, VPTree), laid out so that
+    a mapped file is queried in place: a Header, a table of Sections, then
+    the index's arrays exactly as it holds them in memory, each aligned to
+    ALIGNMENT bytes.  Files are written in the machine's byte order and
+    size_t width and are only opened by machines that share them.
+
+    Version 1.
+    */
+
+    const uint32_t VERSION = 1;
+    const size_t ALIGNMENT = 64;
+    const uint32_t BYTE_ORDER_MARK = 0x01020304;
+    const char MAGIC[8] = {'H', 'I', 'G', 'H', 'P', 'I', 'D', 'X'};
+
+    enum class Kind : uint32_t {
+        KD_TREE = 1,
+        VP_TREE = 2
+    };
+
+    struct Header {
+        char magic[8];
+        uint32_t version;
+        uint32_t kind;
+        uint32_t byte_order;
+        uint32_t value_size;
+        uint32_t value_float;
+        uint32_t index_size;
+        uint64_t section_count;
+        // index specific: dimensions, leaf size, levels, point count, ...
+        uint64_t params[8];
+    };
+
+    struct Section {
+        uint64_t offset;
+        uint64_t bytes;
+    };
+
+    template <typename U>
+    class View {
+        // Read-only array over memory owned elsewhere: a vector of the
+        // index, or a mapped file kept alive by the index.
+
+    private:
+        const U *m_data;
+        size_t m_size;
+
+    public:
+        View(): m_data(nullptr), m_size(0) {};
+        View(const U *data, const size_t size): m_data(data), m_size(size) {};
+        explicit View(const std::vector<U> &values): m_data(values.data()), m_size(values.size()) {};
+
+        const U & operator[](const size_t index) const {
+            return m_data[index];
+        }
+
+        const U *data() const {
+            return m_data;
+        }
+
+        size_t size() const {
+            return m_size;
+        }
+    };
+
+    template <typename T>
+    Header make_header(const Kind kind, const std::vector<uint64_t> &params) {
+        Header header;
+        std::memset(&header, 0, sizeof(Header));
+        std::memcpy(header.magic, MAGIC, sizeof(MAGIC));
+        header.version = VERSION;
+        header.kind = static_cast<uint32_t>(kind);
+        header.byte_order = BYTE_ORDER_MARK;
+        header.value_size = sizeof(T);
+        header.value_float = std::is_floating_point<T>::value ? 1 : 0;
+        header.index_size = sizeof(size_t);
+        for (size_t i = 0; i < params.size() && i < 8; ++i) {
+            header.params[i] = params[i];
+        }
+        return header;
+    }
+
+    inline void write(const std::string &path, Header header, const std::vector<std::pair<const void *, size_t> > &sections) {
+        // sections are given as (data, bytes)
+        header.section_count = sections.size();
+        std::vector<Section> table(sections.size());
+        uint64_t offset = sizeof(Header) + sections.size() * sizeof(Section);
+        for (size_t i = 0; i < sections.size(); ++i) {
+            offset = (offset + ALIGNMENT - 1) / ALIGNMENT * ALIGNMENT;
+            table[i].offset = offset;
+            table[i].bytes = sections[i].second;
+            offset += sections[i].second;
+        }
+
+        FILE *file = std::fopen(path.c_str(), "wb");
+        if (file == nullptr) {
+            throw std::runtime_error("could not open " + path + " for writing");
+        }
+        bool written = std::fwrite(&header, sizeof(Header), 1, file) == 1;
+        written = written && (table.empty() || std::fwrite(table.data(), sizeof(Section), table.size(), file) == table.size());
+        uint64_t position = sizeof(Header) + table.size() * sizeof(Section);
+        const char padding[ALIGNMENT] = {0};
+        for (size_t i = 0; i < sections.size() && written; ++i) {
+            written = position == table[i].offset || std::fwrite(padding, 1, table[i].offset - position, file) == table[i].offset - position;
+            written = written && (table[i].bytes == 0 || std::fwrite(sections[i].first, 1, table[i].bytes, file) == table[i].bytes);
+            position = table[i].offset + table[i].bytes;
+        }
+        written = std::fclose(file) == 0 && written;
+        if (!written) {
+            throw std::runtime_error("could not write " + path);
+        }
+    }
+
+    class File {
+        // A whole index file, mapped read-only where mmap is available and
+        // read into memory elsewhere.  Copies share the mapping, which is
+        // released with the last of them.
+
+    private:
+        std::shared_ptr<const char> m_data;
+        size_t m_size;
+
+        const Header & header() const {
+            return *reinterpret_cast<const Header *>(m_data.get());
+        }
+
+    public:
+        File(): m_size(0) {};
+
+        File(const std::string &path, const Kind kind, const uint32_t value_size, const bool value_float): m_size(0) {
+            #if defined(__linux__) || defined(__APPLE__)
+            int descriptor = open(path.c_str(), O_RDONLY);
+            if (descriptor < 0) {
+                throw std::runtime_error("could not open " + path);
+            }
+            struct stat status;
+            if (fstat(descriptor, &status) != 0) {
+                close(descriptor);
+                throw std::runtime_error("could not stat " + path);
+            }
+            m_size = static_cast<size_t>(status.st_size);
+            void *memory = m_size > 0 ? mmap(nullptr, m_size, PROT_READ, MAP_SHARED, descriptor, 0) : MAP_FAILED;
+            close(descriptor);
+            if (memory == MAP_FAILED) {
+                throw std::runtime_error("could not map " + path);
+            }
+            const size_t size = m_size;
+            m_data = std::shared_ptr<const char>(static_cast<const char *>(memory), [size](const char *data) {
+                munmap(const_cast<char *>(data), size);
+            });
+            #else
+            FILE *file = std::fopen(path.c_str(), "rb");
+            if (file == nullptr) {
+                throw std::runtime_error("could not open " + path);
+            }
+            std::fseek(file, 0, SEEK_END);
+            m_size = static_cast<size_t>(std::ftell(file));
+            std::fseek(file, 0, SEEK_SET);
+            char *memory = new char[m_size];
+            const bool read = std::fread(memory, 1, m_size, file) == m_size;
+            std::fclose(file);
+            m_data = std::shared_ptr<const char>(memory, std::default_delete<const char[]>());
+            if (!read) {
+                throw std::runtime_error("could not read " + path);
+            }
+            #endif
+
+            if (m_size < sizeof(Header) || std::memcmp(header().magic, MAGIC, sizeof(MAGIC)) != 0) {
+                throw std::runtime_error(path + " is not an index file");
+            }
+            if (header().version != VERSION) {
+                throw std::runtime_error(path + " has unsupported index file version " + std::to_string(header().version));
+            }
+            if (header().byte_order != BYTE_ORDER_MARK || header().index_size != sizeof(size_t)) {
+                throw std::runtime_error(path + " was written by a machine of another byte order or word size");
+            }
+            if (header().kind != static_cast<uint32_t>(kind) || header().value_size != value_size || (header().value_float != 0) != value_float) {
+                throw std::runtime_error(path + " holds another kind of index or value type");
+            }
+            const uint64_t table_end = sizeof(Header) + header().section_count * sizeof(Section);
+            bool valid = table_end <= m_size;
+            for (uint64_t i = 0; i < header().section_count && valid; ++i) {
+                const Section &entry = reinterpret_cast<const Section *>(m_data.get() + sizeof(Header))[i];
+                valid = entry.offset % ALIGNMENT == 0 && entry.offset >= table_end && entry.offset + entry.bytes <= m_size;
+            }
+            if (!valid) {
+                throw std::runtime_error(path + " is truncated or corrupt");
+            }
+        }
+
+        uint64_t param(const size_t index) const {
+            return header().params[index];
+        }
+
+        // section index as count values of U, which must match what was
+        // written
+        template <typename U>
+        View<U> section(const size_t index, const size_t count) const {
+            if (index >= header().section_count) {
+                throw std::runtime_error("index file has no section " + std::to_string(index));
+            }
+            const Section &entry = reinterpret_cast<const Section *>(m_data.get() + sizeof(Header))[index];
+            if (entry.bytes != count * sizeof(U)) {
+                throw std::runtime_error("index file section " + std::to_string(index) + " has the wrong size");
+            }
+            return View<U>(reinterpret_cast<const U *>(m_data.get() + entry.offset), count);
+        }
+    };
+}
+
+#endif /* INDEX_FILE_H */
@@ -0,0 +1,241 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "kdtree.cpp"
+#include "dynamic_kdtree.hpp"
+
+template <typename T>
+DynamicKDTree<T>::DynamicKDTree(const size_t &buffer_size) : m_dims(0), m_buffer_size(buffer_size), m_size(0) {
+    assert(buffer_size > 0);
+}
+
+template <typename T>
+const T *DynamicKDTree<T>::point_(const size_t &id) const {
+    return m_points.data() + id * m_dims;
+}
+
+template <typename T>
+size_t DynamicKDTree<T>::size() const {
+    return m_size;
+}
+
+template <typename T>
+bool DynamicKDTree<T>::contains(const size_t &id) const {
+    return id < m_alive.size() && m_alive[id];
+}
+
+template <typename T>
+std::vector<T> DynamicKDTree<T>::point(const size_t &id) const {
+    assert(contains(id));
+    return std::vector<T>(point_(id), point_(id) + m_dims);
+}
+
+template <typename T>
+void DynamicKDTree<T>::build(const size_t &slot, const std::vector<size_t> &ids) {
+    std::vector< std::vector<T> > points(ids.size());
+    for (size_t i = 0; i < ids.size(); i++) {
+        points[i].assign(point_(ids[i]), point_(ids[i]) + m_dims);
+        m_locations[ids[i]] = std::pair<size_t, size_t>(slot, i);
+    }
+    Slot &target = m_slots[slot];
+    target.tree = ids.empty() ? KDTree<T>() : KDTree<T>(points);
+    target.ids = ids;
+    target.removed.assign(ids.size(), 0);
+    target.removed_count = 0;
+}
+
+template <typename T>
+void DynamicKDTree<T>::merge() {
+    // the buffer and every tree below the first empty slot go to that slot
+    std::vector<size_t> ids(m_buffer);
+    size_t slot = 0;
+    while (slot < m_slots.size() && !m_slots[slot].ids.empty()) {
+        const Slot &source = m_slots[slot];
+        for (size_t i = 0; i < source.ids.size(); i++) {
+            if (!source.removed[i]) {
+                ids.push_back(source.ids[i]);
+            }
+        }
+        slot++;
+    }
+    if (slot == m_slots.size()) {
+        m_slots.push_back(Slot());
+    }
+    for (size_t i = 0; i < slot; i++) {
+        build(i, std::vector<size_t>());
+    }
+    m_buffer.clear();
+    build(slot, ids);
+}
+
+template <typename T>
+size_t DynamicKDTree<T>::insert(const std::vector<T> &pt) {
+    if (m_size == 0 && m_alive.empty()) {
+        m_dims = pt.size();
+    }
+    assert(pt.size() == m_dims);
+    size_t id;
+    if (m_free.empty()) {
+        id = m_alive.size();
+        m_alive.push_back(0);
+        m_locations.push_back(std::pair<size_t, size_t>());
+        m_points.resize(m_points.size() + m_dims);
+    } else {
+        id = m_free.back();
+        m_free.pop_back();
+    }
+    std::copy(pt.begin(), pt.end(), m_points.begin() + id * m_dims);
+    m_alive[id] = 1;
+    m_locations[id] = std::pair<size_t, size_t>(std::numeric_limits<size_t>::max(), m_buffer.size());
+    m_buffer.push_back(id);
+    m_size++;
+    if (m_buffer.size() >= m_buffer_size) {
+        merge();
+    }
+    return id;
+}
+
+template <typename T>
+void DynamicKDTree<T>::remove(const size_t &id) {
+    assert(contains(id));
+    const std::pair<size_t, size_t> location = m_locations[id];
+    if (location.first == std::numeric_limits<size_t>::max()) {
+        m_buffer[location.second] = m_buffer.back();
+        m_locations[m_buffer.back()].second = location.second;
+        m_buffer.pop_back();
+    } else {
+        Slot &slot = m_slots[location.first];
+        slot.removed[location.second] = 1;
+        slot.removed_count++;
+        if (2 * slot.removed_count >= slot.ids.size()) {
+            std::vector<size_t> ids;
+            for (size_t i = 0; i < slot.ids.size(); i++) {
+                if (!slot.removed[i]) {
+                    ids.push_back(slot.ids[i]);
+                }
+            }
+            build(location.first, ids);
+        }
+    }
+    m_alive[id] = 0;
+    m_free.push_back(id);
+    m_size--;
+}
+
+template <typename T>
+size_t DynamicKDTree<T>::nearest_index(const std::vector<T> &pt) {
+    std::pair<double, size_t> best(std::numeric_limits<double>::infinity(), std::numeric_limits<size_t>::max());
+    for (size_t i = 0; i < m_buffer.size(); i++) {
+        double d = std::sqrt(dist2(point_(m_buffer[i]), pt.data(), m_dims));
+        if (d < best.first) {
+            best = std::pair<double, size_t>(d, m_buffer[i]);
+        }
+    }
+    for (size_t s = 0; s < m_slots.size(); s++) {
+        const Slot &slot = m_slots[s];
+        if (slot.ids.empty()) {
+            continue;
+        }
+        auto accept = [&slot](const size_t index) {
+            return !slot.removed[index];
+        };
+        auto cost = [](const size_t, const double distance) {
+            return distance;
+        };
+        std::pair<double, size_t> found = m_slots[s].tree.nearest_if(pt, accept, cost, best.first);
+        if (found.second != std::numeric_limits<size_t>::max()) {
+            best = std::pair<double, size_t>(found.first, slot.ids[found.second]);
+        }
+    }
+    return best.second;
+}
+
+template <typename T>
+std::vector< std::pair<double, size_t> > DynamicKDTree<T>::nearest_k(const std::vector<T> &pt, const size_t &k) {
+    std::vector< std::pair<double, size_t> > output;
+    for (size_t i = 0; i < m_buffer.size(); i++) {
+        output.push_back(std::pair<double, size_t>(std::sqrt(dist2(point_(m_buffer[i]), pt.data(), m_dims)), m_buffer[i]));
+    }
+    for (size_t s = 0; s < m_slots.size(); s++) {
+        const Slot &slot = m_slots[s];
+        if (slot.ids.empty()) {
+            continue;
+        }
+        auto accept = [&slot](const size_t index) {
+            return !slot.removed[index];
+        };
+        std::vector< std::pair<double, size_t> > found = m_slots[s].tree.nearest_k_if(pt, k, accept);
+        for (size_t i = 0; i < found.size(); i++) {
+            output.push_back(std::pair<double, size_t>(found[i].first, slot.ids[found[i].second]));
+        }
+    }
+    const size_t count = std::min(k, output.size());
+    std::partial_sort(output.begin(), output.begin() + count, output.end());
+    output.resize(count);
+    return output;
+}
+
+template <typename T>
+template <typename Visitor>
+void DynamicKDTree<T>::neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) {
+    const double r2 = rad * rad;
+    for (size_t i = 0; i < m_buffer.size(); i++) {
+        double d = dist2(point_(m_buffer[i]), pt.data(), m_dims);
+        if (d <= r2) {
+            visit(m_buffer[i], std::sqrt(d));
+        }
+    }
+    for (size_t s = 0; s < m_slots.size(); s++) {
+        const Slot &slot = m_slots[s];
+        if (slot.ids.empty()) {
+            continue;
+        }
+        m_slots[s].tree.neighborhood_visit(pt, rad, [&slot, &visit](const size_t index, const double distance) {
+            if (!slot.removed[index]) {
+                visit(slot.ids[index], distance);
+            }
+        });
+    }
+}
+
+template <typename T>
+std::vector<size_t> DynamicKDTree<T>::neighborhood_indices(const std::vector<T> &pt, const double &rad) {
+    std::vector<size_t> output;
+    neighborhood_visit(pt, rad, [&output](const size_t id, const double) {
+        output.push_back(id);
+    });
+    return output;
+}
+
+template <typename T>
+size_t DynamicKDTree<T>::count_within(const std::vector<T> &pt, const double &rad, const size_t &stop_at) {
+    const double r2 = rad * rad;
+    size_t count = 0;
+    for (size_t i = 0; i < m_buffer.size() && count < stop_at; i++) {
+        if (dist2(point_(m_buffer[i]), pt.data(), m_dims) <= r2) {
+            count++;
+        }
+    }
+    for (size_t s = 0; s < m_slots.size() && count < stop_at; s++) {
+        const Slot &slot = m_slots[s];
+        if (slot.ids.empty()) {
+            continue;
+        }
+        if (slot.removed_count == 0) {
+            count += m_slots[s].tree.count_within(pt, rad, stop_at - count);
+            continue;
+        }
+        m_slots[s].tree.neighborhood_visit(pt, rad, [&slot, &count](const size_t index, const double) {
+            if (!slot.removed[index]) {
+                count++;
+            }
+        });
+    }
+    return std::min(count, stop_at);
+}
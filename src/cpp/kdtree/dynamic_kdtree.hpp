@@ -0,0 +1,68 @@
+#pragma once
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "kdtree.hpp"
+
+// KD-tree supporting insert and remove by the logarithmic method: new
+// points go to a small buffer searched linearly, and a full buffer is
+// merged with every tree below the first empty slot into a static KDTree
+// in that slot, so slot i holds about buffer_size * 2^i points and each
+// point is rebuilt O(log n) times.  Removal marks the point in its tree and
+// rebuilds that tree from its live points once half of them are removed.
+// Points are addressed by the id insert returns; ids of removed points are
+// reused.
+template <typename T>
+class DynamicKDTree {
+    struct Slot {
+        KDTree<T> tree;
+        // id of each tree index, and whether it has been removed since
+        std::vector<size_t> ids;
+        std::vector<char> removed;
+        size_t removed_count;
+    };
+
+    size_t m_dims;
+    size_t m_buffer_size;
+    std::vector<T> m_points;
+    std::vector<size_t> m_buffer;
+    std::vector<Slot> m_slots;
+    // (slot, position) of every id, slot std::numeric_limits<size_t>::max()
+    // for the buffer
+    std::vector< std::pair<size_t, size_t> > m_locations;
+    std::vector<char> m_alive;
+    std::vector<size_t> m_free;
+    size_t m_size;
+
+    const T *point_(const size_t &id) const;
+    void build(const size_t &slot, const std::vector<size_t> &ids);
+    void merge();
+
+   public:
+    explicit DynamicKDTree(const size_t &buffer_size = 64);
+
+    size_t size() const;
+    bool contains(const size_t &id) const;
+    std::vector<T> point(const size_t &id) const;
+
+    size_t insert(const std::vector<T> &pt);
+    void remove(const size_t &id);
+
+    // id of the nearest point, std::numeric_limits<size_t>::max() if empty
+    size_t nearest_index(const std::vector<T> &pt);
+
+    // k nearest points as (distance, id), closest first
+    std::vector< std::pair<double, size_t> > nearest_k(const std::vector<T> &pt, const size_t &k);
+
+    // Calls visit(id, distance) for every point within rad of pt.
+    template <typename Visitor>
+    void neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit);
+
+    std::vector<size_t> neighborhood_indices(const std::vector<T> &pt, const double &rad);
+
+    // Number of points within rad of pt, stopping once stop_at are found.
+    size_t count_within(const std::vector<T> &pt, const double &rad,
+                        const size_t &stop_at = std::numeric_limits<size_t>::max());
+};
@@ -1,314 +1,725 @@
+#pragma once
+
 #include <algorithm>
+#include <cassert>
 #include <cmath>
 #include <functional>
 #include <iterator>
 #include <limits>
 #include <memory>
+#include <numeric>
+#include <queue>
 #include <vector>
 
 #include "kdtree.hpp"
 
 template <typename T>
-KDNode<T>::KDNode() = default;
+inline double dist2(const std::vector<T> &a, const std::vector<T> &b) {
+    double distc = 0;
+    for (size_t i = 0; i < a.size(); i++) {
+        double di = a.at(i) - b.at(i);
+        distc += di * di;
+    }
+    return distc;
+}
 
 template <typename T>
-KDNode<T>::KDNode(const std::vector<T> &pt, const size_t &idx_, const KDNodePtr &left_,
-               const KDNodePtr &right_) {
-    x = pt;
-    index = idx_;
-    left = left_;
-    right = right_;
+inline double dist2(const T *a, const T *b, const size_t &dims) {
+    double distc = 0;
+    for (size_t i = 0; i < dims; i++) {
+        double di = a[i] - b[i];
+        distc += di * di;
+    }
+    return distc;
 }
 
 template <typename T>
-KDNode<T>::KDNode(const typename std::pair< std::vector<T>, size_t> &pi, const KDNodePtr &left_,
-               const KDNodePtr &right_) {
-    x = pi.first;
-    index = pi.second;
-    left = left_;
-    right = right_;
+void KDTree<T>::swap_rows(const size_t &a, const size_t &b) {
+    std::swap_ranges(m_owned_points.begin() + a * m_dims, m_owned_points.begin() + (a + 1) * m_dims, m_owned_points.begin() + b * m_dims);
+    std::swap(m_owned_order[a], m_owned_order[b]);
 }
 
 template <typename T>
-KDNode<T>::~KDNode() = default;
+void KDTree<T>::select_rows(size_t begin, size_t end, const size_t &k, const size_t &dim) {
+    // Quickselect on the rows themselves with Hoare partitions, so every
+    // pass reads the range sequentially and equal keys split evenly.  The
+    // median of three is moved to the front as the pivot, which keeps each
+    // partition strictly inside the range.
+    const size_t dims = m_dims;
+    while (end - begin > 1) {
+        const size_t middle = begin + (end - begin) / 2;
+        const T first = m_points[begin * dims + dim], second = m_points[middle * dims + dim], last = m_points[(end - 1) * dims + dim];
+        size_t median = begin;
+        if ((first < second) != (first < last)) {
+            median = begin;
+        } else if ((second < first) != (second < last)) {
+            median = middle;
+        } else {
+            median = end - 1;
+        }
+        swap_rows(begin, median);
+        const T pivot = m_points[begin * dims + dim];
+
+        long int i = static_cast<long int>(begin) - 1, j = static_cast<long int>(end);
+        while (true) {
+            do {
+                i++;
+            } while (m_points[i * dims + dim] < pivot);
+            do {
+                j--;
+            } while (pivot < m_points[j * dims + dim]);
+            if (i >= j) {
+                break;
+            }
+            swap_rows(i, j);
+        }
+        if (k <= static_cast<size_t>(j)) {
+            end = j + 1;
+        } else {
+            begin = j + 1;
+        }
+    }
+}
 
 template <typename T>
-T KDNode<T>::coord(const size_t &idx) { return x.at(idx); }
+void KDTree<T>::make_tree(const size_t node, const size_t begin, const size_t end, const size_t level) {
+    if (level == m_levels) {
+        return;
+    }
+
+    // split on the dimension with the widest spread, estimated from about
+    // a thousand evenly strided rows in large ranges
+    const size_t dims = m_dims;
+    const size_t stride = std::max<size_t>(1, (end - begin) / 1024);
+    std::vector<T> low(point(begin), point(begin) + dims), high(low);
+    for (size_t i = begin + stride; i < end; i += stride) {
+        const T *row = point(i);
+        for (size_t j = 0; j < dims; j++) {
+            low[j] = std::min(low[j], row[j]);
+            high[j] = std::max(high[j], row[j]);
+        }
+    }
+    size_t dim = 0;
+    for (size_t j = 1; j < dims; j++) {
+        if (high[j] - low[j] > high[dim] - low[dim]) {
+            dim = j;
+        }
+    }
+
+    const size_t middle = begin + (end - begin) / 2;
+    select_rows(begin, end, middle, dim);
+    m_owned_split_dims[node] = dim;
+    m_owned_split_values[node] = m_points[middle * dims + dim];
+
+    // subtrees cover disjoint ranges, so they are built as independent tasks
+    #pragma omp task if(end - begin > 2000)
+    make_tree(2 * node + 1, begin, middle, level + 1);
+    #pragma omp task if(end - begin > 2000)
+    make_tree(2 * node + 2, middle, end, level + 1);
+}
+
 template <typename T>
-KDNode<T>::operator bool() { return (!x.empty()); }
+const T *KDTree<T>::point(const size_t &position) const {
+    return m_points.data() + position * m_dims;
+}
+
 template <typename T>
-KDNode<T>::operator std::vector<T>() { return x; }
+KDTree<T>::KDTree() : m_dims(0), m_leaf_size(32), m_levels(0), m_max_leaves(0), m_scale(1) {}
+
 template <typename T>
-KDNode<T>::operator size_t() { return index; }
+KDTree<T>::KDTree(const std::vector< std::vector<T> > &point_array, const size_t &leaf_size)
+    : m_dims(point_array.empty() ? 0 : point_array.front().size()), m_leaf_size(leaf_size), m_levels(0), m_max_leaves(0), m_scale(1) {
+    assert(leaf_size > 0);
+    const size_t length = point_array.size();
+    // halve until every bucket holds at most leaf_size points
+    while (m_dims > 0 && length > 0 && ((length - 1) >> m_levels) + 1 > m_leaf_size) {
+        m_levels++;
+    }
+    const size_t internal = (size_t(1) << m_levels) - 1;
+    m_owned_split_values.resize(internal);
+    m_owned_split_dims.resize(internal);
+
+    m_owned_order.resize(length);
+    std::iota(m_owned_order.begin(), m_owned_order.end(), 0);
+    m_owned_points.resize(length * m_dims);
+    bind();
+    long int i = 0;
+    #pragma omp parallel for if(length > 2000)
+    for (i = 0; i < static_cast<long int>(length); i++) {
+        std::copy(point_array[i].begin(), point_array[i].end(), m_owned_points.begin() + i * m_dims);
+    }
+
+    if (length > 0) {
+        #pragma omp parallel if(length > 2000)
+        #pragma omp single
+        make_tree(0, 0, length, 0);
+    }
+}
+
 template <typename T>
-KDNode<T>::operator std::pair< std::vector< double >, size_t >() { return std::pair< std::vector< double >, size_t >(x, index); }
+void KDTree<T>::bind() {
+    m_points = index_file::View<T>(m_owned_points);
+    m_order = index_file::View<size_t>(m_owned_order);
+    m_split_values = index_file::View<T>(m_owned_split_values);
+    m_split_dims = index_file::View<size_t>(m_owned_split_dims);
+}
 
 template <typename T>
-KDNodePtr<T> NewKDNodePtr() {
-    KDNodePtr<T> mynode = std::make_shared< KDNode<T> >();
-    return mynode;
+KDTree<T>::KDTree(const KDTree &other) : m_dims(0), m_leaf_size(32), m_levels(0), m_max_leaves(0), m_scale(1) {
+    *this = other;
 }
 
 template <typename T>
-inline double dist2(const std::vector<T> &a, const std::vector<T> &b) {
-    double distc = 0;
-    for (size_t i = 0; i < a.size(); i++) {
-        double di = a.at(i) - b.at(i);
-        distc += di * di;
+KDTree<T> &KDTree<T>::operator=(const KDTree &other) {
+    // views of a mapped file stay valid, as the copy shares the mapping
+    m_dims = other.m_dims;
+    m_leaf_size = other.m_leaf_size;
+    m_levels = other.m_levels;
+    m_points = other.m_points;
+    m_order = other.m_order;
+    m_split_values = other.m_split_values;
+    m_split_dims = other.m_split_dims;
+    m_owned_points = other.m_owned_points;
+    m_owned_order = other.m_owned_order;
+    m_owned_split_values = other.m_owned_split_values;
+    m_owned_split_dims = other.m_owned_split_dims;
+    m_file = other.m_file;
+    m_max_leaves = other.m_max_leaves;
+    m_scale = other.m_scale;
+    if (m_order.data() == other.m_owned_order.data()) {
+        bind();
     }
-    return distc;
+    return *this;
 }
 
 template <typename T>
-inline double dist2(const KDNodePtr<T> &a, const KDNodePtr<T> &b) {
-    return dist2(a->x, b->x);
+void KDTree<T>::save(const std::string &path) const {
+    std::vector<uint64_t> params = {m_dims, m_leaf_size, m_levels, size()};
+    std::vector<std::pair<const void *, size_t> > sections = {
+        std::make_pair(static_cast<const void *>(m_points.data()), m_points.size() * sizeof(T)),
+        std::make_pair(static_cast<const void *>(m_order.data()), m_order.size() * sizeof(size_t)),
+        std::make_pair(static_cast<const void *>(m_split_values.data()), m_split_values.size() * sizeof(T)),
+        std::make_pair(static_cast<const void *>(m_split_dims.data()), m_split_dims.size() * sizeof(size_t))
+    };
+    index_file::write(path, index_file::make_header<T>(index_file::Kind::KD_TREE, params), sections);
 }
 
 template <typename T>
-comparer<T>::comparer(size_t idx_) : idx{idx_} {};
+KDTree<T> KDTree<T>::load(const std::string &path) {
+    KDTree<T> tree;
+    tree.m_file = index_file::File(path, index_file::Kind::KD_TREE, sizeof(T), std::is_floating_point<T>::value);
+    tree.m_dims = tree.m_file.param(0);
+    tree.m_leaf_size = tree.m_file.param(1);
+    tree.m_levels = tree.m_file.param(2);
+    const size_t length = tree.m_file.param(3);
+    const size_t internal = (size_t(1) << tree.m_levels) - 1;
+    tree.m_points = tree.m_file.template section<T>(0, length * tree.m_dims);
+    tree.m_order = tree.m_file.template section<size_t>(1, length);
+    tree.m_split_values = tree.m_file.template section<T>(2, internal);
+    tree.m_split_dims = tree.m_file.template section<size_t>(3, internal);
+    return tree;
+}
 
 template <typename T>
-inline bool comparer<T>::compare_idx(const typename std::pair< std::vector<T>, size_t> &a,
-                                  const typename std::pair< std::vector<T>, size_t> &b
-) {
-    return (a.first.at(idx) < b.first.at(idx));
+size_t KDTree<T>::size() const {
+    return m_order.size();
 }
 
 template <typename T>
-inline void sort_on_idx(const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &begin,
-                        const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &end,
-                        size_t idx) {
-    comparer<T> comp(idx);
-    comp.idx = idx;
+size_t KDTree<T>::dimensions() const {
+    return m_dims;
+}
 
-    using std::placeholders::_1;
-    using std::placeholders::_2;
+template <typename T>
+size_t KDTree<T>::node_count() const {
+    return (size_t(2) << m_levels) - 1;
+}
 
-    std::sort(begin, end, std::bind(&comparer<T>::compare_idx, comp, _1, _2));
+template <typename T>
+void KDTree<T>::set_approximation(const size_t &max_leaves, const double &epsilon) {
+    assert(epsilon >= 0);
+    m_max_leaves = max_leaves;
+    m_scale = (1 + epsilon) * (1 + epsilon);
 }
 
 template <typename T>
-KDNodePtr<T> KDTree<T>::make_tree(const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &begin,
-                            const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &end,
-                            const size_t &length,
-                            const size_t &level
+void KDTree<T>::nearest_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const T *pt,
+    std::pair<double, size_t> &best
 ) {
-    if (begin == end) {
-        return NewKDNodePtr<T>();
-    }
-
-    size_t dim = begin->first.size();
-
-    if (length > 1) {
-        sort_on_idx<T>(begin, end, level);
+    if (level == m_levels) {
+        for (size_t i = begin; i < end; i++) {
+            double d = dist2(point(i), pt, m_dims);
+            if (d < best.first) {
+                best = std::pair<double, size_t>(d, i);
+            }
+        }
+        return;
     }
 
-    auto middle = begin + (length / 2);
-
-    auto l_begin = begin;
-    auto l_end = middle;
-    auto r_begin = middle + 1;
-    auto r_end = end;
-
-    size_t l_len = length / 2;
-    size_t r_len = length - l_len - 1;
+    const size_t middle = begin + (end - begin) / 2;
+    double dx = m_split_values[node] - pt[m_split_dims[node]];
 
-    KDNodePtr<T> left;
-    if (l_len > 0 && dim > 0) {
-        left = make_tree(l_begin, l_end, l_len, (level + 1) % dim);
-    } else {
-        left = leaf;
-    }
-    KDNodePtr<T> right;
-    if (r_len > 0 && dim > 0) {
-        right = make_tree(r_begin, r_end, r_len, (level + 1) % dim);
+    // select which branch makes sense to check, and only check the other
+    // one if it makes sense to do so
+    if (dx > 0) {
+        nearest_(2 * node + 1, begin, middle, level + 1, pt, best);
+        if (dx * dx * m_scale < best.first) {
+            nearest_(2 * node + 2, middle, end, level + 1, pt, best);
+        }
     } else {
-        right = leaf;
+        nearest_(2 * node + 2, middle, end, level + 1, pt, best);
+        if (dx * dx * m_scale < best.first) {
+            nearest_(2 * node + 1, begin, middle, level + 1, pt, best);
+        }
     }
+};
 
-    // KDNode result = KDNode();
-    return std::make_shared< KDNode<T> >(*middle, left, right);
-}
-
+// default caller
 template <typename T>
-KDTree<T>::KDTree(std::vector< std::vector<T> > point_array) {
-    leaf = std::make_shared< KDNode<T> >();
-    // iterators
-    std::vector< std::pair< std::vector<T>, size_t> > arr;
-    for (size_t i = 0; i < point_array.size(); i++) {
-        arr.push_back(std::pair< std::vector<T>, size_t>(point_array.at(i), i));
+std::pair<double, size_t> KDTree<T>::nearest_(const std::vector<T> &pt) {
+    std::pair<double, size_t> best(std::numeric_limits<double>::infinity(), std::numeric_limits<size_t>::max());
+    if (m_max_leaves > 0) {
+        std::vector<Branch> pending;
+        auto accept = [](const size_t) { return true; };
+        auto key = [](const size_t position) { return position; };
+        size_t size = 0;
+        nearest_bbf_(pt.data(), 1, accept, key, &best, size, pending);
+        return best;
     }
+    nearest_(0, 0, size(), 0, pt.data(), best);
+    return best;
+};
 
-    auto begin = arr.begin();
-    auto end = arr.end();
+template <typename T>
+std::vector<T> KDTree<T>::nearest_point(const std::vector<T> &pt) {
+    return nearest_pointIndex(pt).first;
+};
 
-    size_t length = arr.size();
-    size_t level = 0;  // starting
+template <typename T>
+size_t KDTree<T>::nearest_index(const std::vector<T> &pt) {
+    size_t position = nearest_(pt).second;
+    return position == std::numeric_limits<size_t>::max() ? position : m_order[position];
+};
 
-    root = KDTree::make_tree(begin, end, length, level);
+template <typename T>
+typename std::pair< std::vector<T>, size_t> KDTree<T>::nearest_pointIndex(const std::vector<T> &pt) {
+    size_t position = nearest_(pt).second;
+    if (position == std::numeric_limits<size_t>::max()) {
+        return std::pair< std::vector<T>, size_t>(std::vector<T>(), position);
+    }
+    return std::pair< std::vector<T>, size_t>(std::vector<T>(point(position), point(position) + m_dims), m_order[position]);
 }
 
 template <typename T>
-KDNodePtr<T> KDTree<T>::nearest_(
-    const KDNodePtr<T> &branch,
-    const std::vector<T> &pt,
+template <typename Accept>
+void KDTree<T>::nearest_k_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
     const size_t &level,
-    const KDNodePtr<T> &best,
-    const double &best_dist
+    const T *pt,
+    const size_t &k,
+    Accept &accept,
+    std::pair<double, size_t> *heap,
+    size_t &size
 ) {
-    double d, dx, dx2;
+    if (level == m_levels) {
+        for (size_t i = begin; i < end; i++) {
+            if (!accept(i)) {
+                continue;
+            }
+            std::pair<double, size_t> candidate(dist2(point(i), pt, m_dims), m_order[i]);
+            if (size < k) {
+                heap[size++] = candidate;
+                std::push_heap(heap, heap + size);
+            } else if (candidate < heap[0]) {
+                std::pop_heap(heap, heap + k);
+                heap[k - 1] = candidate;
+                std::push_heap(heap, heap + k);
+            }
+        }
+        return;
+    }
 
-    if (!bool(*branch)) {
-        return NewKDNodePtr<T>();  // basically, null
+    const size_t middle = begin + (end - begin) / 2;
+    double dx = m_split_values[node] - pt[m_split_dims[node]];
+    if (dx > 0) {
+        nearest_k_(2 * node + 1, begin, middle, level + 1, pt, k, accept, heap, size);
+        if (size < k || dx * dx * m_scale < heap[0].first) {
+            nearest_k_(2 * node + 2, middle, end, level + 1, pt, k, accept, heap, size);
+        }
+    } else {
+        nearest_k_(2 * node + 2, middle, end, level + 1, pt, k, accept, heap, size);
+        if (size < k || dx * dx * m_scale < heap[0].first) {
+            nearest_k_(2 * node + 1, begin, middle, level + 1, pt, k, accept, heap, size);
+        }
     }
+}
 
-    std::vector<T> branch_pt(*branch);
-    size_t dim = branch_pt.size();
+template <typename T>
+template <typename Accept, typename Key>
+void KDTree<T>::nearest_bbf_(
+    const T *pt,
+    const size_t &k,
+    Accept &accept,
+    Key &key,
+    std::pair<double, size_t> *heap,
+    size_t &size,
+    std::vector<Branch> &pending
+) {
+    // pending is a min-heap on the bounds
+    auto farther = [](const Branch &a, const Branch &b) {
+        return a.bound > b.bound;
+    };
+    pending.clear();
+    Branch root = {0, 0, 0, this->size(), 0};
+    pending.push_back(root);
+    for (size_t leaves = 0; leaves < m_max_leaves && !pending.empty(); leaves++) {
+        std::pop_heap(pending.begin(), pending.end(), farther);
+        Branch branch = pending.back();
+        pending.pop_back();
+        if (size == k && branch.bound * m_scale >= heap[0].first) {
+            // every queued subtree is at least as far
+            break;
+        }
 
-    d = dist2(branch_pt, pt);
-    dx = branch_pt.at(level) - pt.at(level);
-    dx2 = dx * dx;
+        // descend to the closest leaf, queueing the far side of every split
+        while (branch.level < m_levels) {
+            const size_t middle = branch.begin + (branch.end - branch.begin) / 2;
+            const double dx = m_split_values[branch.node] - pt[m_split_dims[branch.node]];
+            const bool left = dx > 0;
+            Branch far = {std::max(branch.bound, dx * dx), 2 * branch.node + (left ? 2 : 1),
+                          left ? middle : branch.begin, left ? branch.end : middle, branch.level + 1};
+            if (size < k || far.bound * m_scale < heap[0].first) {
+                pending.push_back(far);
+                std::push_heap(pending.begin(), pending.end(), farther);
+            }
+            branch.node = 2 * branch.node + (left ? 1 : 2);
+            if (left) {
+                branch.end = middle;
+            } else {
+                branch.begin = middle;
+            }
+            branch.level++;
+        }
 
-    KDNodePtr<T> best_l = best;
-    double best_dist_l = best_dist;
+        for (size_t i = branch.begin; i < branch.end; i++) {
+            if (!accept(i)) {
+                continue;
+            }
+            std::pair<double, size_t> candidate(dist2(point(i), pt, m_dims), key(i));
+            if (size < k) {
+                heap[size++] = candidate;
+                std::push_heap(heap, heap + size);
+            } else if (candidate < heap[0]) {
+                std::pop_heap(heap, heap + k);
+                heap[k - 1] = candidate;
+                std::push_heap(heap, heap + k);
+            }
+        }
+    }
+}
 
-    if (d < best_dist) {
-        best_dist_l = d;
-        best_l = branch;
+template <typename T>
+template <typename Accept>
+void KDTree<T>::nearest_k_row_(
+    const T *pt,
+    const size_t &k,
+    Accept &accept,
+    std::pair<double, size_t> *heap,
+    std::vector<Branch> &pending,
+    size_t *indices,
+    double *distances
+) {
+    size_t size = 0;
+    if (m_max_leaves > 0) {
+        auto key = [this](const size_t position) { return m_order[position]; };
+        nearest_bbf_(pt, k, accept, key, heap, size, pending);
+    } else {
+        nearest_k_(0, 0, this->size(), 0, pt, k, accept, heap, size);
     }
+    std::sort_heap(heap, heap + size);
+    for (size_t i = 0; i < k; i++) {
+        indices[i] = i < size ? heap[i].second : std::numeric_limits<size_t>::max();
+        distances[i] = i < size ? std::sqrt(heap[i].first) : std::numeric_limits<double>::infinity();
+    }
+}
 
-    size_t next_lv = (level + 1) % dim;
-    KDNodePtr<T> section;
-    KDNodePtr<T> other;
+template <typename T>
+std::vector< std::pair<double, size_t> > KDTree<T>::nearest_k(const std::vector<T> &pt, const size_t &k) {
+    return nearest_k_if(pt, k, [](const size_t) { return true; });
+}
 
-    // select which branch makes sense to check
-    if (dx > 0) {
-        section = branch->left;
-        other = branch->right;
-    } else {
-        section = branch->right;
-        other = branch->left;
+template <typename T>
+template <typename Accept>
+std::vector< std::pair<double, size_t> > KDTree<T>::nearest_k_if(const std::vector<T> &pt, const size_t &k, Accept accept) {
+    std::vector< std::pair<double, size_t> > output(k);
+    size_t size = 0;
+    auto accept_position = [this, &accept](const size_t position) {
+        return accept(m_order[position]);
+    };
+    if (k > 0 && m_max_leaves > 0) {
+        std::vector<Branch> pending;
+        auto key = [this](const size_t position) { return m_order[position]; };
+        nearest_bbf_(pt.data(), k, accept_position, key, output.data(), size, pending);
+    } else if (k > 0) {
+        nearest_k_(0, 0, this->size(), 0, pt.data(), k, accept_position, output.data(), size);
+    }
+    std::sort_heap(output.begin(), output.begin() + size);
+    output.resize(size);
+    for (size_t i = 0; i < size; ++i) {
+        output[i].first = std::sqrt(output[i].first);
+    }
+    return output;
+}
+
+template <typename T>
+void KDTree<T>::nearest_k_batch(
+    const std::vector<std::vector<T> > &points,
+    const size_t &k,
+    std::vector<size_t> &indices,
+    std::vector<double> &distances
+) {
+    const size_t count = points.size();
+    indices.resize(count * k);
+    distances.resize(count * k);
+    if (k == 0) {
+        return;
+    }
+    #pragma omp parallel if(count > 2000)
+    {
+        // one heap per thread, reused for every query it runs
+        std::vector< std::pair<double, size_t> > heap(k);
+        std::vector<Branch> pending;
+        auto accept = [](const size_t) { return true; };
+        long int i = 0;
+        #pragma omp for schedule(dynamic, 256)
+        for (i = 0; i < static_cast<long int>(count); i++) {
+            nearest_k_row_(points[i].data(), k, accept, heap.data(), pending, &indices[i * k], &distances[i * k]);
+        }
     }
+}
 
-    // keep nearest neighbor from further down the tree
-    KDNodePtr<T> further = nearest_(section, pt, next_lv, best_l, best_dist_l);
-    if (!further->x.empty()) {
-        double dl = dist2(further->x, pt);
-        if (dl < best_dist_l) {
-            best_dist_l = dl;
-            best_l = further;
+template <typename T>
+void KDTree<T>::all_nearest_k(
+    const size_t &k,
+    std::vector<size_t> &indices,
+    std::vector<double> &distances
+) {
+    const size_t count = size();
+    indices.resize(count * k);
+    distances.resize(count * k);
+    if (k == 0) {
+        return;
+    }
+    #pragma omp parallel if(count > 2000)
+    {
+        std::vector< std::pair<double, size_t> > heap(k);
+        std::vector<Branch> pending;
+        long int i = 0;
+        // queries in tree order, so neighboring queries touch the same leaves
+        #pragma omp for schedule(dynamic, 256)
+        for (i = 0; i < static_cast<long int>(count); i++) {
+            const size_t row = m_order[i] * k;
+            const size_t self = i;
+            auto accept = [self](const size_t position) {
+                return position != self;
+            };
+            nearest_k_row_(point(i), k, accept, heap.data(), pending, &indices[row], &distances[row]);
         }
     }
-    // only check the other branch if it makes sense to do so
-    if (dx2 < best_dist_l) {
-        further = nearest_(other, pt, next_lv, best_l, best_dist_l);
-        if (!further->x.empty()) {
-            double dl = dist2(further->x, pt);
-            if (dl < best_dist_l) {
-                best_dist_l = dl;
-                best_l = further;
+}
+
+template <typename T>
+template <typename Accept, typename Cost, typename Skip>
+void KDTree<T>::nearest_if_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const T *pt,
+    Accept &accept,
+    Cost &cost,
+    Skip &skip,
+    std::pair<double, size_t> &best
+) {
+    if (skip(node)) {
+        return;
+    }
+
+    if (level == m_levels) {
+        for (size_t i = begin; i < end; i++) {
+            const size_t index = m_order[i];
+            if (!accept(index)) {
+                continue;
+            }
+            double d = std::sqrt(dist2(point(i), pt, m_dims));
+            if (d < best.first) {
+                double c = cost(index, d);
+                if (c < best.first) {
+                    best = std::pair<double, size_t>(c, index);
+                }
             }
         }
+        return;
     }
 
-    return best_l;
-};
+    const size_t middle = begin + (end - begin) / 2;
+    double dx = m_split_values[node] - pt[m_split_dims[node]];
+    if (dx > 0) {
+        nearest_if_(2 * node + 1, begin, middle, level + 1, pt, accept, cost, skip, best);
+        if (std::fabs(dx) < best.first) {
+            nearest_if_(2 * node + 2, middle, end, level + 1, pt, accept, cost, skip, best);
+        }
+    } else {
+        nearest_if_(2 * node + 2, middle, end, level + 1, pt, accept, cost, skip, best);
+        if (std::fabs(dx) < best.first) {
+            nearest_if_(2 * node + 1, begin, middle, level + 1, pt, accept, cost, skip, best);
+        }
+    }
+}
 
-// default caller
 template <typename T>
-KDNodePtr<T> KDTree<T>::nearest_(const std::vector<T> &pt) {
-    size_t level = 0;
-    // KDNodePtr best = branch;
-    double branch_dist = dist2(std::vector<T>(*root), pt);
-    return nearest_(root,          // beginning of tree
-                    pt,            // point we are querying
-                    level,         // start from level 0
-                    root,          // best is the root
-                    branch_dist);  // best_dist = branch_dist
-};
+template <typename Accept, typename Cost>
+std::pair<double, size_t> KDTree<T>::nearest_if(const std::vector<T> &pt, Accept accept, Cost cost, const double &bound) {
+    auto skip = [](const size_t) { return false; };
+    return nearest_if(pt, accept, cost, bound, skip);
+}
 
 template <typename T>
-std::vector<T> KDTree<T>::nearest_point(const std::vector<T> &pt) {
-    return std::vector<T>(*nearest_(pt));
-};
+template <typename Accept, typename Cost, typename Skip>
+std::pair<double, size_t> KDTree<T>::nearest_if(const std::vector<T> &pt, Accept accept, Cost cost, const double &bound, Skip skip) {
+    std::pair<double, size_t> best(bound, std::numeric_limits<size_t>::max());
+    nearest_if_(0, 0, size(), 0, pt.data(), accept, cost, skip, best);
+    return best;
+}
 
 template <typename T>
-size_t KDTree<T>::nearest_index(const std::vector<T> &pt) {
-    return size_t(*nearest_(pt));
-};
+size_t KDTree<T>::subtree_labels_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const std::vector<size_t> &labels,
+    std::vector<size_t> &output
+) {
+    const size_t mixed = std::numeric_limits<size_t>::max();
+    const size_t empty = mixed - 1;
+    size_t label = empty;
+    if (level == m_levels) {
+        for (size_t i = begin; i < end && label != mixed; i++) {
+            const size_t point_label = labels.at(m_order[i]);
+            label = label == empty || label == point_label ? point_label : mixed;
+        }
+    } else {
+        const size_t middle = begin + (end - begin) / 2;
+        size_t left = subtree_labels_(2 * node + 1, begin, middle, level + 1, labels, output);
+        size_t right = subtree_labels_(2 * node + 2, middle, end, level + 1, labels, output);
+        label = left == empty ? right : (right == empty || right == left ? left : mixed);
+    }
+    output.at(node) = label == empty ? mixed : label;
+    return label;
+}
 
 template <typename T>
-typename std::pair< std::vector<T>, size_t> KDTree<T>::nearest_pointIndex(const std::vector<T> &pt) {
-    KDNodePtr<T> Nearest = nearest_(pt);
-    return pointIndex(std::vector<T>(*Nearest), size_t(*Nearest));
+std::vector<size_t> KDTree<T>::subtree_labels(const std::vector<size_t> &labels) {
+    std::vector<size_t> output(node_count(), std::numeric_limits<size_t>::max());
+    subtree_labels_(0, 0, size(), 0, labels, output);
+    return output;
 }
 
 template <typename T>
-std::vector< std::pair< std::vector<T>, size_t> > KDTree<T>::neighborhood_(
-    const KDNodePtr<T> &branch,
-    const std::vector<T> &pt,
-    const double &rad,
-    const size_t &level
+template <typename Visitor>
+void KDTree<T>::neighborhood_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const T *pt,
+    const double &r2,
+    Visitor &visit
 ) {
-    double d, dx, dx2;
-
-    if (!bool(*branch)) {
-        // branch has no point, means it is a leaf,
-        // no points to add
-        return std::vector< std::pair< std::vector<T>, size_t> >();
+    if (level == m_levels) {
+        for (size_t i = begin; i < end; i++) {
+            double d = dist2(point(i), pt, m_dims);
+            if (d <= r2) {
+                visit(i, d);
+            }
+        }
+        return;
     }
 
-    size_t dim = pt.size();
-
-    double r2 = rad * rad;
-
-    d = dist2(std::vector<T>(*branch), pt);
-    dx = std::vector<T>(*branch).at(level) - pt.at(level);
-    dx2 = dx * dx;
-
-    std::vector< std::pair< std::vector<T>, size_t> > nbh, nbh_s, nbh_o;
-    if (d <= r2) {
-        nbh.push_back(pointIndex(*branch));
+    const size_t middle = begin + (end - begin) / 2;
+    double dx = m_split_values[node] - pt[m_split_dims[node]];
+    double dx2 = dx * dx;
+    if (dx > 0 || dx2 <= r2) {
+        neighborhood_(2 * node + 1, begin, middle, level + 1, pt, r2, visit);
     }
-
-    KDNodePtr<T> section;
-    KDNodePtr<T> other;
-    if (dx > 0) {
-        section = branch->left;
-        other = branch->right;
-    } else {
-        section = branch->right;
-        other = branch->left;
+    if (dx <= 0 || dx2 <= r2) {
+        neighborhood_(2 * node + 2, middle, end, level + 1, pt, r2, visit);
     }
+};
 
-    nbh_s = neighborhood_(section, pt, rad, (level + 1) % dim);
-    nbh.insert(nbh.end(), nbh_s.begin(), nbh_s.end());
-    if (dx2 < r2) {
-        nbh_o = neighborhood_(other, pt, rad, (level + 1) % dim);
-        nbh.insert(nbh.end(), nbh_o.begin(), nbh_o.end());
+template <typename T>
+bool KDTree<T>::count_within_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const T *pt,
+    const double &r2,
+    const size_t &stop_at,
+    const bool &strict,
+    size_t &count
+) {
+    if (level == m_levels) {
+        for (size_t i = begin; i < end; i++) {
+            const double d = dist2(point(i), pt, m_dims);
+            if ((strict ? d < r2 : d <= r2) && ++count >= stop_at) {
+                return false;
+            }
+        }
+        return true;
     }
 
-    return nbh;
+    const size_t middle = begin + (end - begin) / 2;
+    double dx = m_split_values[node] - pt[m_split_dims[node]];
+    double dx2 = dx * dx;
+    // the side holding pt first, as it is the likelier to reach stop_at
+    if (dx > 0) {
+        return count_within_(2 * node + 1, begin, middle, level + 1, pt, r2, stop_at, strict, count)
+            && (dx2 > r2 || count_within_(2 * node + 2, middle, end, level + 1, pt, r2, stop_at, strict, count));
+    }
+    return count_within_(2 * node + 2, middle, end, level + 1, pt, r2, stop_at, strict, count)
+        && (dx2 > r2 || count_within_(2 * node + 1, begin, middle, level + 1, pt, r2, stop_at, strict, count));
 };
 
 template <typename T>
 std::vector< std::pair< std::vector<T>, size_t> > KDTree<T>::neighborhood(
     const std::vector<T> &pt,
     const double &rad) {
-    size_t level = 0;
-    return neighborhood_(root, pt, rad, level);
+    std::vector< std::pair< std::vector<T>, size_t> > nbh;
+    auto visit = [this, &nbh](const size_t position, const double) {
+        nbh.push_back(std::pair< std::vector<T>, size_t>(std::vector<T>(point(position), point(position) + m_dims), m_order[position]));
+    };
+    neighborhood_(0, 0, size(), 0, pt.data(), rad * rad, visit);
+    return nbh;
 }
 
 template <typename T>
 std::vector< std::vector<T> > KDTree<T>::neighborhood_points(
     const std::vector<T> &pt,
     const double &rad) {
-    size_t level = 0;
-    std::vector< std::pair< std::vector<T>, size_t> > nbh = neighborhood_(root, pt, rad, level);
     std::vector< std::vector<T> > nbhp;
-    nbhp.resize(nbh.size());
-    std::transform(nbh.begin(), nbh.end(), nbhp.begin(),
-                   [](typename std::pair< std::vector<T>, size_t> x) { return x.first; });
+    auto visit = [this, &nbhp](const size_t position, const double) {
+        nbhp.push_back(std::vector<T>(point(position), point(position) + m_dims));
+    };
+    neighborhood_(0, 0, size(), 0, pt.data(), rad * rad, visit);
     return nbhp;
 }
 
@@ -316,11 +727,335 @@ template <typename T>
 std::vector<size_t> KDTree<T>::neighborhood_indices(
     const std::vector<T> &pt,
     const double &rad) {
-    size_t level = 0;
-    std::vector< std::pair< std::vector<T>, size_t> > nbh = neighborhood_(root, pt, rad, level);
     std::vector<size_t> nbhi;
-    nbhi.resize(nbh.size());
-    std::transform(nbh.begin(), nbh.end(), nbhi.begin(),
-                   [](typename std::pair< std::vector<T>, size_t> x) { return x.second; });
+    neighborhood_indices(pt, rad, nbhi);
     return nbhi;
 }
+
+template <typename T>
+void KDTree<T>::neighborhood_indices(
+    const std::vector<T> &pt,
+    const double &rad,
+    std::vector<size_t> &output) {
+    output.clear();
+    auto visit = [this, &output](const size_t position, const double) {
+        output.push_back(m_order[position]);
+    };
+    neighborhood_(0, 0, size(), 0, pt.data(), rad * rad, visit);
+}
+
+template <typename T>
+template <typename Visitor>
+void KDTree<T>::neighborhood_visit(
+    const std::vector<T> &pt,
+    const double &rad,
+    Visitor visit) {
+    auto forward = [this, &visit](const size_t position, const double d) {
+        visit(m_order[position], std::sqrt(d));
+    };
+    neighborhood_(0, 0, size(), 0, pt.data(), rad * rad, forward);
+}
+
+template <typename T>
+size_t KDTree<T>::count_within(
+    const std::vector<T> &pt,
+    const double &rad,
+    const size_t &stop_at,
+    const bool &strict) {
+    size_t count = 0;
+    if (stop_at > 0) {
+        count_within_(0, 0, size(), 0, pt.data(), rad * rad, stop_at, strict, count);
+    }
+    return count;
+}
+
+template <typename T>
+void KDTree<T>::node_boxes_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    T *low,
+    T *high
+) {
+    T *node_low = low + node * m_dims, *node_high = high + node * m_dims;
+    if (level == m_levels) {
+        std::fill(node_low, node_low + m_dims, std::numeric_limits<T>::max());
+        std::fill(node_high, node_high + m_dims, std::numeric_limits<T>::lowest());
+        for (size_t i = begin; i < end; i++) {
+            const T *row = point(i);
+            for (size_t j = 0; j < m_dims; j++) {
+                node_low[j] = std::min(node_low[j], row[j]);
+                node_high[j] = std::max(node_high[j], row[j]);
+            }
+        }
+        return;
+    }
+
+    const size_t middle = begin + (end - begin) / 2;
+    const size_t left = 2 * node + 1, right = 2 * node + 2;
+    node_boxes_(left, begin, middle, level + 1, low, high);
+    node_boxes_(right, middle, end, level + 1, low, high);
+    for (size_t j = 0; j < m_dims; j++) {
+        node_low[j] = std::min(low[left * m_dims + j], low[right * m_dims + j]);
+        node_high[j] = std::max(high[left * m_dims + j], high[right * m_dims + j]);
+    }
+}
+
+template <typename T>
+template <typename S>
+void KDTree<T>::self_join_(
+    const size_t a,
+    const size_t a_begin,
+    const size_t a_end,
+    const size_t b,
+    const size_t b_begin,
+    const size_t b_end,
+    const size_t level,
+    const T *low,
+    const T *high,
+    const double r2,
+    const bool distances,
+    std::vector<std::vector<pairwise::Edge<S> > > *buffers
+) {
+    if (a_begin == a_end || b_begin == b_end) {
+        return;
+    }
+
+    // squared distances between the closest and the farthest corners of
+    // the two boxes
+    double closest = 0, farthest = 0;
+    for (size_t j = 0; j < m_dims; j++) {
+        const double a_low = low[a * m_dims + j], a_high = high[a * m_dims + j];
+        const double b_low = low[b * m_dims + j], b_high = high[b * m_dims + j];
+        const double gap = std::max(0.0, std::max(a_low - b_high, b_low - a_high));
+        const double span = std::max(a_high - b_low, b_high - a_low);
+        closest += gap * gap;
+        farthest += span * span;
+    }
+    if (closest >= r2) {
+        return;
+    }
+
+    if (farthest < r2 || level == m_levels) {
+        std::vector<pairwise::Edge<S> > &buffer = (*buffers)[pairwise::thread_id()];
+        const bool whole = farthest < r2;
+        for (size_t i = a_begin; i < a_end; i++) {
+            const T *row = point(i);
+            if (!whole) {
+                // skip the rows of a too far from the box of b
+                double gap2 = 0;
+                for (size_t j = 0; j < m_dims; j++) {
+                    const double gap = std::max(0.0, std::max(low[b * m_dims + j] - row[j], row[j] - high[b * m_dims + j]));
+                    gap2 += gap * gap;
+                }
+                if (gap2 >= r2) {
+                    continue;
+                }
+            }
+            for (size_t k = a == b ? i + 1 : b_begin; k < b_end; k++) {
+                double d = whole && !distances ? 0 : dist2(row, point(k), m_dims);
+                if (whole || d < r2) {
+                    pairwise::Edge<S> edge = {m_order[i], m_order[k], static_cast<S>(distances ? std::sqrt(d) : 0)};
+                    buffer.push_back(edge);
+                }
+            }
+        }
+        return;
+    }
+
+    // both nodes sit at the same level, so both are split; a node paired
+    // with itself yields its two halves and the pair between them
+    const size_t a_middle = a_begin + (a_end - a_begin) / 2, b_middle = b_begin + (b_end - b_begin) / 2;
+    const bool large = (a_end - a_begin) + (b_end - b_begin) > 2000;
+    #pragma omp task if(large)
+    self_join_<S>(2 * a + 1, a_begin, a_middle, 2 * b + 1, b_begin, b_middle, level + 1, low, high, r2, distances, buffers);
+    #pragma omp task if(large)
+    self_join_<S>(2 * a + 2, a_middle, a_end, 2 * b + 2, b_middle, b_end, level + 1, low, high, r2, distances, buffers);
+    #pragma omp task if(large)
+    self_join_<S>(2 * a + 1, a_begin, a_middle, 2 * b + 2, b_middle, b_end, level + 1, low, high, r2, distances, buffers);
+    if (a != b) {
+        #pragma omp task if(large)
+        self_join_<S>(2 * a + 2, a_middle, a_end, 2 * b + 1, b_begin, b_middle, level + 1, low, high, r2, distances, buffers);
+    }
+}
+
+template <typename T>
+template <typename S>
+pairwise::CSRMatrix<S> KDTree<T>::self_join(const double &rad, const bool include_self, const bool distances) {
+    const size_t length = size();
+    std::vector<std::vector<pairwise::Edge<S> > > buffers(pairwise::thread_count());
+    if (length > 1) {
+        std::vector<T> low(node_count() * m_dims), high(node_count() * m_dims);
+        node_boxes_(0, 0, length, 0, low.data(), high.data());
+        #pragma omp parallel if(length > 2000)
+        #pragma omp single
+        self_join_<S>(0, 0, length, 0, 0, length, 0, low.data(), high.data(), rad * rad, distances, &buffers);
+    }
+    return pairwise::edges_to_csr<S>(length, buffers, true, include_self);
+}
+
+template <typename T>
+void KDTree<T>::node_extremes_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const double *values,
+    double *lowest,
+    double *highest
+) {
+    double node_lowest = std::numeric_limits<double>::infinity();
+    double node_highest = -std::numeric_limits<double>::infinity();
+    if (level == m_levels) {
+        for (size_t i = begin; i < end; i++) {
+            node_lowest = std::min(node_lowest, values[i]);
+            node_highest = std::max(node_highest, values[i]);
+        }
+    } else {
+        const size_t middle = begin + (end - begin) / 2;
+        const size_t left = 2 * node + 1, right = 2 * node + 2;
+        node_extremes_(left, begin, middle, level + 1, values, lowest, highest);
+        node_extremes_(right, middle, end, level + 1, values, lowest, highest);
+        if (lowest) {
+            node_lowest = std::min(lowest[left], lowest[right]);
+        }
+        if (highest) {
+            node_highest = std::max(highest[left], highest[right]);
+        }
+    }
+    if (lowest) {
+        lowest[node] = node_lowest;
+    }
+    if (highest) {
+        highest[node] = node_highest;
+    }
+}
+
+template <typename T>
+double KDTree<T>::box_gap2_(const size_t &a, const size_t &b, const T *low, const T *high) const {
+    double closest = 0;
+    for (size_t j = 0; j < m_dims; j++) {
+        const double gap = std::max(0.0, std::max(static_cast<double>(low[a * m_dims + j]) - high[b * m_dims + j],
+                                                  static_cast<double>(low[b * m_dims + j]) - high[a * m_dims + j]));
+        closest += gap * gap;
+    }
+    return closest;
+}
+
+template <typename T>
+void KDTree<T>::nearest_foreign_(
+    const size_t a,
+    const size_t a_begin,
+    const size_t a_end,
+    const size_t b,
+    const size_t b_begin,
+    const size_t b_end,
+    const size_t level,
+    Foreign *search
+) {
+    if (a_begin == a_end || b_begin == b_end) {
+        return;
+    }
+    const size_t mixed = std::numeric_limits<size_t>::max();
+    if (search->node_labels[a] != mixed && search->node_labels[a] == search->node_labels[b]) {
+        return;
+    }
+    const double lower = std::max(std::sqrt(box_gap2_(a, b, search->low, search->high)),
+                                  std::max(search->node_weights[a], search->node_weights[b]));
+    if (lower >= search->node_bounds[a]) {
+        return;
+    }
+
+    if (level == m_levels) {
+        double bound = 0;
+        for (size_t i = a_begin; i < a_end; i++) {
+            std::pair<double, size_t> &best = search->nearest[i];
+            const double weight = search->weights[i];
+            const size_t label = search->labels[i];
+            const T *row = point(i);
+            // skip the rows no cheaper than their best for any of b's
+            double gap2 = 0;
+            for (size_t j = 0; j < m_dims; j++) {
+                const double gap = std::max(0.0, std::max(search->low[b * m_dims + j] - row[j], row[j] - search->high[b * m_dims + j]));
+                gap2 += gap * gap;
+            }
+            if (std::max(std::sqrt(gap2), std::max(weight, search->node_weights[b])) < best.first) {
+                for (size_t k = b_begin; k < b_end; k++) {
+                    if (search->labels[k] == label) {
+                        continue;
+                    }
+                    const double d = std::sqrt(dist2(row, point(k), m_dims));
+                    const double c = std::max(d, std::max(weight, search->weights[k]));
+                    if (c < best.first) {
+                        best = std::pair<double, size_t>(c, m_order[k]);
+                    }
+                }
+            }
+            bound = std::max(bound, best.first);
+        }
+        search->node_bounds[a] = bound;
+        return;
+    }
+
+    // each half of a is searched by one task, closer half of b first; the
+    // bound of a is then the worse of its halves'
+    const size_t a_middle = a_begin + (a_end - a_begin) / 2, b_middle = b_begin + (b_end - b_begin) / 2;
+    const bool large = a_end - a_begin > 2000;
+    for (size_t side = 0; side < 2; side++) {
+        const size_t child = 2 * a + 1 + side;
+        const size_t child_begin = side ? a_middle : a_begin, child_end = side ? a_end : a_middle;
+        #pragma omp task if(large)
+        {
+            const bool right_first = box_gap2_(child, 2 * b + 2, search->low, search->high) < box_gap2_(child, 2 * b + 1, search->low, search->high);
+            if (right_first) {
+                nearest_foreign_(child, child_begin, child_end, 2 * b + 2, b_middle, b_end, level + 1, search);
+                nearest_foreign_(child, child_begin, child_end, 2 * b + 1, b_begin, b_middle, level + 1, search);
+            } else {
+                nearest_foreign_(child, child_begin, child_end, 2 * b + 1, b_begin, b_middle, level + 1, search);
+                nearest_foreign_(child, child_begin, child_end, 2 * b + 2, b_middle, b_end, level + 1, search);
+            }
+        }
+    }
+    #pragma omp taskwait
+    search->node_bounds[a] = std::max(search->node_bounds[2 * a + 1], search->node_bounds[2 * a + 2]);
+}
+
+template <typename T>
+std::vector<std::pair<double, size_t> > KDTree<T>::nearest_foreign(
+    const std::vector<size_t> &labels,
+    const std::vector<double> &weights,
+    const std::vector<double> &bounds) {
+    const size_t length = size();
+    const size_t none = std::numeric_limits<size_t>::max();
+    std::vector<std::pair<double, size_t> > output(length);
+    if (length == 0) {
+        return output;
+    }
+    std::vector<size_t> position_labels(length);
+    std::vector<double> position_weights(length), position_bounds(length);
+    std::vector<std::pair<double, size_t> > nearest(length);
+    for (size_t i = 0; i < length; i++) {
+        position_labels[i] = labels[m_order[i]];
+        position_weights[i] = weights[m_order[i]];
+        position_bounds[i] = bounds[m_order[i]];
+        nearest[i] = std::pair<double, size_t>(position_bounds[i], none);
+    }
+    std::vector<T> low(node_count() * m_dims), high(node_count() * m_dims);
+    node_boxes_(0, 0, length, 0, low.data(), high.data());
+    std::vector<double> node_weights(node_count()), node_bounds(node_count());
+    node_extremes_(0, 0, length, 0, position_weights.data(), node_weights.data(), nullptr);
+    node_extremes_(0, 0, length, 0, position_bounds.data(), nullptr, node_bounds.data());
+    const std::vector<size_t> node_labels = subtree_labels(labels);
+
+    Foreign search = {position_labels.data(), position_weights.data(), node_labels.data(),
+                      node_weights.data(), node_bounds.data(), low.data(), high.data(), nearest.data()};
+    #pragma omp parallel if(length > 2000)
+    #pragma omp single
+    nearest_foreign_(0, 0, length, 0, 0, length, 0, &search);
+
+    for (size_t i = 0; i < length; i++) {
+        output[m_order[i]] = nearest[i];
+    }
+    return output;
+}
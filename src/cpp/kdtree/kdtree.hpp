@@ -2,88 +2,113 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <memory>
+#include <queue>
 #include <vector>
 
+#include "../index_file.hpp"
+#include "../pairwise.hpp"
+
 using indexArr = std::vector<size_t>;
 
 template <typename T>
-class KDNode {
-   public:
-    using KDNodePtr = std::shared_ptr< KDNode<T> >;
-    size_t index;
-    std::vector<T> x;
-    KDNodePtr left;
-    KDNodePtr right;
-
-    // initializer
-    KDNode();
-    KDNode(const std::vector<T> &, const size_t &, const KDNodePtr &,
-           const KDNodePtr &);
-    KDNode(const std::pair< std::vector<T>, size_t> &, const KDNodePtr &, const KDNodePtr &);
-    ~KDNode();
-
-    // getter
-    T coord(const size_t &);
-
-    // conversions
-    explicit operator bool();
-    explicit operator std::vector<T>();
-    explicit operator size_t();
-    explicit operator typename std::pair< std::vector< double >, size_t >();
-};
-
+inline double dist2(const std::vector<T> &, const std::vector<T> &);
 template <typename T>
-using KDNodePtr = std::shared_ptr< KDNode<T> >;
+inline double dist2(const T *, const T *, const size_t &);
 
+// Implicit, array-backed KD-tree.  The points are copied once into a flat
+// row-major array in tree order, with m_order mapping each position back to
+// the index of the point in the input.  Node i has children 2i + 1 and
+// 2i + 2 and covers a contiguous range of positions that is halved at every
+// level, so ranges are recomputed on the way down instead of stored; only
+// the split dimension and value of each internal node are kept.  Every leaf
+// at the bottom level is a bucket of at most leaf_size points (at least half
+// that once there are more than leaf_size points), and queries walk the
+// arrays without allocating.  The arrays are read through views, of the
+// tree's own vectors or of a file written by save and mapped by load.
 template <typename T>
-inline double dist(const std::vector<T> &, const std::vector<T> &);
-template <typename T>
-inline double dist(const KDNodePtr<T> &, const KDNodePtr<T> &);
+class KDTree {
+    size_t m_dims;
+    size_t m_leaf_size;
+    // depth of the leaves, and the internal nodes above them
+    size_t m_levels;
+    index_file::View<T> m_points;
+    index_file::View<size_t> m_order;
+    index_file::View<T> m_split_values;
+    index_file::View<size_t> m_split_dims;
+    // what the views are over: the built arrays, or the mapped file
+    std::vector<T> m_owned_points;
+    std::vector<size_t> m_owned_order;
+    std::vector<T> m_owned_split_values;
+    std::vector<size_t> m_owned_split_dims;
+    index_file::File m_file;
+    // approximate search: leaves checked per query (0 for no limit), and
+    // (1 + epsilon)^2, the factor subtrees must beat the current worst by
+    size_t m_max_leaves;
+    double m_scale;
 
-// Need for sorting
-template <typename T>
-class comparer {
-   public:
-    size_t idx;
-    explicit comparer(size_t idx_);
-    inline bool compare_idx(
-        const std::pair< std::vector<T>, size_t > &,  //
-        const std::pair< std::vector<T>, size_t > &   //
-    );
-};
+    // subtree queued by best-bin-first search, with a lower bound on its
+    // squared distance to the query
+    struct Branch {
+        double bound;
+        size_t node;
+        size_t begin;
+        size_t end;
+        size_t level;
+    };
 
-template <typename T>
-inline void sort_on_idx(const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &,  //
-                        const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &,  //
-                        size_t idx);
+    void swap_rows(const size_t &a, const size_t &b);
+    // moves the rows of [begin, end) so row k holds the k-th smallest value
+    // of dimension dim, with no larger value before it nor smaller after it
+    void select_rows(size_t begin, size_t end, const size_t &k, const size_t &dim);
 
-template <typename T>
-class KDTree {
-    KDNodePtr<T> root;
-    KDNodePtr<T> leaf;
+    // by value, as the subtrees are built in tasks that outlive the caller's
+    // frame
+    void make_tree(const size_t node, const size_t begin, const size_t end,
+                   const size_t level);
 
-    KDNodePtr<T> make_tree(const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &begin,  //
-                        const typename std::vector< std::pair< std::vector<T>, size_t> >::iterator &end,    //
-                        const size_t &length,                  //
-                        const size_t &level                    //
-    );
+    const T *point(const size_t &position) const;
+
+    // points the views at the owned arrays
+    void bind();
 
    public:
-    KDTree() = default;
-    explicit KDTree(std::vector<std::vector<T> > point_array);
+    KDTree();
+    explicit KDTree(const std::vector<std::vector<T> > &point_array, const size_t &leaf_size = 32);
+    KDTree(const KDTree &other);
+    KDTree(KDTree &&other) = default;
+    KDTree &operator=(const KDTree &other);
+    KDTree &operator=(KDTree &&other) = default;
+
+    // Writes the tree to a versioned binary file (see index_file.hpp).
+    void save(const std::string &path) const;
+
+    // Maps a file written by save and queries it in place, without
+    // rebuilding or copying the arrays.  Throws std::runtime_error if the
+    // file is not a KDTree of T written on a compatible machine.
+    static KDTree load(const std::string &path);
+
+    size_t size() const;
+    size_t dimensions() const;
+    // number of nodes, internal and leaves; node ids run from 0 to this
+    size_t node_count() const;
+
+    // Approximate nearest and k-nearest queries (single, filtered, batched
+    // and all-points).  With max_leaves > 0 the leaves are searched
+    // best-bin-first, closest bounding split first, and the search stops
+    // after max_leaves of them; with epsilon > 0 a subtree is only searched
+    // if it could hold a point more than 1 + epsilon times closer than the
+    // current k-th, so every neighbor returned is within 1 + epsilon of
+    // the true one.  (0, 0), the default, is the exact search.
+    void set_approximation(const size_t &max_leaves, const double &epsilon = 0);
 
    private:
-    KDNodePtr<T> nearest_(           //
-        const KDNodePtr<T> &branch,  //
-        const std::vector<T> &pt,        //
-        const size_t &level,      //
-        const KDNodePtr<T> &best,    //
-        const double &best_dist   //
-    );
+    void nearest_(const size_t &node, const size_t &begin, const size_t &end,
+                  const size_t &level, const T *pt, std::pair<double, size_t> &best);
 
-    // default caller
-    KDNodePtr<T> nearest_(const std::vector<T> &pt);
+    // default caller, as (squared distance, position)
+    std::pair<double, size_t> nearest_(const std::vector<T> &pt);
 
    public:
     std::vector<T> nearest_point(const std::vector<T> &pt);
@@ -91,9 +116,87 @@ class KDTree {
     std::pair< std::vector<T>, size_t> nearest_pointIndex(const std::vector<T> &pt);
 
    private:
-    std::vector< std::pair< std::vector<T>, size_t> > neighborhood_(
-        const KDNodePtr<T> &branch, const std::vector<T> &pt,
-        const double &rad, const size_t &level);
+    // heap[0..size) is a max-heap of (squared distance, index) bounded to
+    // the k best so far, of the positions accept(position) allows
+    template <typename Accept>
+    void nearest_k_(const size_t &node, const size_t &begin, const size_t &end,
+                    const size_t &level, const T *pt, const size_t &k,
+                    Accept &accept, std::pair<double, size_t> *heap,
+                    size_t &size);
+
+    // best-bin-first search of at most m_max_leaves leaves, as nearest_k_
+    // from the root with key(position) stored in the heap; pending is
+    // scratch space for the queued subtrees
+    template <typename Accept, typename Key>
+    void nearest_bbf_(const T *pt, const size_t &k, Accept &accept, Key &key,
+                      std::pair<double, size_t> *heap, size_t &size,
+                      std::vector<Branch> &pending);
+
+    // k nearest of pt into row[0..k) of indices and distances, closest
+    // first, padded with std::numeric_limits<size_t>::max() and infinity
+    template <typename Accept>
+    void nearest_k_row_(const T *pt, const size_t &k, Accept &accept,
+                        std::pair<double, size_t> *heap, std::vector<Branch> &pending,
+                        size_t *indices, double *distances);
+
+    template <typename Accept, typename Cost, typename Skip>
+    void nearest_if_(const size_t &node, const size_t &begin, const size_t &end,
+                     const size_t &level, const T *pt, Accept &accept, Cost &cost,
+                     Skip &skip, std::pair<double, size_t> &best);
+
+    size_t subtree_labels_(const size_t &node, const size_t &begin, const size_t &end,
+                           const size_t &level, const std::vector<size_t> &labels,
+                           std::vector<size_t> &output);
+
+   public:
+    // k nearest points as (distance, index), closest first
+    std::vector< std::pair<double, size_t> > nearest_k(const std::vector<T> &pt, const size_t &k);
+
+    // k nearest points among those accept(index) allows
+    template <typename Accept>
+    std::vector< std::pair<double, size_t> > nearest_k_if(const std::vector<T> &pt, const size_t &k, Accept accept);
+
+    // k nearest points of every query in parallel, as flat row-major
+    // n x k arrays of indices and distances, closest first.  Rows with fewer
+    // than k points available are padded with
+    // std::numeric_limits<size_t>::max() and infinity.
+    void nearest_k_batch(const std::vector<std::vector<T> > &points, const size_t &k,
+                         std::vector<size_t> &indices, std::vector<double> &distances);
+
+    // As nearest_k_batch over the tree's own points, row i for input point
+    // i, leaving each point out of its own row.
+    void all_nearest_k(const size_t &k, std::vector<size_t> &indices,
+                       std::vector<double> &distances);
+
+    // Nearest point under a derived cost among the points accept(index)
+    // allows, as (cost, index).  cost(index, distance) must never be less
+    // than the Euclidean distance so subtrees can still be pruned.  Returns
+    // index std::numeric_limits<size_t>::max() if nothing under bound is found.
+    template <typename Accept, typename Cost>
+    std::pair<double, size_t> nearest_if(const std::vector<T> &pt, Accept accept, Cost cost,
+                                         const double &bound = std::numeric_limits<double>::infinity());
+
+    // As above, but skip(node) may discard the whole subtree below a node,
+    // e.g. using subtree_labels.
+    template <typename Accept, typename Cost, typename Skip>
+    std::pair<double, size_t> nearest_if(const std::vector<T> &pt, Accept accept, Cost cost,
+                                         const double &bound, Skip skip);
+
+    // For every node (by node id) the label shared by all points of its
+    // subtree, or std::numeric_limits<size_t>::max() when they differ.
+    std::vector<size_t> subtree_labels(const std::vector<size_t> &labels);
+
+   private:
+    // visit(position, squared distance) for every point within r2
+    template <typename Visitor>
+    void neighborhood_(const size_t &node, const size_t &begin, const size_t &end,
+                       const size_t &level, const T *pt, const double &r2,
+                       Visitor &visit);
+
+    // false once count reaches stop_at; strict leaves out points at r2
+    bool count_within_(const size_t &node, const size_t &begin, const size_t &end,
+                       const size_t &level, const T *pt, const double &r2,
+                       const size_t &stop_at, const bool &strict, size_t &count);
 
    public:
     std::vector< std::pair< std::vector<T>, size_t> > neighborhood(
@@ -104,4 +207,85 @@ class KDTree {
 
     std::vector<size_t> neighborhood_indices(
         const std::vector<T> &pt, const double &rad);
+
+    // Fills output (cleared first) so its capacity is reused across queries.
+    void neighborhood_indices(const std::vector<T> &pt, const double &rad,
+                              std::vector<size_t> &output);
+
+    // Calls visit(index, distance) for every point within rad of pt, in no
+    // particular order, without allocating.
+    template <typename Visitor>
+    void neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit);
+
+    // Number of points within rad of pt, stopping the search as soon as
+    // stop_at are found (e.g. min_points for a core test).  strict only
+    // counts points closer than rad, as the DBSCAN neighborhoods do.
+    size_t count_within(const std::vector<T> &pt, const double &rad,
+                        const size_t &stop_at = std::numeric_limits<size_t>::max(),
+                        const bool &strict = false);
+
+   private:
+    // bounding box of every node, row node of low and high
+    void node_boxes_(const size_t &node, const size_t &begin, const size_t &end,
+                     const size_t &level, T *low, T *high);
+
+    // pairs of a's and b's points closer than sqrt(r2) into the calling
+    // thread's buffer, a == b for the pairs within a node; by value, as node
+    // pairs are joined in tasks that outlive the caller's frame
+    template <typename S>
+    void self_join_(const size_t a, const size_t a_begin, const size_t a_end,
+                    const size_t b, const size_t b_begin, const size_t b_end,
+                    const size_t level, const T *low, const T *high, const double r2,
+                    const bool distances, std::vector<std::vector<pairwise::Edge<S> > > *buffers);
+
+    // state of a nearest_foreign search: point arrays by tree position,
+    // node arrays by node id
+    struct Foreign {
+        const size_t *labels;
+        const double *weights;
+        const size_t *node_labels;
+        const double *node_weights;
+        double *node_bounds;
+        const T *low;
+        const T *high;
+        std::pair<double, size_t> *nearest;
+    };
+
+    // per node the lowest and the highest of values (by position) over its
+    // subtree, either output may be null
+    void node_extremes_(const size_t &node, const size_t &begin, const size_t &end,
+                        const size_t &level, const double *values, double *lowest,
+                        double *highest);
+
+    // squared distance between the boxes of nodes a and b
+    double box_gap2_(const size_t &a, const size_t &b, const T *low, const T *high) const;
+
+    // nearest foreign points of a's points among b's; by value, as query
+    // subtrees are searched in tasks that outlive the caller's frame
+    void nearest_foreign_(const size_t a, const size_t a_begin, const size_t a_end,
+                          const size_t b, const size_t b_begin, const size_t b_end,
+                          const size_t level, Foreign *search);
+
+   public:
+    // Dual-tree step of Boruvka's minimum spanning tree under the cost
+    // max(distance, weights[p], weights[q]) (mutual reachability with core
+    // distances as weights, the Euclidean tree with zero weights): for
+    // every point p, the cheapest q with another label, as (cost, index),
+    // among those cheaper than bounds[p] (e.g. the best edge known for its
+    // label).  Query and reference subtrees are pruned together by their
+    // boxes, lowest weights and labels, and a query subtree by the worst
+    // bound of its points.  Index std::numeric_limits<size_t>::max() where
+    // nothing is cheaper.
+    std::vector<std::pair<double, size_t> > nearest_foreign(const std::vector<size_t> &labels,
+                                                           const std::vector<double> &weights,
+                                                           const std::vector<double> &bounds);
+
+    // Every pair of points closer than rad (strictly) by one dual-tree
+    // traversal: node pairs whose boxes are rad or more apart are pruned,
+    // and pairs whose boxes lie entirely within rad are taken whole.  Same
+    // CSR layout as pairwise::pdist_threshold.  Without distances the
+    // values are left 0, for callers that only need the adjacency.
+    template <typename S>
+    pairwise::CSRMatrix<S> self_join(const double &rad, const bool include_self = true,
+                                     const bool distances = true);
 };
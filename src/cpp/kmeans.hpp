@@ -6,6 +6,7 @@
 #include <vector>
 #include <algorithm>
 #include <unordered_map>
+#include "hnsw/hnsw.cpp"
 
 
 namespace clustering {
@@ -286,6 +287,7 @@ namespace clustering {
         long int m_max_iterations;
         T m_tolerance;
         T (* m_distance)(std::vector<T>, std::vector<T>);
+        bool m_centroid_index;
 
         void initialize_random_centroids(std::vector<std::vector<T> > &data, std::vector<std::vector<T> > &centroids) {
             size_t sample_count = data.size();
@@ -391,6 +393,15 @@ namespace clustering {
             return changes;
         }
 
+        template <typename Distance>
+        void nearest_centroids(std::vector<std::vector<T> > &data, std::vector<std::vector<T> > &centroids, const Distance &distance, std::vector<size_t> &nearest) {
+            // approximate nearest centroid of every sample, searched in an
+            // HNSW graph of the centroids rebuilt as they move
+            const HNSW<T, Distance> index(centroids, distance);
+            std::vector<double> distances;
+            index.nearest_k_batch(data, 1, nearest, distances);
+        }
+
         long int update_clusters(std::vector<std::vector<T> > &data, std::vector<std::vector<T> > &centroids, std::vector<long int> &clusters) {
             size_t centroid_count = centroids.size();
             size_t sample_count = data.size();
@@ -398,6 +409,22 @@ namespace clustering {
 
             long int assignment_changes = 0;
 
+            if (m_centroid_index) {
+                std::vector<size_t> nearest;
+                if (distance::is_euclidean(m_distance)) {
+                    nearest_centroids(data, centroids, distance::Euclidean(), nearest);
+                } else {
+                    nearest_centroids(data, centroids, distance::Function<T>(m_distance), nearest);
+                }
+                for (i = 0; i < sample_count; ++i) {
+                    if (clusters[i] != static_cast<long int>(nearest[i])) {
+                        clusters[i] = nearest[i];
+                        ++assignment_changes;
+                    }
+                }
+                return assignment_changes;
+            }
+
             T distance = 0.0;
             long int closest_centroid = 0;
             T closest_centroid_distance = 9999999;
@@ -428,6 +455,7 @@ namespace clustering {
             m_max_iterations = max_iterations;
             m_tolerance = tolerance;
             m_distance = distance_func;
+            m_centroid_index = false;
         }
 
         void setK(const long int k) {
@@ -454,6 +482,17 @@ namespace clustering {
             return this->m_tolerance;
         }
 
+        // Assign samples to the nearest centroid found in an HNSW graph of
+        // the centroids instead of comparing every centroid.  Approximate;
+        // for large k.
+        void setCentroidIndex(const bool centroidIndex) {
+            this->m_centroid_index = centroidIndex;
+        }
+
+        bool getCentroidIndex() {
+            return this->m_centroid_index;
+        }
+
         std::tuple<std::vector<std::vector<T> >, std::vector<long int> > predict(std::vector<std::vector<T> > &data) {
 
             size_t sample_size = data.size();
@@ -0,0 +1,160 @@
+#ifndef MEMBERSHIPS_H
+#define MEMBERSHIPS_H
+
+#include <cstddef>
+#include <algorithm>
+#include <map>
+#include <numeric>
+#include <vector>
+
+namespace density {
+
+    namespace fuzzy {
+
+        template <typename V = float, typename C = int>
+        struct Memberships {
+            // Fuzzy clusters in sparse row storage: point i belongs to
+            // clusters[offsets[i]..offsets[i + 1]) sorted ascending, noise
+            // as -1, with matching values.  Three flat arrays instead of one
+            // std::map per point, which bindings can hand out as is.
+            std::vector<size_t> offsets = {0};
+            std::vector<C> clusters = {};
+            std::vector<V> values = {};
+
+            Memberships() {};
+
+            // copy with other value and cluster types, e.g. float and int
+            template <typename V2, typename C2>
+            explicit Memberships(const Memberships<V2, C2> &other): offsets(other.offsets), clusters(other.clusters.begin(), other.clusters.end()), values(other.values.begin(), other.values.end()) {}
+
+            size_t size() const {
+                return offsets.size() - 1;
+            }
+
+            size_t nonzeros() const {
+                return clusters.size();
+            }
+
+            size_t degree(const size_t i) const {
+                return offsets[i + 1] - offsets[i];
+            }
+
+            // membership of point i in cluster, 0 if it has none
+            V membership(const size_t i, const C cluster) const {
+                auto begin = clusters.begin() + offsets[i];
+                auto end = clusters.begin() + offsets[i + 1];
+                auto it = std::lower_bound(begin, end, cluster);
+                if (it == end || *it != cluster) {
+                    return 0;
+                }
+                return values[std::distance(clusters.begin(), it)];
+            }
+
+            std::vector<std::map<C, V> > to_maps() const {
+                const long int point_count = static_cast<long int>(size());
+                std::vector<std::map<C, V> > output(point_count);
+                long int i = 0;
+                #pragma omp parallel for if(point_count > 2000)
+                for (i = 0; i < point_count; ++i) {
+                    for (size_t k = offsets[i]; k < offsets[i + 1]; ++k) {
+                        output[i].emplace_hint(output[i].end(), clusters[k], values[k]);
+                    }
+                }
+                return output;
+            }
+        };
+
+        template <typename V = double, typename C = int>
+        class MembershipBuilder {
+            // Collects the memberships an estimator assigns as a log of
+            // (point, cluster, value), sorted into Memberships in one pass at
+            // the end.  A later value for the same point and cluster replaces
+            // the earlier one, as with std::map.  Not thread safe.
+
+            private:
+                struct Entry {
+                    size_t point;
+                    C cluster;
+                    V value;
+                };
+
+                std::vector<Entry> m_entries;
+                // per point: 1 if it has a membership, 3 if one is noise
+                std::vector<unsigned char> m_states;
+
+            public:
+                explicit MembershipBuilder(const size_t point_count = 0): m_states(point_count, 0) {}
+
+                size_t size() const {
+                    return m_states.size();
+                }
+
+                void set(const size_t point, const C cluster, const V value) {
+                    m_entries.push_back(Entry{point, cluster, value});
+                    m_states[point] |= cluster < 0 ? 3 : 1;
+                }
+
+                bool empty(const size_t point) const {
+                    return m_states[point] == 0;
+                }
+
+                bool noise(const size_t point) const {
+                    return m_states[point] == 3;
+                }
+
+                Memberships<V, C> build() const {
+                    // entries counted and scattered by point in log order,
+                    // then each row sorted by cluster keeping the last value
+                    const size_t point_count = size();
+                    const size_t entry_count = m_entries.size();
+                    std::vector<size_t> starts(point_count + 1, 0);
+                    for (const Entry &entry: m_entries) {
+                        ++starts[entry.point + 1];
+                    }
+                    std::partial_sum(starts.begin(), starts.end(), starts.begin());
+                    std::vector<size_t> order(entry_count);
+                    std::vector<size_t> cursors(starts.begin(), starts.end() - 1);
+                    for (size_t k = 0; k < entry_count; ++k) {
+                        order[cursors[m_entries[k].point]++] = k;
+                    }
+
+                    Memberships<V, C> output;
+                    output.offsets.assign(point_count + 1, 0);
+                    const long int row_count = static_cast<long int>(point_count);
+                    long int i = 0;
+                    #pragma omp parallel for if(entry_count > 100000)
+                    for (i = 0; i < row_count; ++i) {
+                        const auto begin = order.begin() + starts[i], end = order.begin() + starts[i + 1];
+                        if (end - begin > 1) {
+                            std::sort(begin, end, [this](const size_t a, const size_t b) {
+                                return m_entries[a].cluster < m_entries[b].cluster || (m_entries[a].cluster == m_entries[b].cluster && a < b);
+                            });
+                        }
+                        size_t kept = 0;
+                        for (auto it = begin; it != end; ++it) {
+                            kept += it + 1 == end || m_entries[*(it + 1)].cluster != m_entries[*it].cluster;
+                        }
+                        output.offsets[i + 1] = kept;
+                    }
+                    std::partial_sum(output.offsets.begin(), output.offsets.end(), output.offsets.begin());
+                    output.clusters.resize(output.offsets[point_count]);
+                    output.values.resize(output.offsets[point_count]);
+                    #pragma omp parallel for if(entry_count > 100000)
+                    for (i = 0; i < row_count; ++i) {
+                        const auto begin = order.begin() + starts[i], end = order.begin() + starts[i + 1];
+                        size_t position = output.offsets[i];
+                        for (auto it = begin; it != end; ++it) {
+                            if (it + 1 == end || m_entries[*(it + 1)].cluster != m_entries[*it].cluster) {
+                                output.clusters[position] = m_entries[*it].cluster;
+                                output.values[position] = m_entries[*it].value;
+                                ++position;
+                            }
+                        }
+                    }
+                    return output;
+                }
+        };
+    }
+}
+
+#endif /* MEMBERSHIPS_H */
@@ -2,9 +2,12 @@
 #define MOVING_H
 
 #include "dbscan.cpp"
+#include "rtree/rtree.cpp"
 #include <set>
 #include <map>
 #include <algorithm>
+#include <cmath>
+#include <numeric>
 #include <tuple>
 
 namespace density {
@@ -31,12 +34,176 @@ namespace density {
             return v3;
         }
 
+        template <typename T>
+        class TrajectoryIndex {
+            /*
+            R-tree (see RTree) over the space-time boxes of the segments of
+            trajectories given as data[object][time][coordinate], the layout
+            the estimators of this namespace take.  Time is the snapshot
+            index and objects move in straight lines between snapshots, so a
+            segment is kept by a query only if the line itself meets the
+            window, not just its box.
+
+            Original paper: STR: A Simple and Efficient Algorithm for R-Tree
+            Packing (Leutenegger, Lopez, Edgington 1997)
+            */
+
+            private:
+                size_t m_objects;
+                size_t m_times;
+                size_t m_dims;
+                // position of every object at every time, flat
+                std::vector<T> m_positions;
+                RTree<T> m_tree;
+
+                size_t segments() const {
+                    return m_times > 1 ? m_times - 1 : 1;
+                }
+
+                const T *position(const size_t object, const size_t time) const {
+                    return &m_positions[(object * m_times + time) * m_dims];
+                }
+
+                bool meets(const size_t segment, const std::vector<T> &low, const std::vector<T> &high, const double begin, const double end) const {
+                    // clips the parameter s in [0, 1] of the segment to every
+                    // dimension of the window in turn
+                    const size_t object = segment / segments();
+                    const size_t time = segment % segments();
+                    const T *start = position(object, time);
+                    const T *stop = m_times > 1 ? position(object, time + 1) : start;
+                    double s_low = 0.0, s_high = 1.0;
+                    auto clip = [&s_low, &s_high](const double from, const double to, const double lower, const double upper) {
+                        const double delta = to - from;
+                        if (delta == 0) {
+                            return from >= lower && from <= upper;
+                        }
+                        double first = (lower - from) / delta, last = (upper - from) / delta;
+                        if (first > last) {
+                            std::swap(first, last);
+                        }
+                        s_low = std::max(s_low, first);
+                        s_high = std::min(s_high, last);
+                        return s_low <= s_high;
+                    };
+                    if (!clip(time, m_times > 1 ? time + 1.0 : time, begin, end)) {
+                        return false;
+                    }
+                    for (size_t d = 0; d < m_dims; ++d) {
+                        if (!clip(start[d], stop[d], low[d], high[d])) {
+                            return false;
+                        }
+                    }
+                    return true;
+                }
+
+            public:
+                TrajectoryIndex(): m_objects(0), m_times(0), m_dims(0) {};
+
+                TrajectoryIndex(const std::vector<std::vector<std::vector<T> > > &data, const size_t node_size = 16) {
+                    m_objects = data.size();
+                    m_times = m_objects ? data.front().size() : 0;
+                    m_dims = m_times ? data.front().front().size() : 0;
+                    if (m_times == 0) {
+                        m_objects = 0;
+                        return;
+                    }
+                    m_positions.resize(m_objects * m_times * m_dims);
+                    const size_t segment_count = m_objects * segments();
+                    std::vector<std::vector<T> > lows(segment_count), highs(segment_count);
+                    long int object = 0;
+                    #pragma omp parallel for if(m_objects > 2000)
+                    for (object = 0; object < static_cast<long int>(m_objects); ++object) {
+                        assert(data[object].size() == m_times);
+                        for (size_t time = 0; time < m_times; ++time) {
+                            assert(data[object][time].size() == m_dims);
+                            std::copy(data[object][time].begin(), data[object][time].end(), m_positions.begin() + (object * m_times + time) * m_dims);
+                        }
+                        // box of every segment: both ends in space, then time
+                        for (size_t time = 0; time < segments(); ++time) {
+                            const T *start = position(object, time);
+                            const T *stop = m_times > 1 ? position(object, time + 1) : start;
+                            std::vector<T> &low = lows[object * segments() + time];
+                            std::vector<T> &high = highs[object * segments() + time];
+                            low.resize(m_dims + 1);
+                            high.resize(m_dims + 1);
+                            for (size_t d = 0; d < m_dims; ++d) {
+                                low[d] = std::min(start[d], stop[d]);
+                                high[d] = std::max(start[d], stop[d]);
+                            }
+                            low[m_dims] = static_cast<T>(time);
+                            high[m_dims] = static_cast<T>(m_times > 1 ? time + 1 : time);
+                        }
+                    }
+                    m_tree = RTree<T>(lows, highs, node_size);
+                }
+
+                size_t size() const {
+                    return m_objects;
+                }
+
+                // Objects whose trajectory passes through the box from low to
+                // high during the times [begin, end], ascending.
+                std::vector<size_t> window(const std::vector<T> &low, const std::vector<T> &high, const double begin, const double end) const {
+                    assert(low.size() == m_dims && high.size() == m_dims);
+                    std::vector<size_t> output;
+                    if (m_objects == 0) {
+                        return output;
+                    }
+                    std::vector<T> box_low(low), box_high(high);
+                    box_low.push_back(static_cast<T>(std::floor(begin)));
+                    box_high.push_back(static_cast<T>(std::ceil(end)));
+                    m_tree.window_visit(box_low, box_high, [this, &output, &low, &high, &begin, &end](const size_t segment) {
+                        if (meets(segment, low, high, begin, end)) {
+                            output.push_back(segment / segments());
+                        }
+                    });
+                    std::sort(output.begin(), output.end());
+                    output.erase(std::unique(output.begin(), output.end()), output.end());
+                    return output;
+                }
+
+                // Objects inside the box from low to high at time, ascending.
+                std::vector<size_t> time_slice(const double time, const std::vector<T> &low, const std::vector<T> &high) const {
+                    return window(low, high, time, time);
+                }
+        };
+
+        template <typename T>
+        std::vector<int> snapshot_clusters(density::DBSCAN<T> &estimator, const std::vector<std::vector<std::vector<T> > > &data, const size_t column, const TrajectoryIndex<T> *index, const std::vector<T> &low, const std::vector<T> &high) {
+            // clusters of the objects at one time; with an index only the
+            // objects inside the region are clustered and the rest are noise
+            const size_t data_size = data.size();
+            std::vector<size_t> objects;
+            if (index == nullptr) {
+                objects.resize(data_size);
+                std::iota(objects.begin(), objects.end(), 0);
+            } else {
+                objects = index->time_slice(column, low, high);
+            }
+            std::vector<int> clusters(data_size, -1);
+            if (objects.empty()) {
+                return clusters;
+            }
+            std::vector<std::vector<T> > column_data = std::vector<std::vector<T> >(objects.size());
+            for (size_t i = 0; i < objects.size(); ++i) {
+                column_data[i] = data[objects[i]][column];
+            }
+            std::vector<int> object_clusters = estimator.predict(column_data);
+            for (size_t i = 0; i < objects.size(); ++i) {
+                clusters[objects[i]] = object_clusters[i];
+            }
+            return clusters;
+        }
+
         template <typename T>
         class MovingDBSCAN {
 
             private:
                 density::DBSCAN<T> m_estimator;
                 double m_theta;
+                // region the objects are clustered in, none if empty
+                std::vector<T> m_region_low;
+                std::vector<T> m_region_high;
 
                 double jaccard(std::vector<size_t> A, std::vector<size_t> B) {
                     std::vector<size_t> numerator_set = vector_intersection(A, B);
@@ -57,7 +224,29 @@ namespace density {
                 }
                 virtual ~MovingDBSCAN() {};
 
+                // Only cluster the objects inside the box from low to high at
+                // each time, found through a TrajectoryIndex; the others are
+                // noise.
+                void setRegion(const std::vector<T> &low, const std::vector<T> &high) {
+                    assert(low.size() == high.size());
+                    this->m_region_low = low;
+                    this->m_region_high = high;
+                }
+
+                void clearRegion() {
+                    this->m_region_low.clear();
+                    this->m_region_high.clear();
+                }
+
                 std::vector<std::vector<int> > predict(const std::vector<std::vector<std::vector<T> > > &data) {
+                    return predict(data, m_region_low.empty() ? TrajectoryIndex<T>() : TrajectoryIndex<T>(data));
+                }
+
+                // As predict, with the region looked up in an index built
+                // once over data by the caller, e.g. to try several regions;
+                // the index is not used without a region.
+                std::vector<std::vector<int> > predict(const std::vector<std::vector<std::vector<T> > > &data, const TrajectoryIndex<T> &index) {
+                    assert(m_region_low.empty() || index.size() == data.size());
                     const size_t columns = data.front().size();
                     const size_t data_size = data.size();
 
@@ -66,11 +255,7 @@ namespace density {
                     std::set<int> previous_unique_clusters;
                     std::vector<int> previous_clusters;
                     for (size_t column = 0; column < columns; ++column) {
-                        std::vector<std::vector<T> > column_data = std::vector<std::vector<T> >(data_size);
-                        for (size_t i = 0; i < data_size; ++i) {
-                            column_data[i] = data[i][column];
-                        }
-                        std::vector<int> clusters = m_estimator.predict(column_data);
+                        std::vector<int> clusters = snapshot_clusters(m_estimator, data, column, m_region_low.empty() ? nullptr : &index, m_region_low, m_region_high);
                         std::set<int> unique_clusters;
                         for (const int &i: clusters) {
                             if (i < 0) { continue; }
@@ -188,6 +373,9 @@ namespace density {
                 density::DBSCAN<T> m_estimator;
                 unsigned int m_k;
                 unsigned int m_m;
+                // region the objects are clustered in, none if empty
+                std::vector<T> m_region_low;
+                std::vector<T> m_region_high;
 
             public:
                 CMC(density::DBSCAN<T>& estimator, const unsigned int k, const unsigned int m) {
@@ -199,7 +387,28 @@ namespace density {
                 }
                 virtual ~CMC() {};
 
+                // Only look for convoys among the objects inside the box from
+                // low to high at each time, found through a TrajectoryIndex.
+                void setRegion(const std::vector<T> &low, const std::vector<T> &high) {
+                    assert(low.size() == high.size());
+                    this->m_region_low = low;
+                    this->m_region_high = high;
+                }
+
+                void clearRegion() {
+                    this->m_region_low.clear();
+                    this->m_region_high.clear();
+                }
+
                 std::tuple<std::vector<std::vector<size_t> >, std::vector<size_t>, std::vector<size_t> > predict(const std::vector< std::vector<std::vector<T> > > &data) {
+                    return predict(data, m_region_low.empty() ? TrajectoryIndex<T>() : TrajectoryIndex<T>(data));
+                }
+
+                // As predict, with the region looked up in an index built
+                // once over data by the caller; the index is not used
+                // without a region.
+                std::tuple<std::vector<std::vector<size_t> >, std::vector<size_t>, std::vector<size_t> > predict(const std::vector< std::vector<std::vector<T> > > &data, const TrajectoryIndex<T> &index) {
+                    assert(m_region_low.empty() || index.size() == data.size());
                     const size_t columns = data.front().size();
                     const size_t data_size = data.size();
 
@@ -212,11 +421,7 @@ namespace density {
                     std::set<int> previous_unique_clusters;
                     std::vector<int> previous_clusters;
                     for (size_t column = 0; column < columns; ++column) {
-                        std::vector<std::vector<T> > column_data = std::vector<std::vector<T> >(data_size);
-                        for (size_t i = 0; i < data_size; ++i) {
-                            column_data[i] = data[i][column];
-                        }
-                        std::vector<int> clusters = m_estimator.predict(column_data);
+                        std::vector<int> clusters = snapshot_clusters(m_estimator, data, column, m_region_low.empty() ? nullptr : &index, m_region_low, m_region_high);
                         std::vector<ConvoyCandidate> current_candidates;
                         std::set<int> unique_clusters;
                         for (const int &i: clusters) {
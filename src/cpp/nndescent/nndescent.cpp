@@ -0,0 +1,365 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+#include "nndescent.hpp"
+
+template <typename T, typename Distance>
+uint64_t NNDescent<T, Distance>::mix(const uint64_t &seed, const uint64_t &a, const uint64_t &b) {
+    // splitmix64 finalizer folded over the words
+    uint64_t x = seed;
+    const uint64_t words[2] = {a, b};
+    for (size_t i = 0; i < 2; i++) {
+        x ^= words[i];
+        x += 0x9E3779B97F4A7C15ULL;
+        x = (x ^ (x >> 30)) * 0xBF58476D1CE4E5B9ULL;
+        x = (x ^ (x >> 27)) * 0x94D049BB133111EBULL;
+        x ^= x >> 31;
+    }
+    return x;
+}
+
+template <typename T, typename Distance>
+bool NNDescent<T, Distance>::push(size_t *indices, double *distances, char *flags, const size_t &width,
+                                  const size_t &j, const double &d) {
+    if (!(d < distances[0])) {
+        return false;
+    }
+    for (size_t t = 0; t < width; t++) {
+        if (indices[t] == j) {
+            return false;
+        }
+    }
+    // replaces the farthest, at the root, and sifts the new entry down
+    size_t position = 0;
+    while (2 * position + 1 < width) {
+        size_t child = 2 * position + 1;
+        if (child + 1 < width && distances[child + 1] > distances[child]) {
+            child++;
+        }
+        if (distances[child] <= d) {
+            break;
+        }
+        indices[position] = indices[child];
+        distances[position] = distances[child];
+        flags[position] = flags[child];
+        position = child;
+    }
+    indices[position] = j;
+    distances[position] = d;
+    flags[position] = 2;
+    return true;
+}
+
+template <typename T, typename Distance>
+void NNDescent<T, Distance>::sample(uint64_t *priorities, size_t *candidates, const size_t &width,
+                                    const uint64_t &priority, const size_t &j) {
+    if (priority >= priorities[0]) {
+        return;
+    }
+    for (size_t t = 0; t < width; t++) {
+        if (candidates[t] == j) {
+            return;
+        }
+    }
+    size_t position = 0;
+    while (2 * position + 1 < width) {
+        size_t child = 2 * position + 1;
+        if (child + 1 < width && priorities[child + 1] > priorities[child]) {
+            child++;
+        }
+        if (priorities[child] <= priority) {
+            break;
+        }
+        priorities[position] = priorities[child];
+        candidates[position] = candidates[child];
+        position = child;
+    }
+    priorities[position] = priority;
+    candidates[position] = j;
+}
+
+template <typename T, typename Distance>
+NNDescent<T, Distance>::NNDescent() : m_size(0), m_k(0), m_iterations(0) {}
+
+template <typename T, typename Distance>
+NNDescent<T, Distance>::NNDescent(const std::vector<std::vector<T> > &point_array, const size_t &k,
+                                  const Distance &distance, const double &sample_rate,
+                                  const double &delta, const size_t &max_iterations,
+                                  const unsigned int &seed)
+    : m_size(point_array.size()), m_k(k), m_iterations(0) {
+    assert(k > 0);
+    assert(sample_rate > 0);
+    const size_t n = m_size;
+    const size_t none = std::numeric_limits<size_t>::max();
+    m_indices.assign(n * k, none);
+    m_distances.assign(n * k, std::numeric_limits<double>::infinity());
+    if (n < 2) {
+        return;
+    }
+
+    const size_t dims = point_array.front().size();
+    const long int count = static_cast<long int>(n);
+    std::vector<T> points(n * dims);
+    long int i = 0;
+    #pragma omp parallel for if(n > 2000)
+    for (i = 0; i < count; i++) {
+        std::copy(point_array[i].begin(), point_array[i].end(), points.begin() + i * dims);
+    }
+    const T *rows = points.data();
+
+    // the graph is a max-heap of width (distance, index) per point, flagged
+    // 1 while new and 2 in the round it entered; it starts from width
+    // distinct random neighbors
+    const size_t width = std::min(k, n - 1);
+    std::vector<size_t> heap_indices(n * width);
+    std::vector<double> heap_distances(n * width);
+    std::vector<char> flags(n * width, 1);
+    #pragma omp parallel for if(n > 2000)
+    for (i = 0; i < count; i++) {
+        size_t *row = &heap_indices[i * width];
+        std::vector<std::pair<double, size_t> > heap;
+        heap.reserve(width);
+        for (uint64_t attempt = 0; heap.size() < width; attempt++) {
+            size_t j = width == n - 1 ? heap.size() : mix(seed, i, attempt) % (n - 1);
+            j += j >= static_cast<size_t>(i) ? 1 : 0;
+            if (std::find(row, row + heap.size(), j) != row + heap.size()) {
+                continue;
+            }
+            row[heap.size()] = j;
+            heap.push_back(std::pair<double, size_t>(distance(rows + i * dims, rows + j * dims, dims), j));
+        }
+        std::make_heap(heap.begin(), heap.end());
+        for (size_t t = 0; t < width; t++) {
+            heap_distances[i * width + t] = heap[t].first;
+            row[t] = heap[t].second;
+        }
+    }
+
+    const size_t samples = std::max<size_t>(1, static_cast<size_t>(std::ceil(sample_rate * width)));
+    std::vector<uint64_t> new_priorities(n * samples), old_priorities(n * samples);
+    std::vector<size_t> new_candidates(n * samples), old_candidates(n * samples);
+    std::vector<std::vector<Update> > buffers(pairwise::thread_count());
+    // reverse edges from the rows of thread a to those of thread b, in
+    // bucket a * threads + b
+    std::vector<std::vector<Reverse> > reverses(pairwise::thread_count() * pairwise::thread_count());
+    // points joined between two rounds of updates, which bounds the buffers
+    const size_t block = 16384;
+
+    while (m_iterations < max_iterations) {
+        m_iterations++;
+        const uint64_t round = mix(seed, m_iterations, none);
+
+        // candidates of every point: a sample of its new and old neighbors
+        // and of the points that have it as a new or old neighbor.  Each
+        // thread reads the rows of its own range of points, samples their
+        // neighbors and buckets the reverse edges by the thread that owns
+        // the other end, then samples the reverse edges bucketed for it.
+        std::fill(new_priorities.begin(), new_priorities.end(), std::numeric_limits<uint64_t>::max());
+        std::fill(old_priorities.begin(), old_priorities.end(), std::numeric_limits<uint64_t>::max());
+        std::fill(new_candidates.begin(), new_candidates.end(), none);
+        std::fill(old_candidates.begin(), old_candidates.end(), none);
+        #pragma omp parallel if(n > 2000)
+        {
+            size_t threads = 1, thread = 0;
+            #ifdef _OPENMP
+            threads = omp_get_num_threads();
+            thread = omp_get_thread_num();
+            #endif
+            const size_t begin = n * thread / threads;
+            const size_t end = n * (thread + 1) / threads;
+            auto offer = [&](const size_t u, const size_t v, const uint64_t priority, const bool fresh) {
+                uint64_t *priorities = fresh ? new_priorities.data() : old_priorities.data();
+                size_t *candidates = fresh ? new_candidates.data() : old_candidates.data();
+                sample(priorities + u * samples, candidates + u * samples, samples, priority, v);
+            };
+            for (size_t u = begin; u < end; u++) {
+                for (size_t t = 0; t < width; t++) {
+                    const size_t v = heap_indices[u * width + t];
+                    const bool fresh = flags[u * width + t] != 0;
+                    // the same for both ends, so that a point offered
+                    // twice to one list is sampled the same whatever the
+                    // order of the offers
+                    const uint64_t priority = mix(round, std::min(u, v), std::max(u, v));
+                    offer(u, v, priority, fresh);
+                    // the thread whose range [n * t / threads, n * (t + 1) / threads) holds v
+                    const size_t owner = ((v + 1) * threads - 1) / n;
+                    if (owner == thread) {
+                        offer(v, u, priority, fresh);
+                    } else {
+                        Reverse reverse = {v, u, priority, fresh};
+                        reverses[thread * threads + owner].push_back(reverse);
+                    }
+                }
+            }
+            #pragma omp barrier
+            for (size_t b = 0; b < threads; b++) {
+                std::vector<Reverse> &bucket = reverses[b * threads + thread];
+                for (const Reverse &reverse: bucket) {
+                    offer(reverse.v, reverse.u, reverse.priority, reverse.fresh);
+                }
+                bucket.clear();
+            }
+        }
+        // sampled neighbors are joined this round and are old from now on
+        #pragma omp parallel for if(n > 2000)
+        for (i = 0; i < count; i++) {
+            const size_t *candidates = &new_candidates[i * samples];
+            for (size_t t = 0; t < width; t++) {
+                if (flags[i * width + t] && std::find(candidates, candidates + samples, heap_indices[i * width + t]) != candidates + samples) {
+                    flags[i * width + t] = 0;
+                }
+            }
+        }
+
+        // local joins: new candidates with each other and with the old
+        // ones.  Heaps are read but not written while joining, and each
+        // thread then applies the updates that fall in its range.
+        for (size_t first = 0; first < n; first += block) {
+            const long int last = static_cast<long int>(std::min(n, first + block));
+            #pragma omp parallel for if(n > 2000) schedule(dynamic, 64)
+            for (i = static_cast<long int>(first); i < last; i++) {
+                std::vector<Update> &buffer = buffers[pairwise::thread_id()];
+                const size_t *fresh = &new_candidates[i * samples];
+                const size_t *old = &old_candidates[i * samples];
+                auto join = [&](const size_t p, const size_t q) {
+                    const double d = distance(rows + p * dims, rows + q * dims, dims);
+                    if (d < heap_distances[p * width] || d < heap_distances[q * width]) {
+                        Update update = {p, q, d};
+                        buffer.push_back(update);
+                    }
+                };
+                for (size_t a = 0; a < samples; a++) {
+                    const size_t p = fresh[a];
+                    if (p == none) {
+                        continue;
+                    }
+                    for (size_t b = a + 1; b < samples; b++) {
+                        if (fresh[b] != none) {
+                            join(p, fresh[b]);
+                        }
+                    }
+                    for (size_t b = 0; b < samples; b++) {
+                        if (old[b] != none && old[b] != p) {
+                            join(p, old[b]);
+                        }
+                    }
+                }
+            }
+            #pragma omp parallel if(n > 2000)
+            {
+                size_t threads = 1, thread = 0;
+                #ifdef _OPENMP
+                threads = omp_get_num_threads();
+                thread = omp_get_thread_num();
+                #endif
+                const size_t begin = n * thread / threads;
+                const size_t end = n * (thread + 1) / threads;
+                for (size_t b = 0; b < buffers.size(); b++) {
+                    for (const Update &update: buffers[b]) {
+                        if (update.i >= begin && update.i < end) {
+                            const size_t offset = update.i * width;
+                            push(&heap_indices[offset], &heap_distances[offset], &flags[offset], width, update.j, update.distance);
+                        }
+                        if (update.j >= begin && update.j < end) {
+                            const size_t offset = update.j * width;
+                            push(&heap_indices[offset], &heap_distances[offset], &flags[offset], width, update.i, update.distance);
+                        }
+                    }
+                }
+            }
+            for (size_t b = 0; b < buffers.size(); b++) {
+                buffers[b].clear();
+            }
+        }
+        // entries that entered the graph this round, flagged 2 by push;
+        // unlike the accepted updates their number does not depend on the
+        // order the updates were applied in
+        size_t changes = 0;
+        #pragma omp parallel for if(n > 2000) reduction(+:changes)
+        for (i = 0; i < static_cast<long int>(n * width); i++) {
+            if (flags[i] == 2) {
+                flags[i] = 1;
+                changes++;
+            }
+        }
+        if (changes <= delta * n * width) {
+            break;
+        }
+    }
+
+    #pragma omp parallel for if(n > 2000)
+    for (i = 0; i < count; i++) {
+        std::vector<std::pair<double, size_t> > row(width);
+        for (size_t t = 0; t < width; t++) {
+            row[t] = std::pair<double, size_t>(heap_distances[i * width + t], heap_indices[i * width + t]);
+        }
+        std::sort(row.begin(), row.end());
+        for (size_t t = 0; t < width; t++) {
+            m_distances[i * k + t] = row[t].first;
+            m_indices[i * k + t] = row[t].second;
+        }
+    }
+}
+
+template <typename T, typename Distance>
+size_t NNDescent<T, Distance>::size() const {
+    return m_size;
+}
+
+template <typename T, typename Distance>
+size_t NNDescent<T, Distance>::neighbors() const {
+    return m_k;
+}
+
+template <typename T, typename Distance>
+size_t NNDescent<T, Distance>::iterations() const {
+    return m_iterations;
+}
+
+template <typename T, typename Distance>
+const std::vector<size_t> &NNDescent<T, Distance>::indices() const {
+    return m_indices;
+}
+
+template <typename T, typename Distance>
+const std::vector<double> &NNDescent<T, Distance>::distances() const {
+    return m_distances;
+}
+
+template <typename T, typename Distance>
+template <typename S>
+pairwise::CSRMatrix<S> NNDescent<T, Distance>::threshold_graph(const S &threshold, const bool include_self) const {
+    const size_t n = m_size;
+    std::vector<std::vector<pairwise::Edge<S> > > buffers(pairwise::thread_count());
+    long int i = 0;
+    // an edge found from both ends is kept by the smaller one
+    #pragma omp parallel for if(n > 2000)
+    for (i = 0; i < static_cast<long int>(n); i++) {
+        std::vector<pairwise::Edge<S> > &buffer = buffers[pairwise::thread_id()];
+        const size_t index = static_cast<size_t>(i);
+        for (size_t t = 0; t < m_k; t++) {
+            const size_t j = m_indices[index * m_k + t];
+            const S value = static_cast<S>(m_distances[index * m_k + t]);
+            if (j == std::numeric_limits<size_t>::max() || !(value < threshold)) {
+                break;
+            }
+            const size_t *other = &m_indices[j * m_k];
+            if (j > index || std::find(other, other + m_k, index) == other + m_k) {
+                pairwise::Edge<S> edge = {index, j, value};
+                buffer.push_back(edge);
+            }
+        }
+    }
+    return pairwise::edges_to_csr<S>(n, buffers, true, include_self);
+}
@@ -0,0 +1,86 @@
+#pragma once
+
+#include <cstdint>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "../distance.hpp"
+#include "../pairwise.hpp"
+
+// Approximate k-nearest-neighbor graph by NN-Descent: every point starts
+// with k random neighbors, and each round every point introduces the
+// neighbors it has (and the points that have it as a neighbor) to each
+// other, each keeping the closest k it has been offered, until less than
+// delta of the graph changes in a round.  Each round a point joins about
+// sample_rate * k of its new and of its old neighbors, reverse ones
+// included, and a pair that already met is joined again only when one side
+// is new; rates above 1 buy recall with time.  The distance is any functor
+// distance(row1, row2, dims) (see the functors of distance.hpp); unlike the
+// trees the cost does not grow with the dimension beyond that of the
+// distance itself.  Rounds are deterministic for a seed whatever the
+// number of threads.
+//
+// Original paper: Efficient K-Nearest Neighbor Graph Construction for
+// Generic Similarity Measures (Dong, Charikar, Li 2011)
+template <typename T, typename Distance = distance::Euclidean>
+class NNDescent {
+    size_t m_size;
+    size_t m_k;
+    size_t m_iterations;
+    // row-major n x k, closest first
+    std::vector<size_t> m_indices;
+    std::vector<double> m_distances;
+
+    struct Update {
+        size_t i;
+        size_t j;
+        double distance;
+    };
+
+    // edge (v, u) offered to the candidates of v by the thread owning u
+    struct Reverse {
+        size_t v;
+        size_t u;
+        uint64_t priority;
+        bool fresh;
+    };
+
+    // pseudo-random 64 bits of (seed, a, b)
+    static uint64_t mix(const uint64_t &seed, const uint64_t &a, const uint64_t &b);
+
+    // Offers j at distance d to the max-heap of width entries at heap,
+    // unless it is already there or no closer than the farthest; returns
+    // whether it was taken.
+    static bool push(size_t *indices, double *distances, char *flags, const size_t &width,
+                     const size_t &j, const double &d);
+
+    // Keeps j in the candidate list of width entries if its priority is
+    // among the width lowest offered, which samples the offers uniformly.
+    static void sample(uint64_t *priorities, size_t *candidates, const size_t &width,
+                       const uint64_t &priority, const size_t &j);
+
+   public:
+    NNDescent();
+    NNDescent(const std::vector<std::vector<T> > &point_array, const size_t &k,
+              const Distance &distance = Distance(), const double &sample_rate = 1.0,
+              const double &delta = 0.001, const size_t &max_iterations = 12,
+              const unsigned int &seed = 5489u);
+
+    size_t size() const;
+    size_t neighbors() const;
+    // rounds the build took
+    size_t iterations() const;
+
+    // Flat row-major n x k neighbor indices and distances, row i for input
+    // point i without i itself, closest first, as KDTree::all_nearest_k
+    // returns them; rows of graphs over k or fewer points are padded with
+    // std::numeric_limits<size_t>::max() and infinity.
+    const std::vector<size_t> &indices() const;
+    const std::vector<double> &distances() const;
+
+    // The graph's edges shorter than threshold (strictly) in both
+    // directions, each once, as a symmetric CSR matrix.
+    template <typename S>
+    pairwise::CSRMatrix<S> threshold_graph(const S &threshold, const bool include_self = true) const;
+};
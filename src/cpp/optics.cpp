@@ -0,0 +1 @@
+#include "optics.hpp"
@@ -0,0 +1,286 @@
+#ifndef OPTICS_H
+#define OPTICS_H
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <limits>
+#include <vector>
+#include <algorithm>
+#include "kdtree/kdtree.cpp"
+
+namespace density {
+
+    class IndexedMinHeap {
+        // Binary min-heap over the items 0..n-1 keyed by a double, with the
+        // position of every item tracked so a key can be decreased in place.
+        // Ties are broken by item so the pop order is deterministic.
+
+    private:
+        std::vector<size_t> m_heap;
+        std::vector<size_t> m_position;
+        std::vector<double> m_key;
+
+        bool less(const size_t a, const size_t b) const {
+            return m_key[a] < m_key[b] || (m_key[a] == m_key[b] && a < b);
+        }
+
+        void swap_nodes(const size_t i, const size_t j) {
+            std::swap(m_heap[i], m_heap[j]);
+            m_position[m_heap[i]] = i;
+            m_position[m_heap[j]] = j;
+        }
+
+        void sift_up(size_t i) {
+            while (i > 0) {
+                size_t parent = (i - 1) / 2;
+                if (!less(m_heap[i], m_heap[parent])) {
+                    break;
+                }
+                swap_nodes(i, parent);
+                i = parent;
+            }
+        }
+
+        void sift_down(size_t i) {
+            const size_t size = m_heap.size();
+            while (true) {
+                size_t smallest = i, left = 2 * i + 1, right = 2 * i + 2;
+                if (left < size && less(m_heap[left], m_heap[smallest])) {
+                    smallest = left;
+                }
+                if (right < size && less(m_heap[right], m_heap[smallest])) {
+                    smallest = right;
+                }
+                if (smallest == i) {
+                    break;
+                }
+                swap_nodes(i, smallest);
+                i = smallest;
+            }
+        }
+
+    public:
+        explicit IndexedMinHeap(const size_t capacity): m_position(capacity, SIZE_MAX), m_key(capacity) {};
+
+        bool empty() const {
+            return m_heap.empty();
+        }
+
+        bool contains(const size_t item) const {
+            return m_position[item] != SIZE_MAX;
+        }
+
+        // insert item, or lower its key if it is already queued
+        void push(const size_t item, const double key) {
+            if (contains(item)) {
+                if (key < m_key[item]) {
+                    m_key[item] = key;
+                    sift_up(m_position[item]);
+                }
+                return;
+            }
+            m_key[item] = key;
+            m_position[item] = m_heap.size();
+            m_heap.push_back(item);
+            sift_up(m_heap.size() - 1);
+        }
+
+        size_t pop() {
+            size_t top = m_heap.front();
+            swap_nodes(0, m_heap.size() - 1);
+            m_heap.pop_back();
+            m_position[top] = SIZE_MAX;
+            if (!m_heap.empty()) {
+                sift_down(0);
+            }
+            return top;
+        }
+    };
+
+    template <typename T>
+    class OPTICS {
+        /*
+        Ordering Points To Identify the Clustering Structure.  One run with a
+        generating epsilon orders the points by reachability; the DBSCAN
+        clustering for any smaller epsilon can then be read off that order
+        in O(n) with extract_dbscan, without querying neighborhoods again.
+
+        Neighborhoods come from a KD-tree, so distances are Euclidean.  As
+        in density::DBSCAN a neighborhood includes the point itself and uses
+        distances strictly below epsilon.
+
+        Original paper: OPTICS: Ordering Points To Identify the Clustering
+        Structure (Ankerst, Breunig, Kriegel, Sander 1999)
+        */
+
+    private:
+        T m_epsilon;
+        long int m_min_points;
+        // epsilon of the last fit, which bounds the extractable epsilons
+        // even if setEpsilon changed m_epsilon since
+        T m_fitted_epsilon;
+        std::vector<size_t> m_ordering;
+        std::vector<double> m_reachability;
+        std::vector<double> m_core_distances;
+        // lowest reachability of each point from any of its neighbors, and
+        // that neighbor; decides border points exactly during extraction
+        std::vector<double> m_border_reachability;
+        std::vector<size_t> m_border_core;
+
+        void neighbors(KDTree<T> &tree, const std::vector<std::vector<T> > &data, const size_t index, std::vector<size_t> &indices, std::vector<double> &distances) {
+            indices.clear();
+            distances.clear();
+            tree.neighborhood_visit(data[index], m_epsilon, [&indices, &distances](const size_t neighbor, const double distance) {
+                indices.push_back(neighbor);
+                distances.push_back(distance);
+            });
+        }
+
+        double core_distance(std::vector<double> distances) {
+            const size_t k = static_cast<size_t>(m_min_points);
+            if (distances.size() < k) {
+                return std::numeric_limits<double>::infinity();
+            }
+            std::nth_element(distances.begin(), distances.begin() + (k - 1), distances.end());
+            double output = distances[k - 1];
+            // the neighborhood is strictly below epsilon
+            return output < m_epsilon ? output : std::numeric_limits<double>::infinity();
+        }
+
+        void update(const size_t index, const std::vector<size_t> &indices, const std::vector<double> &distances, const std::vector<bool> &processed, IndexedMinHeap &seeds) {
+            const double core = m_core_distances[index];
+            for (size_t i = 0; i < indices.size(); ++i) {
+                const size_t neighbor = indices[i];
+                const double reachability = std::max(core, distances[i]);
+                if (reachability < m_border_reachability[neighbor]) {
+                    m_border_reachability[neighbor] = reachability;
+                    m_border_core[neighbor] = index;
+                }
+                if (processed[neighbor] || reachability >= m_reachability[neighbor]) {
+                    continue;
+                }
+                m_reachability[neighbor] = reachability;
+                seeds.push(neighbor, reachability);
+            }
+        }
+
+        void process(KDTree<T> &tree, const std::vector<std::vector<T> > &data, const size_t index, std::vector<bool> &processed, IndexedMinHeap &seeds, std::vector<size_t> &indices, std::vector<double> &distances) {
+            neighbors(tree, data, index, indices, distances);
+            processed[index] = true;
+            m_ordering.push_back(index);
+            m_core_distances[index] = core_distance(distances);
+            if (m_core_distances[index] != std::numeric_limits<double>::infinity()) {
+                update(index, indices, distances, processed, seeds);
+            }
+        }
+
+    public:
+        OPTICS(const T epsilon, const long int min_points) {
+            assert(epsilon > 0);
+            assert(min_points > 0);
+            m_epsilon = epsilon;
+            m_min_points = min_points;
+            m_fitted_epsilon = 0;
+        }
+        virtual ~OPTICS() {};
+
+        void setEpsilon(const T epsilon) {
+            this->m_epsilon = epsilon;
+        }
+
+        T getEpsilon() {
+            return this->m_epsilon;
+        }
+
+        // generating epsilon of the last fit, 0 before any
+        T getFittedEpsilon() {
+            return this->m_fitted_epsilon;
+        }
+
+        void setMinPoints(const long int minPoints) {
+            this->m_min_points = minPoints;
+        }
+
+        long int getMinPoints() {
+            return this->m_min_points;
+        }
+
+        const std::vector<size_t> & getOrdering() {
+            return this->m_ordering;
+        }
+
+        // reachability of each point (by index), infinity where undefined
+        const std::vector<double> & getReachability() {
+            return this->m_reachability;
+        }
+
+        const std::vector<double> & getCoreDistances() {
+            return this->m_core_distances;
+        }
+
+        void fit(const std::vector<std::vector<T> > &data) {
+            const size_t sample_count = data.size();
+            const double undefined = std::numeric_limits<double>::infinity();
+            m_ordering.clear();
+            m_ordering.reserve(sample_count);
+            m_reachability.assign(sample_count, undefined);
+            m_core_distances.assign(sample_count, undefined);
+            m_border_reachability.assign(sample_count, undefined);
+            m_border_core.assign(sample_count, 0);
+            m_fitted_epsilon = m_epsilon;
+            if (sample_count == 0) {
+                return;
+            }
+
+            KDTree<T> tree(data);
+            std::vector<bool> processed(sample_count, false);
+            IndexedMinHeap seeds(sample_count);
+            std::vector<size_t> indices;
+            std::vector<double> distances;
+            for (size_t index = 0; index < sample_count; ++index) {
+                if (processed[index]) {
+                    continue;
+                }
+                process(tree, data, index, processed, seeds, indices, distances);
+                while (!seeds.empty()) {
+                    process(tree, data, seeds.pop(), processed, seeds, indices, distances);
+                }
+            }
+        }
+
+        std::vector<int> extract_dbscan(const T epsilon) {
+            // DBSCAN labels for epsilon <= the generating epsilon of the
+            // last fit, -1 for noise, in a single pass over the ordering
+            assert(epsilon <= m_fitted_epsilon);
+            const size_t sample_count = m_ordering.size();
+            std::vector<int> clusters(sample_count, -1);
+            int cluster_id = -1;
+            for (size_t i = 0; i < sample_count; ++i) {
+                const size_t index = m_ordering[i];
+                if (m_reachability[index] >= epsilon) {
+                    if (m_core_distances[index] < epsilon) {
+                        ++cluster_id;
+                        clusters[index] = cluster_id;
+                    }
+                } else {
+                    clusters[index] = cluster_id;
+                }
+            }
+            // border points ordered before every core point they border
+            for (size_t index = 0; index < sample_count; ++index) {
+                if (clusters[index] == -1 && m_border_reachability[index] < epsilon) {
+                    clusters[index] = clusters[m_border_core[index]];
+                }
+            }
+            return clusters;
+        }
+
+        std::vector<int> predict(const std::vector<std::vector<T> > &data) {
+            fit(data);
+            return extract_dbscan(m_epsilon);
+        }
+    };
+}
+
+#endif /* OPTICS_H */
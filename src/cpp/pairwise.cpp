@@ -0,0 +1 @@
+#include "pairwise.hpp"
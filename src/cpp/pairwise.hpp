@@ -0,0 +1,387 @@
+#ifndef PAIRWISE_H
+#define PAIRWISE_H
+
+#include <cassert>
+#include <cstddef>
+#include <vector>
+#include <algorithm>
+#include <numeric>
+#include <utility>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace pairwise {
+
+    // Points per tile are chosen so that two tiles of points fit in roughly
+    // this many bytes (half of a typical 64KiB L1d + L2 slice per core).
+    const size_t TILE_BYTES = 32 * 1024;
+    const size_t MIN_TILE_SIZE = 16;
+    const size_t MAX_TILE_SIZE = 512;
+
+    inline size_t tile_size(const size_t dimensions, const size_t value_size) {
+        size_t point_bytes = dimensions * value_size;
+        if (point_bytes == 0) {
+            return MAX_TILE_SIZE;
+        }
+        size_t size = TILE_BYTES / (2 * point_bytes);
+        return std::max(MIN_TILE_SIZE, std::min(MAX_TILE_SIZE, size));
+    }
+
+    inline int thread_count() {
+        #ifdef _OPENMP
+        return omp_get_max_threads();
+        #else
+        return 1;
+        #endif
+    }
+
+    inline int thread_id() {
+        #ifdef _OPENMP
+        return omp_get_thread_num();
+        #else
+        return 0;
+        #endif
+    }
+
+    // (row tile, column tile) pairs covering the upper triangle of an n x n
+    // matrix, including the diagonal tiles.
+    inline std::vector<std::pair<size_t, size_t> > upper_tiles(const size_t n, const size_t tile) {
+        std::vector<std::pair<size_t, size_t> > output;
+        size_t tiles = (n + tile - 1) / tile;
+        output.reserve(tiles * (tiles + 1) / 2);
+        for (size_t a = 0; a < tiles; ++a) {
+            for (size_t b = a; b < tiles; ++b) {
+                output.push_back(std::make_pair(a * tile, b * tile));
+            }
+        }
+        return output;
+    }
+
+    template <typename S>
+    class CondensedMatrix {
+        // Symmetric distance matrix stored as its strict upper triangle, row
+        // by row: n * (n - 1) / 2 values instead of n * n.  The diagonal is
+        // implicitly zero.  Matches the layout of scipy's pdist.
+
+    private:
+        size_t m_size;
+        std::vector<S> m_values;
+
+    public:
+        CondensedMatrix(): m_size(0) {};
+        explicit CondensedMatrix(const size_t size): m_size(size), m_values(size > 1 ? size * (size - 1) / 2 : 0) {};
+
+        size_t size() const {
+            return m_size;
+        }
+
+        size_t index(size_t i, size_t j) const {
+            assert(i != j);
+            if (j < i) {
+                std::swap(i, j);
+            }
+            return m_size * i - (i * (i + 1)) / 2 + (j - i - 1);
+        }
+
+        S at(const size_t i, const size_t j) const {
+            if (i == j) {
+                return 0;
+            }
+            return m_values[index(i, j)];
+        }
+
+        void set(const size_t i, const size_t j, const S value) {
+            m_values[index(i, j)] = value;
+        }
+
+        std::vector<S> row(const size_t i) const {
+            std::vector<S> output(m_size);
+            for (size_t j = 0; j < m_size; ++j) {
+                output[j] = at(i, j);
+            }
+            return output;
+        }
+
+        const std::vector<S> & values() const {
+            return m_values;
+        }
+
+        std::vector<S> & values() {
+            return m_values;
+        }
+    };
+
+    template <typename S>
+    struct CSRMatrix {
+        // Sparse row storage: the columns of row i are
+        // indices[offsets[i]..offsets[i + 1]) sorted ascending, with matching
+        // values.
+        std::vector<size_t> offsets = {0};
+        std::vector<size_t> indices = {};
+        std::vector<S> values = {};
+
+        size_t size() const {
+            return offsets.size() - 1;
+        }
+
+        size_t nonzeros() const {
+            return indices.size();
+        }
+
+        size_t degree(const size_t i) const {
+            return offsets[i + 1] - offsets[i];
+        }
+
+        // position of (i, j) in indices/values, or nonzeros() if absent
+        size_t find(const size_t i, const size_t j) const {
+            auto begin = indices.begin() + offsets[i];
+            auto end = indices.begin() + offsets[i + 1];
+            auto it = std::lower_bound(begin, end, j);
+            if (it == end || *it != j) {
+                return nonzeros();
+            }
+            return static_cast<size_t>(std::distance(indices.begin(), it));
+        }
+    };
+
+    template <typename S>
+    struct Edge {
+        size_t i;
+        size_t j;
+        S value;
+    };
+
+    template <typename S>
+    CSRMatrix<S> edges_to_csr(const size_t n, const std::vector<std::vector<Edge<S> > > &buffers, const bool symmetric, const bool include_self) {
+        // Assemble per-thread edge buffers into a CSR matrix.  When symmetric,
+        // every (i, j) edge is also written as (j, i).  Rows are counted into
+        // one shared offsets array and the edges scattered through per-row
+        // cursors, both with atomic increments, so the extra memory is one
+        // cursor per row whatever the number of threads.  A single thread
+        // skips the atomics.
+        CSRMatrix<S> output;
+        const long int buffer_count = static_cast<long int>(buffers.size());
+        size_t edge_count = 0;
+        for (const auto &buffer: buffers) {
+            edge_count += buffer.size();
+        }
+        const bool shared = edge_count > 100000 && thread_count() > 1;
+        output.offsets.assign(n + 1, 0);
+        size_t *counts = output.offsets.data() + 1;
+        long int b = 0;
+        #pragma omp parallel for if(shared)
+        for (b = 0; b < buffer_count; ++b) {
+            for (const auto &edge: buffers[b]) {
+                if (shared) {
+                    #pragma omp atomic
+                    ++counts[edge.i];
+                } else {
+                    ++counts[edge.i];
+                }
+                if (symmetric) {
+                    if (shared) {
+                        #pragma omp atomic
+                        ++counts[edge.j];
+                    } else {
+                        ++counts[edge.j];
+                    }
+                }
+            }
+        }
+        if (include_self) {
+            for (size_t i = 0; i < n; ++i) {
+                ++counts[i];
+            }
+        }
+        std::partial_sum(output.offsets.begin(), output.offsets.end(), output.offsets.begin());
+        size_t total = output.offsets[n];
+        output.indices.resize(total);
+        output.values.resize(total);
+
+        std::vector<size_t> cursors(output.offsets.begin(), output.offsets.end() - 1);
+        if (include_self) {
+            for (size_t i = 0; i < n; ++i) {
+                output.indices[cursors[i]] = i;
+                output.values[cursors[i]] = 0;
+                ++cursors[i];
+            }
+        }
+        #pragma omp parallel for if(shared)
+        for (b = 0; b < buffer_count; ++b) {
+            for (const auto &edge: buffers[b]) {
+                size_t position;
+                if (shared) {
+                    #pragma omp atomic capture
+                    position = cursors[edge.i]++;
+                } else {
+                    position = cursors[edge.i]++;
+                }
+                output.indices[position] = edge.j;
+                output.values[position] = edge.value;
+                if (symmetric) {
+                    if (shared) {
+                        #pragma omp atomic capture
+                        position = cursors[edge.j]++;
+                    } else {
+                        position = cursors[edge.j]++;
+                    }
+                    output.indices[position] = edge.i;
+                    output.values[position] = edge.value;
+                }
+            }
+        }
+
+        // rows are filled in no particular order, sort each one by column
+        long int row_count = static_cast<long int>(n);
+        #pragma omp parallel if(total > 100000)
+        {
+            // one scratch row per thread, reused for every row it sorts
+            std::vector<std::pair<size_t, S> > row;
+            long int i = 0;
+            #pragma omp for schedule(dynamic, 256)
+            for (i = 0; i < row_count; ++i) {
+                size_t begin = output.offsets[i], end = output.offsets[i + 1];
+                bool sorted = true;
+                for (size_t k = begin + 1; k < end && sorted; ++k) {
+                    sorted = output.indices[k - 1] < output.indices[k];
+                }
+                if (sorted) {
+                    continue;
+                }
+                row.resize(end - begin);
+                for (size_t k = begin; k < end; ++k) {
+                    row[k - begin] = std::make_pair(output.indices[k], output.values[k]);
+                }
+                std::sort(row.begin(), row.end(), [](const std::pair<size_t, S> &a, const std::pair<size_t, S> &b) {
+                    return a.first < b.first;
+                });
+                for (size_t k = begin; k < end; ++k) {
+                    output.indices[k] = row[k - begin].first;
+                    output.values[k] = row[k - begin].second;
+                }
+            }
+        }
+        return output;
+    }
+
+    template <typename S, typename T, typename DistanceFunc>
+    CondensedMatrix<S> pdist(const std::vector<std::vector<T> > &data, DistanceFunc distance, size_t tile = 0) {
+        // All pairwise distances of data in condensed form.  Work is split into
+        // tile x tile blocks of the upper triangle so both blocks of points
+        // stay in cache; every (i, j) is owned by exactly one block, so the
+        // parallel writes need no synchronization.
+        const size_t n = data.size();
+        CondensedMatrix<S> output(n);
+        if (n < 2) {
+            return output;
+        }
+        if (tile == 0) {
+            tile = tile_size(data.front().size(), sizeof(T));
+        }
+        const std::vector<std::pair<size_t, size_t> > tiles = upper_tiles(n, tile);
+        const long int tile_count = static_cast<long int>(tiles.size());
+        std::vector<S> &values = output.values();
+        long int t = 0;
+        #pragma omp parallel for if(n > 2000) schedule(dynamic)
+        for (t = 0; t < tile_count; ++t) {
+            const size_t row_begin = tiles[t].first, row_end = std::min(n, row_begin + tile);
+            const size_t column_begin = tiles[t].second, column_end = std::min(n, column_begin + tile);
+            for (size_t i = row_begin; i < row_end; ++i) {
+                const std::vector<T> &point = data[i];
+                const size_t row_offset = n * i - (i * (i + 1)) / 2;
+                for (size_t j = std::max(column_begin, i + 1); j < column_end; ++j) {
+                    values[row_offset + (j - i - 1)] = static_cast<S>(distance(point, data[j]));
+                }
+            }
+        }
+        return output;
+    }
+
+    template <typename S, typename T, typename DistanceFunc>
+    std::vector<S> cdist(const std::vector<std::vector<T> > &a, const std::vector<std::vector<T> > &b, DistanceFunc distance, size_t tile = 0) {
+        // Distances between every point of a and every point of b, returned
+        // row-major as an a.size() x b.size() matrix.
+        const size_t rows = a.size(), columns = b.size();
+        std::vector<S> output(rows * columns);
+        if (rows == 0 || columns == 0) {
+            return output;
+        }
+        if (tile == 0) {
+            tile = tile_size(a.front().size(), sizeof(T));
+        }
+        const size_t row_tiles = (rows + tile - 1) / tile;
+        const size_t column_tiles = (columns + tile - 1) / tile;
+        const long int tile_count = static_cast<long int>(row_tiles * column_tiles);
+        long int t = 0;
+        #pragma omp parallel for if(rows * columns > 4000000) schedule(dynamic)
+        for (t = 0; t < tile_count; ++t) {
+            const size_t row_begin = (t / column_tiles) * tile, row_end = std::min(rows, row_begin + tile);
+            const size_t column_begin = (t % column_tiles) * tile, column_end = std::min(columns, column_begin + tile);
+            for (size_t i = row_begin; i < row_end; ++i) {
+                const std::vector<T> &point = a[i];
+                S *row = &output[i * columns];
+                for (size_t j = column_begin; j < column_end; ++j) {
+                    row[j] = static_cast<S>(distance(point, b[j]));
+                }
+            }
+        }
+        return output;
+    }
+
+    template <typename S, typename T, typename DistanceFunc>
+    CSRMatrix<S> pdist_threshold(const std::vector<std::vector<T> > &data, DistanceFunc distance, const S threshold, size_t tile = 0, const bool include_self = true) {
+        // Sparse pdist: only pairs closer than threshold (strictly) are kept,
+        // in both directions.  With include_self every row also contains the
+        // point itself at distance 0, i.e. each row is the eps-neighborhood
+        // used by DBSCAN.
+        const size_t n = data.size();
+        std::vector<std::vector<Edge<S> > > buffers(thread_count());
+        if (n > 1) {
+            if (tile == 0) {
+                tile = tile_size(data.front().size(), sizeof(T));
+            }
+            const std::vector<std::pair<size_t, size_t> > tiles = upper_tiles(n, tile);
+            const long int tile_count = static_cast<long int>(tiles.size());
+            long int t = 0;
+            #pragma omp parallel for if(n > 2000) schedule(dynamic)
+            for (t = 0; t < tile_count; ++t) {
+                std::vector<Edge<S> > &buffer = buffers[thread_id()];
+                const size_t row_begin = tiles[t].first, row_end = std::min(n, row_begin + tile);
+                const size_t column_begin = tiles[t].second, column_end = std::min(n, column_begin + tile);
+                for (size_t i = row_begin; i < row_end; ++i) {
+                    const std::vector<T> &point = data[i];
+                    for (size_t j = std::max(column_begin, i + 1); j < column_end; ++j) {
+                        S value = static_cast<S>(distance(point, data[j]));
+                        if (value < threshold) {
+                            Edge<S> edge = {i, j, value};
+                            buffer.push_back(edge);
+                        }
+                    }
+                }
+            }
+        }
+        return edges_to_csr<S>(n, buffers, true, include_self);
+    }
+
+    template <typename S>
+    CSRMatrix<S> threshold(const CondensedMatrix<S> &matrix, const S threshold, const bool include_self = true) {
+        // Sparse view of an already computed condensed matrix.
+        const size_t n = matrix.size();
+        std::vector<std::vector<Edge<S> > > buffers(1);
+        const std::vector<S> &values = matrix.values();
+        size_t k = 0;
+        for (size_t i = 0; i < n; ++i) {
+            for (size_t j = i + 1; j < n; ++j, ++k) {
+                if (values[k] < threshold) {
+                    Edge<S> edge = {i, j, values[k]};
+                    buffers[0].push_back(edge);
+                }
+            }
+        }
+        return edges_to_csr<S>(n, buffers, true, include_self);
+    }
+}
+
+#endif /* PAIRWISE_H */
@@ -0,0 +1 @@
+#include "partitioned_dbscan.hpp"
@@ -0,0 +1,391 @@
+#ifndef PARTITIONED_DBSCAN_H
+#define PARTITIONED_DBSCAN_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <unordered_map>
+#include <vector>
+#include <algorithm>
+#include "distance.hpp"
+#include "pairwise.hpp"
+#include "union_find.hpp"
+#include "kdtree/kdtree.cpp"
+#include "geo/cell_index.cpp"
+
+#if defined(__linux__)
+#include <sys/mman.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#endif
+
+namespace density {
+
+    template <typename S>
+    class SharedBuffer {
+        // Array that forked workers write and the parent reads: an anonymous
+        // shared mapping on Linux, ordinary memory elsewhere (where the
+        // partitions are clustered in-process).
+
+    private:
+        S *m_data;
+        size_t m_size;
+
+    public:
+        explicit SharedBuffer(const size_t size): m_data(nullptr), m_size(size) {
+            if (size == 0) {
+                return;
+            }
+            #if defined(__linux__)
+            void *memory = mmap(nullptr, size * sizeof(S), PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+            if (memory == MAP_FAILED) {
+                throw std::runtime_error("could not map shared memory for DBSCAN workers");
+            }
+            m_data = static_cast<S *>(memory);
+            #else
+            m_data = new S[size];
+            #endif
+        }
+
+        ~SharedBuffer() {
+            if (m_data == nullptr) {
+                return;
+            }
+            #if defined(__linux__)
+            munmap(m_data, m_size * sizeof(S));
+            #else
+            delete[] m_data;
+            #endif
+        }
+
+        SharedBuffer(const SharedBuffer &) = delete;
+        SharedBuffer & operator=(const SharedBuffer &) = delete;
+
+        S & operator[](const size_t index) {
+            return m_data[index];
+        }
+    };
+
+    template <typename T>
+    class PartitionedDBSCAN {
+        /*
+        DBSCAN sharded over worker processes.  The data is split kd-style
+        (median of the widest dimension of the largest partition) and each
+        partition is clustered together with its halo: every point closer
+        than epsilon to the bounding box of the partition.  Owned points
+        therefore see their whole neighborhood, so their core flags are
+        exact.  Workers are forked and write labels and core flags into
+        shared memory; the parent merges clusters with a union-find through
+        halo points that their owner found to be core.
+
+        Halos are found per coordinate, so the distance must be at least the
+        largest coordinate difference (any Minkowski distance).  Each worker
+        only holds its partition's neighbor graph, so peak memory follows
+        the largest partition rather than the whole data set.  Without fork
+        (non-Linux builds, or a single process) partitions run in turn.
+        */
+
+    private:
+        T m_epsilon;
+        long int m_min_points;
+        T (* m_distance)(std::vector<T>, std::vector<T>);
+        size_t m_partition_count;
+        size_t m_process_count;
+
+        std::vector<std::vector<size_t> > partition(const std::vector<std::vector<T> > &data) {
+            std::vector<std::vector<size_t> > output(1, std::vector<size_t>(data.size()));
+            std::iota(output[0].begin(), output[0].end(), 0);
+            const size_t dimensions = data.front().size();
+            while (output.size() < m_partition_count) {
+                auto largest = std::max_element(output.begin(), output.end(), [](const std::vector<size_t> &a, const std::vector<size_t> &b) {
+                    return a.size() < b.size();
+                });
+                std::vector<size_t> &indices = *largest;
+                if (indices.size() < 2) {
+                    break;
+                }
+                size_t dimension = 0;
+                T widest = -1;
+                for (size_t k = 0; k < dimensions; ++k) {
+                    T low = std::numeric_limits<T>::max(), high = std::numeric_limits<T>::lowest();
+                    for (auto it = indices.begin(); it != indices.end(); ++it) {
+                        low = std::min(low, data[*it][k]);
+                        high = std::max(high, data[*it][k]);
+                    }
+                    if (high - low > widest) {
+                        widest = high - low;
+                        dimension = k;
+                    }
+                }
+                auto middle = indices.begin() + indices.size() / 2;
+                std::nth_element(indices.begin(), middle, indices.end(), [&](const size_t a, const size_t b) {
+                    return data[a][dimension] < data[b][dimension];
+                });
+                std::vector<size_t> upper(middle, indices.end());
+                indices.erase(middle, indices.end());
+                output.push_back(upper);
+            }
+            return output;
+        }
+
+        std::vector<size_t> halo(const std::vector<std::vector<T> > &data, const std::vector<size_t> &owned, const std::vector<size_t> &owners, const size_t part) {
+            const size_t dimensions = data.front().size();
+            std::vector<T> low(dimensions, std::numeric_limits<T>::max()), high(dimensions, std::numeric_limits<T>::lowest());
+            for (auto it = owned.begin(); it != owned.end(); ++it) {
+                for (size_t k = 0; k < dimensions; ++k) {
+                    low[k] = std::min(low[k], data[*it][k]);
+                    high[k] = std::max(high[k], data[*it][k]);
+                }
+            }
+            std::vector<size_t> output;
+            for (size_t i = 0; i < data.size(); ++i) {
+                if (owners[i] == part) {
+                    continue;
+                }
+                bool inside = true;
+                for (size_t k = 0; k < dimensions && inside; ++k) {
+                    inside = data[i][k] > low[k] - m_epsilon && data[i][k] < high[k] + m_epsilon;
+                }
+                if (inside) {
+                    output.push_back(i);
+                }
+            }
+            return output;
+        }
+
+        pairwise::CSRMatrix<T> calculate_neighbors(const std::vector<std::vector<T> > &local) {
+            // eps-neighborhoods within a partition, as DBSCAN finds them
+            if (distance::is_euclidean(m_distance)) {
+                KDTree<T> tree(local);
+                return tree.template self_join<T>(m_epsilon, true, false);
+            }
+            if (distance::is_haversine(m_distance) && !local.empty() && local[0].size() == 2) {
+                const GeoCellIndex<T> index(local, m_epsilon);
+                return index.threshold_graph(m_epsilon);
+            }
+            return pairwise::pdist_threshold<T>(local, m_distance, m_epsilon);
+        }
+
+        // DBSCAN of one partition; writes a local label (-1 for noise) and a
+        // core flag per local point and returns the number of clusters
+        int cluster_partition(const std::vector<std::vector<T> > &data, const std::vector<size_t> &members, int *labels, char *core) {
+            const size_t member_count = members.size();
+            std::vector<std::vector<T> > local(member_count);
+            for (size_t i = 0; i < member_count; ++i) {
+                local[i] = data[members[i]];
+            }
+            const pairwise::CSRMatrix<T> neighbor_graph = calculate_neighbors(local);
+            UnionFind components(member_count);
+            for (size_t i = 0; i < member_count; ++i) {
+                core[i] = static_cast<long int>(neighbor_graph.degree(i)) >= m_min_points;
+            }
+            for (size_t i = 0; i < member_count; ++i) {
+                if (!core[i]) {
+                    continue;
+                }
+                for (size_t k = neighbor_graph.offsets[i]; k < neighbor_graph.offsets[i + 1]; ++k) {
+                    if (core[neighbor_graph.indices[k]]) {
+                        components.unite(i, neighbor_graph.indices[k]);
+                    }
+                }
+            }
+            std::unordered_map<size_t, int> cluster_ids;
+            for (size_t i = 0; i < member_count; ++i) {
+                labels[i] = -1;
+                size_t anchor = member_count;
+                if (core[i]) {
+                    anchor = i;
+                } else {
+                    for (size_t k = neighbor_graph.offsets[i]; k < neighbor_graph.offsets[i + 1]; ++k) {
+                        if (core[neighbor_graph.indices[k]]) {
+                            anchor = neighbor_graph.indices[k];
+                            break;
+                        }
+                    }
+                }
+                if (anchor < member_count) {
+                    auto it = cluster_ids.insert(std::make_pair(components.find(anchor), static_cast<int>(cluster_ids.size())));
+                    labels[i] = it.first->second;
+                }
+            }
+            return static_cast<int>(cluster_ids.size());
+        }
+
+        void run_partitions(const std::vector<std::vector<T> > &data, const std::vector<std::vector<size_t> > &members, const std::vector<size_t> &offsets, SharedBuffer<int> &labels, SharedBuffer<char> &core, SharedBuffer<int> &cluster_counts, const size_t worker, const size_t worker_count) {
+            for (size_t part = worker; part < members.size(); part += worker_count) {
+                cluster_counts[part] = cluster_partition(data, members[part], &labels[offsets[part]], &core[offsets[part]]);
+            }
+        }
+
+        void run_workers(const std::vector<std::vector<T> > &data, const std::vector<std::vector<size_t> > &members, const std::vector<size_t> &offsets, SharedBuffer<int> &labels, SharedBuffer<char> &core, SharedBuffer<int> &cluster_counts) {
+            const size_t worker_count = std::max<size_t>(1, std::min(m_process_count, members.size()));
+            #if defined(__linux__)
+            if (worker_count > 1) {
+                std::vector<pid_t> workers;
+                for (size_t worker = 0; worker < worker_count; ++worker) {
+                    pid_t pid = fork();
+                    if (pid == 0) {
+                        // one thread per worker; also keeps the child off the
+                        // parent's OpenMP thread pool, which fork does not copy
+                        #ifdef _OPENMP
+                        omp_set_num_threads(1);
+                        #endif
+                        // a throw must end the child, not unwind into the
+                        // caller's code as a second copy of the program
+                        try {
+                            run_partitions(data, members, offsets, labels, core, cluster_counts, worker, worker_count);
+                        } catch (...) {
+                            _exit(1);
+                        }
+                        _exit(0);
+                    }
+                    if (pid < 0) {
+                        // could not fork, cluster this share here instead
+                        run_partitions(data, members, offsets, labels, core, cluster_counts, worker, worker_count);
+                        continue;
+                    }
+                    workers.push_back(pid);
+                }
+                bool failed = false;
+                for (auto it = workers.begin(); it != workers.end(); ++it) {
+                    int status = 0;
+                    failed |= waitpid(*it, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0;
+                }
+                if (failed) {
+                    throw std::runtime_error("a DBSCAN worker process failed");
+                }
+                return;
+            }
+            #endif
+            run_partitions(data, members, offsets, labels, core, cluster_counts, 0, 1);
+        }
+
+    public:
+        PartitionedDBSCAN(const T epsilon, const long int min_points, T (* distance_func)(std::vector<T>, std::vector<T>), const size_t partition_count, const size_t process_count) {
+            assert(epsilon > 0);
+            assert(min_points > 0);
+            assert(partition_count > 0);
+            assert(process_count > 0);
+            m_epsilon = epsilon;
+            m_min_points = min_points;
+            m_distance = distance_func;
+            m_partition_count = partition_count;
+            m_process_count = process_count;
+        }
+        virtual ~PartitionedDBSCAN() {};
+
+        void setEpsilon(const T epsilon) {
+            this->m_epsilon = epsilon;
+        }
+
+        T getEpsilon() {
+            return this->m_epsilon;
+        }
+
+        void setMinPoints(const long int minPoints) {
+            this->m_min_points = minPoints;
+        }
+
+        long int getMinPoints() {
+            return this->m_min_points;
+        }
+
+        void setPartitionCount(const size_t partitionCount) {
+            this->m_partition_count = partitionCount;
+        }
+
+        size_t getPartitionCount() {
+            return this->m_partition_count;
+        }
+
+        void setProcessCount(const size_t processCount) {
+            this->m_process_count = processCount;
+        }
+
+        size_t getProcessCount() {
+            return this->m_process_count;
+        }
+
+        std::vector<int> predict(const std::vector<std::vector<T> > &data) {
+            const size_t sample_count = data.size();
+            std::vector<int> clusters(sample_count, -1);
+            if (sample_count == 0) {
+                return clusters;
+            }
+
+            // owned points first, then the halo, per partition
+            std::vector<std::vector<size_t> > members = partition(data);
+            const size_t part_count = members.size();
+            std::vector<size_t> owners(sample_count), owned_counts(part_count);
+            for (size_t part = 0; part < part_count; ++part) {
+                owned_counts[part] = members[part].size();
+                for (auto it = members[part].begin(); it != members[part].end(); ++it) {
+                    owners[*it] = part;
+                }
+            }
+            std::vector<size_t> offsets(part_count + 1, 0);
+            for (size_t part = 0; part < part_count; ++part) {
+                std::vector<size_t> border = halo(data, members[part], owners, part);
+                members[part].insert(members[part].end(), border.begin(), border.end());
+                offsets[part + 1] = offsets[part] + members[part].size();
+            }
+
+            SharedBuffer<int> labels(offsets[part_count]);
+            SharedBuffer<char> core(offsets[part_count]);
+            SharedBuffer<int> cluster_counts(part_count);
+            run_workers(data, members, offsets, labels, core, cluster_counts);
+
+            // global id of (partition, local cluster) is cluster_offsets[partition] + label
+            std::vector<size_t> cluster_offsets(part_count + 1, 0);
+            for (size_t part = 0; part < part_count; ++part) {
+                cluster_offsets[part + 1] = cluster_offsets[part] + static_cast<size_t>(cluster_counts[part]);
+            }
+            std::vector<size_t> owner_position(sample_count);
+            for (size_t part = 0; part < part_count; ++part) {
+                for (size_t i = 0; i < owned_counts[part]; ++i) {
+                    owner_position[members[part][i]] = offsets[part] + i;
+                }
+            }
+            UnionFind merged(cluster_offsets[part_count]);
+            std::vector<size_t> borders(sample_count, SIZE_MAX);
+            for (size_t part = 0; part < part_count; ++part) {
+                for (size_t i = owned_counts[part]; i < members[part].size(); ++i) {
+                    const int label = labels[offsets[part] + i];
+                    if (label < 0) {
+                        continue;
+                    }
+                    const size_t point = members[part][i], position = owner_position[point];
+                    const size_t cluster = cluster_offsets[part] + static_cast<size_t>(label);
+                    if (core[position]) {
+                        // a true core point links the clusters on both sides
+                        merged.unite(cluster, cluster_offsets[owners[point]] + static_cast<size_t>(labels[position]));
+                    } else if (labels[position] < 0) {
+                        // noise to its owner, but a border point here
+                        borders[point] = cluster;
+                    }
+                }
+            }
+
+            std::unordered_map<size_t, int> cluster_ids;
+            for (size_t point = 0; point < sample_count; ++point) {
+                const size_t position = owner_position[point];
+                size_t cluster = borders[point];
+                if (labels[position] >= 0) {
+                    cluster = cluster_offsets[owners[point]] + static_cast<size_t>(labels[position]);
+                }
+                if (cluster == SIZE_MAX) {
+                    continue;
+                }
+                auto it = cluster_ids.insert(std::make_pair(merged.find(cluster), static_cast<int>(cluster_ids.size())));
+                clusters[point] = it.first->second;
+            }
+            return clusters;
+        }
+    };
+}
+
+#endif /* PARTITIONED_DBSCAN_H */
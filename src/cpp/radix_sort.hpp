@@ -0,0 +1,72 @@
+#ifndef RADIX_SORT_H
+#define RADIX_SORT_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+namespace sorting {
+
+    // Unsigned keys that sort in the same order as the values they encode:
+    // floats flip all bits when negative and only the sign bit otherwise,
+    // signed integers flip the sign bit.
+    inline uint64_t radix_key(const double value) {
+        uint64_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits >> 63) ? ~bits : bits | (1ULL << 63);
+    }
+
+    inline uint64_t radix_key(const float value) {
+        uint32_t bits;
+        std::memcpy(&bits, &value, sizeof(bits));
+        return (bits >> 31) ? static_cast<uint32_t>(~bits) : bits | (1U << 31);
+    }
+
+    template <typename T>
+    uint64_t radix_key(const T value) {
+        static_assert(std::is_integral<T>::value, "radix keys need an integral or floating point type");
+        const uint64_t bits = static_cast<uint64_t>(static_cast<typename std::make_unsigned<T>::type>(value));
+        return std::is_signed<T>::value ? bits ^ (1ULL << (sizeof(T) * 8 - 1)) : bits;
+    }
+
+    template <typename T>
+    std::vector<size_t> radix_argsort(const std::vector<T> &data) {
+        // Stable LSD radix sort over 8-bit digits of radix_key, returning the
+        // permutation that sorts data.  Digits every key shares (such as the
+        // high bytes of timestamps from one day) are skipped.
+        const size_t sample_count = data.size();
+        std::vector<uint64_t> keys(sample_count), next_keys(sample_count);
+        std::vector<size_t> order(sample_count), next_order(sample_count);
+        for (size_t i = 0; i < sample_count; ++i) {
+            keys[i] = radix_key(data[i]);
+            order[i] = i;
+        }
+        for (size_t shift = 0; shift < sizeof(T) * 8; shift += 8) {
+            size_t counts[257] = {0};
+            for (size_t i = 0; i < sample_count; ++i) {
+                ++counts[((keys[i] >> shift) & 0xff) + 1];
+            }
+            bool shared = false;
+            for (size_t digit = 1; digit <= 256 && !shared; ++digit) {
+                shared = counts[digit] == sample_count;
+            }
+            if (shared) {
+                continue;
+            }
+            for (size_t digit = 1; digit <= 256; ++digit) {
+                counts[digit] += counts[digit - 1];
+            }
+            for (size_t i = 0; i < sample_count; ++i) {
+                const size_t position = counts[(keys[i] >> shift) & 0xff]++;
+                next_keys[position] = keys[i];
+                next_order[position] = order[i];
+            }
+            keys.swap(next_keys);
+            order.swap(next_order);
+        }
+        return order;
+    }
+}
+
+#endif /* RADIX_SORT_H */
@@ -0,0 +1,190 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <numeric>
+#include <utility>
+#include <vector>
+
+#include "rtree.hpp"
+
+template <typename T>
+RTree<T>::RTree() : m_dims(0), m_node_size(16), m_level_start(1, 0) {}
+
+template <typename T>
+RTree<T>::RTree(const std::vector<std::vector<T> > &lows, const std::vector<std::vector<T> > &highs,
+                const size_t &node_size)
+    : m_dims(0), m_node_size(node_size), m_level_start(1, 0) {
+    assert(node_size > 1);
+    assert(lows.size() == highs.size());
+    const size_t n = lows.size();
+    if (n == 0) {
+        return;
+    }
+    m_dims = lows.front().size();
+    const size_t dims = m_dims;
+    const size_t width = 2 * dims;
+
+    std::vector<T> boxes(n * width);
+    long int i = 0;
+    #pragma omp parallel for if(n > 2000)
+    for (i = 0; i < static_cast<long int>(n); i++) {
+        assert(lows[i].size() == dims && highs[i].size() == dims);
+        std::copy(lows[i].begin(), lows[i].end(), boxes.begin() + i * width);
+        std::copy(highs[i].begin(), highs[i].end(), boxes.begin() + i * width + dims);
+    }
+
+    // packs the boxes, then each level of nodes, until one node is left
+    size_t count = n;
+    for (size_t level = 0; ; level++) {
+        std::vector<double> centers(count * dims);
+        #pragma omp parallel for if(count > 2000)
+        for (i = 0; i < static_cast<long int>(count); i++) {
+            for (size_t d = 0; d < dims; d++) {
+                centers[i * dims + d] = (static_cast<double>(boxes[i * width + d]) + boxes[i * width + dims + d]) / 2;
+            }
+        }
+        std::vector<size_t> order(count);
+        std::iota(order.begin(), order.end(), 0);
+        #pragma omp parallel if(count > 2000)
+        #pragma omp single
+        pack(centers.data(), order.data(), 0, count, 0);
+
+        std::vector<T> packed(count * width);
+        for (size_t position = 0; position < count; position++) {
+            std::copy(&boxes[order[position] * width], &boxes[order[position] * width] + width, &packed[position * width]);
+        }
+        size_t offset = 0;
+        if (level == 0) {
+            m_order = order;
+            m_entries = packed;
+        } else {
+            // the nodes of the level below take their packed order
+            offset = m_level_start[level - 1];
+            const std::vector<size_t> first(m_first.begin() + offset, m_first.end());
+            const std::vector<size_t> children(m_count.begin() + offset, m_count.end());
+            for (size_t position = 0; position < count; position++) {
+                m_first[offset + position] = first[order[position]];
+                m_count[offset + position] = children[order[position]];
+            }
+            std::copy(packed.begin(), packed.end(), m_boxes.begin() + offset * width);
+        }
+
+        const size_t parents = (count + m_node_size - 1) / m_node_size;
+        boxes.assign(parents * width, 0);
+        for (size_t parent = 0; parent < parents; parent++) {
+            const size_t first = parent * m_node_size;
+            const size_t last = std::min(count, first + m_node_size);
+            T *box = &boxes[parent * width];
+            std::copy(&packed[first * width], &packed[first * width] + width, box);
+            for (size_t child = first + 1; child < last; child++) {
+                for (size_t d = 0; d < dims; d++) {
+                    box[d] = std::min(box[d], packed[child * width + d]);
+                    box[dims + d] = std::max(box[dims + d], packed[child * width + dims + d]);
+                }
+            }
+            m_first.push_back(offset + first);
+            m_count.push_back(last - first);
+        }
+        m_boxes.insert(m_boxes.end(), boxes.begin(), boxes.end());
+        m_level_start.push_back(m_first.size());
+        count = parents;
+        if (parents == 1) {
+            break;
+        }
+    }
+}
+
+template <typename T>
+void RTree<T>::pack(const double *centers, size_t *items, const size_t begin, const size_t end,
+                    const size_t dim) {
+    if (end - begin <= m_node_size) {
+        return;
+    }
+    const size_t dims = m_dims;
+    std::sort(items + begin, items + end, [centers, dims, dim](const size_t a, const size_t b) {
+        return centers[a * dims + dim] < centers[b * dims + dim];
+    });
+    if (dim + 1 == dims) {
+        return;
+    }
+    // about P^(1 / (dims - dim)) slabs of whole tiles, P the tiles in range
+    const size_t tiles = (end - begin + m_node_size - 1) / m_node_size;
+    const size_t slabs = static_cast<size_t>(std::ceil(std::pow(static_cast<double>(tiles), 1.0 / (dims - dim)) - 1e-9));
+    const size_t slab = m_node_size * ((tiles + slabs - 1) / slabs);
+    for (size_t first = begin; first < end; first += slab) {
+        const size_t last = std::min(end, first + slab);
+        #pragma omp task if(last - first > 2000)
+        pack(centers, items, first, last, dim + 1);
+    }
+}
+
+template <typename T>
+bool RTree<T>::intersects(const T *box, const T *low, const T *high) const {
+    for (size_t d = 0; d < m_dims; d++) {
+        if (box[d] > high[d] || box[m_dims + d] < low[d]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+template <typename T>
+size_t RTree<T>::size() const {
+    return m_order.size();
+}
+
+template <typename T>
+size_t RTree<T>::dimensions() const {
+    return m_dims;
+}
+
+template <typename T>
+size_t RTree<T>::height() const {
+    return m_level_start.size() - 1;
+}
+
+template <typename T>
+template <typename Visitor>
+void RTree<T>::window_visit(const std::vector<T> &low, const std::vector<T> &high, Visitor visit) const {
+    if (m_first.empty()) {
+        return;
+    }
+    assert(low.size() == m_dims && high.size() == m_dims);
+    const size_t width = 2 * m_dims;
+    const size_t leaves = m_level_start[1];
+    std::vector<size_t> stack(1, m_first.size() - 1);
+    if (!intersects(&m_boxes[stack.back() * width], low.data(), high.data())) {
+        return;
+    }
+    while (!stack.empty()) {
+        const size_t node = stack.back();
+        stack.pop_back();
+        const size_t first = m_first[node];
+        const size_t last = first + m_count[node];
+        if (node < leaves) {
+            for (size_t position = first; position < last; position++) {
+                if (intersects(&m_entries[position * width], low.data(), high.data())) {
+                    visit(m_order[position]);
+                }
+            }
+            continue;
+        }
+        for (size_t child = first; child < last; child++) {
+            if (intersects(&m_boxes[child * width], low.data(), high.data())) {
+                stack.push_back(child);
+            }
+        }
+    }
+}
+
+template <typename T>
+std::vector<size_t> RTree<T>::window(const std::vector<T> &low, const std::vector<T> &high) const {
+    std::vector<size_t> output;
+    window_visit(low, high, [&output](const size_t index) {
+        output.push_back(index);
+    });
+    return output;
+}
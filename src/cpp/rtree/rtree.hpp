@@ -0,0 +1,58 @@
+#pragma once
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+// Static R-tree over axis-aligned boxes, bulk-loaded by Sort-Tile-Recursive
+// packing: the boxes are sorted by the center of their first dimension and
+// cut into slabs, each slab is sorted and cut on the next dimension, and so
+// on, so that every run of node_size boxes in the final order is a compact
+// tile and becomes one leaf.  Each level above packs the boxes of the level
+// below the same way.  Nodes are full but for the last of a level, and are
+// stored level by level with the range of their children, root last.
+//
+// Original paper: STR: A Simple and Efficient Algorithm for R-Tree Packing
+// (Leutenegger, Lopez, Edgington 1997)
+template <typename T>
+class RTree {
+    size_t m_dims;
+    size_t m_node_size;
+    // box of every node as dims lows then dims highs
+    std::vector<T> m_boxes;
+    // first child and child count of every node; children of leaves are
+    // positions in m_order
+    std::vector<size_t> m_first;
+    std::vector<size_t> m_count;
+    // nodes [m_level_start[l], m_level_start[l + 1]) make level l, leaves 0
+    std::vector<size_t> m_level_start;
+    // input index of the box at every position
+    std::vector<size_t> m_order;
+    std::vector<T> m_entries;
+
+    // orders items [begin, end) of centers (dims values each) into tiles of
+    // node_size, from dimension dim on; by value, as slabs are packed in
+    // tasks that outlive the caller's frame
+    void pack(const double *centers, size_t *items, const size_t begin, const size_t end,
+              const size_t dim);
+
+    bool intersects(const T *box, const T *low, const T *high) const;
+
+   public:
+    RTree();
+    // box i spans lows[i] to highs[i], corners of the same dimension
+    RTree(const std::vector<std::vector<T> > &lows, const std::vector<std::vector<T> > &highs,
+          const size_t &node_size = 16);
+
+    size_t size() const;
+    size_t dimensions() const;
+    // levels above the boxes, 0 if empty
+    size_t height() const;
+
+    // Calls visit(index) for every box meeting the closed window from low
+    // to high.
+    template <typename Visitor>
+    void window_visit(const std::vector<T> &low, const std::vector<T> &high, Visitor visit) const;
+
+    std::vector<size_t> window(const std::vector<T> &low, const std::vector<T> &high) const;
+};
@@ -5,6 +5,11 @@
 #include "binary.hpp"
 #include "kmeans.cpp"
 #include "fuzzy_pack.cpp"
+#include "hdbscan.cpp"
+#include "optics.cpp"
+#include "partitioned_dbscan.cpp"
+#include "kdtree/dynamic_kdtree.cpp"
+#include "nndescent/nndescent.cpp"
 
 template <class T, class T2>
 void print_map(std::map<T, T2> &data) {
@@ -24,7 +29,52 @@ void print_vector(std::vector<T> &data) {
     std::cout << "]\n";
 }
 
+// points scattered around a few centers, the same on every run
+std::vector<std::vector<double> > clumped_points(const size_t count, const size_t dims, const unsigned int seed) {
+    std::mt19937 generator(seed);
+    std::uniform_real_distribution<double> offset(-1.0, 1.0);
+    std::vector<std::vector<double> > output(count, std::vector<double>(dims));
+    for (size_t i = 0; i < count; ++i) {
+        const double center = 4.0 * static_cast<double>(generator() % 5);
+        for (size_t j = 0; j < dims; ++j) {
+            output[i][j] = center + offset(generator) * (1.0 + j);
+        }
+    }
+    return output;
+}
+
+// Points where labels disagree with the reference DBSCAN labels: noise
+// must match, core points must fall in the same clusters up to renaming,
+// and a border point must share the cluster of one of its core neighbors.
+size_t clustering_mismatches(const std::vector<int> &labels, const std::vector<int> &reference, const pairwise::CSRMatrix<double> &neighbor_graph, const long int min_points) {
+    std::map<int, int> forward, backward;
+    size_t mismatches = 0;
+    for (size_t i = 0; i < labels.size(); ++i) {
+        if ((labels[i] == -1) != (reference[i] == -1)) {
+            ++mismatches;
+        } else if (static_cast<long int>(neighbor_graph.degree(i)) >= min_points) {
+            const int expected = forward.emplace(labels[i], reference[i]).first->second;
+            const int expected_back = backward.emplace(reference[i], labels[i]).first->second;
+            mismatches += expected != reference[i] || expected_back != labels[i];
+        }
+    }
+    for (size_t i = 0; i < labels.size(); ++i) {
+        if (labels[i] == -1 || static_cast<long int>(neighbor_graph.degree(i)) >= min_points) {
+            continue;
+        }
+        bool found = false;
+        for (size_t k = neighbor_graph.offsets[i]; k < neighbor_graph.offsets[i + 1] && !found; ++k) {
+            const size_t j = neighbor_graph.indices[k];
+            found = static_cast<long int>(neighbor_graph.degree(j)) >= min_points && labels[j] == labels[i];
+        }
+        mismatches += !found;
+    }
+    return mismatches;
+}
+
 int main() {
+    // brute-force checks; any failure makes the test exit non-zero
+    size_t failures = 0;
     std::vector<std::vector<double> > data = {{931.0}, {931.0}, {932.0}, {932.0}, {932.0}, {932.0}, {932.0}, {932.0}, {933.0}, {933.0}, {933.0}, {933.0}, {933.0}, {933.0}, {933.0}, {933.0}, {933.0}, {934.0}, {934.0}, {934.0}, {934.0}, {934.0}, {934.0}, {934.0}, {934.0}, {934.0}, {934.0}, {935.0}, {935.0}, {935.0}, {935.0}, {935.0}, {936.0}, {936.0}, {936.0}, {936.0}, {936.0}, {936.0}, {937.0}, {938.0}, {938.0}, {938.0}, {938.0}, {938.0}, {939.0}, {939.0}, {939.0}, {939.0}, {939.0}, {940.0}, {940.0}, {940.0}, {940.0}, {941.0}, {941.0}, {941.0}, {942.0}, {942.0}, {942.0}, {943.0}, {944.0}, {944.0}, {945.0}, {945.0}, {945.0}, {945.0}, {946.0}, {946.0}, {947.0}, {947.0}, {947.0}, {948.0}, {948.0}, {948.0}, {949.0}, {949.0}, {949.0}, {949.0}, {949.0}, {950.0}, {950.0}, {950.0}, {950.0}, {951.0}, {951.0}, {952.0}, {953.0}, {953.0}, {955.0}, {955.0}, {965.0}, {966.0}, {966.0}, {966.0}, {966.0}, {967.0}, {968.0}, {968.0}, {968.0}, {968.0}, {969.0}, {969.0}, {970.0}, {970.0}, {970.0}, {971.0}, {971.0}, {972.0}, {972.0}, {972.0}, {973.0}, {973.0}, {974.0}, {980.0}, {980.0}, {981.0}, {981.0}, {981.0}, {982.0}, {983.0}, {983.0}, {983.0}, {983.0}, {984.0}, {984.0}, {994.0}, {994.0}, {996.0}, {1002.0}, {1007.0}, {1007.0}, {1007.0}, {1007.0}, {1008.0}, {1009.0}, {1009.0}, {1010.0}, {1028.0}, {1030.0}, {1061.0}, {1078.0}};
     std::vector<std::vector<double> > other_data = {{7344.2}, {7380.0}, {7392.0}, {7451.0}, {7466.0}, {7478.0}, {7493.0}, {7499.0}, {7499.6}, {7510.0}, {7543.0}, {7563.0}, {7569.0}, {7569.0}, {7580.0}, {7591.0}, {7609.0}, {7620.0}, {7623.0}, {7631.0}, {7638.0}, {7645.0}, {7663.7}, {7665.0}, {7667.0}, {7686.0}, {7691.0}, {7701.0}, {7701.0}, {7702.0}, {7735.0}, {7750.0}, {7755.0}, {7760.0}, {7777.0}, {7790.7}, {7796.0}, {7797.0}, {7805.0}, {7809.0}, {7811.0}, {7814.0}, {7819.0}, {7820.0}, {7821.0}, {7828.0}, {7833.3}, {7849.0}, {7853.0}, {7853.0}, {7862.0}, {7874.0}, {7877.0}, {7878.0}, {7880.0}, {7886.0}, {7891.0}, {7894.0}, {7896.0}, {7897.0}, {7899.0}, {7900.0}, {7904.0}, {7929.0}, {7945.0}, {7953.0}, {7958.0}, {7961.0}, {7963.0}, {7964.0}, {7970.0}, {7978.0}, {7998.0}, {7998.0}, {7999.0}, {8021.0}, {8021.0}, {8025.0}, {8033.0}, {8056.0}, {8062.0}, {8063.0}, {8070.0}, {8074.0}, {8110.0}, {8113.0}, {8118.0}, {8119.0}, {8125.0}, {8137.0}, {8151.0}, {8151.0}, {8152.0}, {8169.0}, {8192.0}, {8214.0}, {8237.0}, {8249.0}, {8268.0}, {8275.0}, {8278.0}, {8284.0}, {8285.0}, {8303.0}, {8304.0}, {8308.0}, {8322.0}, {8345.0}, {8352.0}, {8361.0}, {8365.0}, {8370.0}, {8380.0}, {8383.0}, {8394.0}, {8416.0}, {8445.0}, {8454.0}, {8457.0}, {8490.0}, {8506.0}, {8512.0}, {8520.0}, {8533.0}, {8540.0}, {8545.0}, {8563.0}, {8569.0}, {8590.0}, {8611.0}, {8810.0}, {8834.0}, {8850.0}, {8858.0}, {8882.0}, {8895.0}, {8896.0}, {8904.0}, {9148.0}, {9347.0}, {9419.0}};
     std::vector<double> single_data = {7344.0, 7380.0, 7392.0, 7451.0, 7466.0, 7478.0, 7493.0, 7499.0, 7499.0, 7510.0, 7543.0, 7563.0, 7569.0, 7569.0, 7580.0, 7591.0, 7609.0, 7620.0, 7623.0, 7631.0, 7638.0, 7645.0, 7663.0, 7665.0, 7667.0, 7686.0, 7691.0, 7701.0, 7701.0, 7702.0, 7735.0, 7750.0, 7755.0, 7760.0, 7777.0, 7790.0, 7796.0, 7797.0, 7805.0, 7809.0, 7811.0, 7814.0, 7819.0, 7820.0, 7821.0, 7828.0, 7833.0, 7849.0, 7853.0, 7853.0, 7862.0, 7874.0, 7877.0, 7878.0, 7880.0, 7886.0, 7891.0, 7894.0, 7896.0, 7897.0, 7899.0, 7900.0, 7904.0, 7929.0, 7945.0, 7953.0, 7958.0, 7961.0, 7963.0, 7964.0, 7970.0, 7978.0, 7998.0, 7998.0, 7999.0, 8021.0, 8021.0, 8025.0, 8033.0, 8056.0, 8062.0, 8063.0, 8070.0, 8074.0, 8110.0, 8113.0, 8118.0, 8119.0, 8125.0, 8137.0, 8151.0, 8151.0, 8152.0, 8169.0, 8192.0, 8214.0, 8237.0, 8249.0, 8268.0, 8275.0, 8278.0, 8284.0, 8285.0, 8303.0, 8304.0, 8308.0, 8322.0, 8345.0, 8352.0, 8361.0, 8365.0, 8370.0, 8380.0, 8383.0, 8394.0, 8416.0, 8445.0, 8454.0, 8457.0, 8490.0, 8506.0, 8512.0, 8520.0, 8533.0, 8540.0, 8545.0, 8563.0, 8569.0, 8590.0, 8611.0, 8810.0, 8834.0, 8850.0, 8858.0, 8882.0, 8895.0, 8896.0, 8904.0, 9148.0, 9347.0, 9419.0};
@@ -230,6 +280,22 @@ int main() {
         std::cout << "Start: " << start_times[i] << ", End: " << end_times[i] << "\n";
     }
 
+    std::cout << "\nTrajectory R-tree\n";
+    density::moving::TrajectoryIndex<double> trajectory_index = density::moving::TrajectoryIndex<double>(sequential_data);
+    std::vector<size_t> passing = trajectory_index.window({1860.0}, {1880.0}, 1.0, 2.0);
+    std::cout << "Passing 1860-1880 during 1-2: ";
+    print_vector<size_t>(passing);
+    std::vector<size_t> slice = trajectory_index.time_slice(5.0, {5595.0}, {5600.0});
+    std::cout << "At 5595-5600 at time 5: ";
+    print_vector<size_t>(slice);
+    convoy_clf.setRegion({0.0}, {5600.0});
+    std::tie(convoy_indices, start_times, end_times) = convoy_clf.predict(sequential_data, trajectory_index);
+    std::cout << "Convoys below 5600: " << convoy_indices.size() << "\n";
+    for (size_t i = 0; i < start_times.size(); ++i) {
+        print_vector<size_t>(convoy_indices[i]);
+        std::cout << "Start: " << start_times[i] << ", End: " << end_times[i] << "\n";
+    }
+
     long int kmeans_k = 5;
     long int max_iterations = 100;
     double tolerance = 1;
@@ -262,5 +328,289 @@ int main() {
         std::cout << '\n';
     }
 
+    density::fuzzy::CoreDBPack<double, long int> core_pack_clf = density::fuzzy::CoreDBPack<double, long int>(5.0, 2, 5);
+    std::vector<std::map<long int, double> > core_pack_clusters = core_pack_clf.predict(single_data);
+    for (auto i = core_pack_clusters.begin(); i != core_pack_clusters.end(); ++i) {
+        size_t index = std::distance(core_pack_clusters.begin(), i);
+        std::cout << "Core DBPack Index: " << index << ", Point: " << single_data.at(index) << "    ";
+        print_map(*i);
+        std::cout << '\n';
+    }
+
+    density::fuzzy::Memberships<float, int> core_pack_memberships = core_pack_clf.predict_csr(single_data);
+    std::cout << "Core DBPack CSR: " << core_pack_memberships.size() << " points, " << core_pack_memberships.nonzeros() << " memberships\n";
+    print_vector<size_t>(core_pack_memberships.offsets);
+    print_vector<int>(core_pack_memberships.clusters);
+    print_vector<float>(core_pack_memberships.values);
+
+    density::fuzzy::DBPack<double, long int> fuzzy_pack_clf = density::fuzzy::DBPack<double, long int>(5.0, 12.0, 2, 5);
+    std::vector<std::map<long int, double> > fuzzy_pack_clusters = fuzzy_pack_clf.predict(single_data);
+    for (auto i = fuzzy_pack_clusters.begin(); i != fuzzy_pack_clusters.end(); ++i) {
+        size_t index = std::distance(fuzzy_pack_clusters.begin(), i);
+        std::cout << "Fuzzy DBPack Index: " << index << ", Point: " << single_data.at(index) << "    ";
+        print_map(*i);
+        std::cout << '\n';
+    }
+
+    density::HDBSCAN<double> hdbscan_clf = density::HDBSCAN<double>(3, 5);
+    std::vector<int> hdbscan_clusters = hdbscan_clf.predict(data);
+    for (size_t i = 0; i < hdbscan_clusters.size(); ++i) {
+        std::cout << "HDBSCAN: Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << hdbscan_clusters.at(i) << std::endl;
+    }
+
+    density::OPTICS<double> optics_clf = density::OPTICS<double>(epsilon, min_points);
+    optics_clf.fit(data);
+    for (double optics_epsilon = epsilon / 2; optics_epsilon <= epsilon; optics_epsilon += epsilon / 2) {
+        std::vector<int> optics_clusters = optics_clf.extract_dbscan(optics_epsilon);
+        for (size_t i = 0; i < optics_clusters.size(); ++i) {
+            std::cout << "OPTICS (epsilon " << optics_epsilon << "): Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << optics_clusters.at(i) << std::endl;
+        }
+    }
+
+    density::IncrementalDBSCAN<double> incremental_clf = density::IncrementalDBSCAN<double>(epsilon, min_points, distance::euclidean<double>);
+    for (auto it = data.begin(); it != data.end(); ++it) {
+        incremental_clf.insert(*it);
+    }
+    incremental_clf.remove(0);
+    std::vector<int> incremental_clusters = incremental_clf.labels();
+    for (size_t i = 0; i < incremental_clusters.size(); ++i) {
+        std::cout << "Incremental DBSCAN: Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << incremental_clusters.at(i) << std::endl;
+    }
+
+    // random insertions and deletions, checked against DBSCAN over the
+    // points left after every step
+    {
+        const std::vector<std::vector<double> > points = clumped_points(300, 2, 29);
+        density::IncrementalDBSCAN<double> checked_clf = density::IncrementalDBSCAN<double>(0.6, 4, distance::euclidean<double>);
+        density::DBSCAN<double> reference_clf = density::DBSCAN<double>(0.6, 4, distance::euclidean<double>);
+        std::mt19937 generator(7);
+        // point held by every id, SIZE_MAX once removed
+        std::vector<size_t> held;
+        size_t next = 0, mismatches = 0;
+        for (size_t step = 0; step < 400; ++step) {
+            const size_t live = held.size() - std::count(held.begin(), held.end(), SIZE_MAX);
+            if (next < points.size() && (live < 20 || generator() % 3 != 0)) {
+                const size_t id = checked_clf.insert(points[next]);
+                held.resize(std::max(held.size(), id + 1), SIZE_MAX);
+                held[id] = next++;
+            } else if (live > 0) {
+                size_t id = generator() % held.size();
+                while (held[id] == SIZE_MAX) {
+                    id = (id + 1) % held.size();
+                }
+                checked_clf.remove(id);
+                held[id] = SIZE_MAX;
+            }
+            std::vector<std::vector<double> > left;
+            std::vector<int> labels;
+            const std::vector<int> all_labels = checked_clf.labels();
+            for (size_t id = 0; id < held.size(); ++id) {
+                if (held[id] != SIZE_MAX) {
+                    left.push_back(points[held[id]]);
+                    labels.push_back(all_labels[id]);
+                }
+            }
+            const pairwise::CSRMatrix<double> neighbor_graph = pairwise::pdist_threshold<double>(left, distance::euclidean<double>, 0.6);
+            mismatches += clustering_mismatches(labels, reference_clf.predict(left), neighbor_graph, 4);
+        }
+        std::cout << "Incremental DBSCAN vs DBSCAN: " << mismatches << " mismatches" << std::endl;
+        failures += mismatches;
+    }
+
+    density::SampledDBSCAN<double> sampled_clf = density::SampledDBSCAN<double>(epsilon, min_points, data.size() / 4, distance::euclidean<double>, density::CoreSampling::K_CENTER);
+    std::vector<int> sampled_clusters = sampled_clf.predict(data);
+    for (size_t i = 0; i < sampled_clusters.size(); ++i) {
+        std::cout << "DBSCAN++: Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << sampled_clusters.at(i) << std::endl;
+    }
+
+    density::TIDBSCAN<double> ti_clf = density::TIDBSCAN<double>(0.003, min_points, distance::canberra<double>);
+    std::vector<int> ti_clusters = ti_clf.predict(data);
+    for (size_t i = 0; i < ti_clusters.size(); ++i) {
+        std::cout << "TI-DBSCAN (canberra): Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << ti_clusters.at(i) << std::endl;
+    }
+
+    density::VPTreeDBSCAN<double> vp_clf = density::VPTreeDBSCAN<double>(0.003, min_points, distance::canberra<double>);
+    std::vector<int> vp_clusters = vp_clf.predict(data);
+    for (size_t i = 0; i < vp_clusters.size(); ++i) {
+        std::cout << "VP-tree DBSCAN (canberra): Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << vp_clusters.at(i) << std::endl;
+    }
+
+    // (latitude, longitude) fixes on both sides of the antimeridian, eps in kilometers
+    std::vector<std::vector<double> > gps_data = {
+        {-16.50, 179.99}, {-16.51, -179.99}, {-16.50, -179.98}, {-16.52, 179.98},
+        {40.7128, -74.0060}, {40.7130, -74.0050}, {40.7120, -74.0070}, {51.5074, -0.1278}
+    };
+    density::DBSCAN<double> gps_clf = density::DBSCAN<double>(5.0, 3, distance::haversine<double>);
+    std::vector<int> gps_clusters = gps_clf.predict(gps_data);
+    for (size_t i = 0; i < gps_clusters.size(); ++i) {
+        std::cout << "GPS DBSCAN (haversine): Row #" << i << " - " << gps_data.at(i).at(0) << ", " << gps_data.at(i).at(1) << " : Cluster #" << gps_clusters.at(i) << std::endl;
+    }
+
+    density::HNSWDBSCAN<double> hnsw_clf = density::HNSWDBSCAN<double>(epsilon, min_points, distance::euclidean<double>);
+    std::vector<int> hnsw_clusters = hnsw_clf.predict(data);
+    for (size_t i = 0; i < hnsw_clusters.size(); ++i) {
+        std::cout << "HNSW DBSCAN: Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << hnsw_clusters.at(i) << std::endl;
+    }
+
+    density::PartitionedDBSCAN<double> partitioned_clf = density::PartitionedDBSCAN<double>(epsilon, min_points, distance::euclidean<double>, 4, 2);
+    std::vector<int> partitioned_clusters = partitioned_clf.predict(data);
+    for (size_t i = 0; i < partitioned_clusters.size(); ++i) {
+        std::cout << "Partitioned DBSCAN: Row #" << i << " - " << data.at(i).at(0) << " : Cluster #" << partitioned_clusters.at(i) << std::endl;
+    }
+
+    // partitions cut through the clusters, checked against DBSCAN
+    {
+        const std::vector<std::vector<double> > points = clumped_points(3000, 3, 32);
+        density::PartitionedDBSCAN<double> checked_clf = density::PartitionedDBSCAN<double>(0.5, 5, distance::euclidean<double>, 8, 3);
+        density::DBSCAN<double> reference_clf = density::DBSCAN<double>(0.5, 5, distance::euclidean<double>);
+        const pairwise::CSRMatrix<double> neighbor_graph = pairwise::pdist_threshold<double>(points, distance::euclidean<double>, 0.5);
+        const size_t mismatches = clustering_mismatches(checked_clf.predict(points), reference_clf.predict(points), neighbor_graph, 5);
+        std::cout << "Partitioned DBSCAN vs DBSCAN: " << mismatches << " mismatches" << std::endl;
+        failures += mismatches;
+    }
+
+    density::DBSCAN<double> fitted_clf = density::DBSCAN<double>(epsilon, min_points, distance::euclidean<double>);
+    fitted_clf.fit(data);
+    std::vector<std::vector<double> > new_data = {data.front(), data.back(), {0.0, 0.0}};
+    std::vector<int> assigned_clusters = fitted_clf.assign(new_data);
+    for (size_t i = 0; i < assigned_clusters.size(); ++i) {
+        std::cout << "DBSCAN assign: Point #" << i << " - " << new_data.at(i).at(0) << " : Cluster #" << assigned_clusters.at(i) << std::endl;
+    }
+
+    // assign against the label of the nearest core point within epsilon,
+    // with the KD-tree (euclidean) and the pivot window (canberra)
+    {
+        const std::vector<std::vector<double> > points = clumped_points(1500, 3, 33);
+        const std::vector<std::vector<double> > queries = clumped_points(500, 3, 330);
+        double (* functions[2])(std::vector<double>, std::vector<double>) = {distance::euclidean<double>, distance::canberra<double>};
+        const double epsilons[2] = {0.5, 0.08};
+        size_t mismatches = 0;
+        for (size_t f = 0; f < 2; ++f) {
+            density::DBSCAN<double> checked_clf = density::DBSCAN<double>(epsilons[f], 5, functions[f]);
+            checked_clf.fit(points);
+            const std::vector<int> &labels = checked_clf.getLabels();
+            const pairwise::CSRMatrix<double> neighbor_graph = pairwise::pdist_threshold<double>(points, functions[f], epsilons[f]);
+            const std::vector<int> assigned = checked_clf.assign(queries);
+            for (size_t q = 0; q < queries.size(); ++q) {
+                double closest = epsilons[f];
+                int expected = -1;
+                for (size_t i = 0; i < points.size(); ++i) {
+                    const double value = functions[f](queries[q], points[i]);
+                    if (static_cast<long int>(neighbor_graph.degree(i)) >= 5 && value < closest) {
+                        closest = value;
+                        expected = labels[i];
+                    }
+                }
+                mismatches += assigned[q] != expected;
+            }
+        }
+        std::cout << "DBSCAN assign vs nearest core: " << mismatches << " mismatches" << std::endl;
+        failures += mismatches;
+    }
+
+    std::vector<double> unsorted_data(single_data.rbegin(), single_data.rend());
+    std::vector<int> unsorted_clusters = dbpack.predict_unsorted(unsorted_data);
+    for (size_t i = 0; i < unsorted_clusters.size(); ++i) {
+        std::cout << "Unsorted DBPack: Row #" << i << " - " << unsorted_data.at(i) << " : Cluster #" << unsorted_clusters.at(i) << std::endl;
+    }
+
+    density::StreamingDBPack<double> streaming_dbpack = density::StreamingDBPack<double>(5.0, 3);
+    for (size_t i = 0; i < single_data.size(); ++i) {
+        streaming_dbpack.push(single_data.at(i));
+        while (streaming_dbpack.has_finished()) {
+            density::StreamingDBPack<double>::Cluster cluster = streaming_dbpack.pop_finished();
+            std::cout << "Streaming DBPack: after Row #" << i << " - Cluster #" << cluster.id << " : " << cluster.start << " to " << cluster.end << " (" << cluster.count << " points)" << std::endl;
+        }
+    }
+    streaming_dbpack.flush();
+    while (streaming_dbpack.has_finished()) {
+        density::StreamingDBPack<double>::Cluster cluster = streaming_dbpack.pop_finished();
+        std::cout << "Streaming DBPack: flushed - Cluster #" << cluster.id << " : " << cluster.start << " to " << cluster.end << " (" << cluster.count << " points)" << std::endl;
+    }
+
+    // the dual-tree self-join and the strict count_within against the tiled
+    // brute-force threshold graph
+    {
+        const std::vector<std::vector<double> > points = clumped_points(2000, 3, 43);
+        KDTree<double> tree = KDTree<double>(points, 8);
+        size_t mismatches = 0;
+        for (double radius = 0.25; radius <= 1.0; radius *= 2) {
+            const pairwise::CSRMatrix<double> expected = pairwise::pdist_threshold<double>(points, distance::euclidean<double>, radius);
+            const pairwise::CSRMatrix<double> joined = tree.self_join<double>(radius);
+            mismatches += joined.offsets != expected.offsets || joined.indices != expected.indices;
+            for (size_t k = 0; k < expected.nonzeros() && k < joined.nonzeros(); ++k) {
+                mismatches += std::fabs(joined.values[k] - expected.values[k]) > 1e-9;
+            }
+            const pairwise::CSRMatrix<double> adjacency = tree.self_join<double>(radius, false, false);
+            const pairwise::CSRMatrix<double> expected_adjacency = pairwise::pdist_threshold<double>(points, distance::euclidean<double>, radius, 0, false);
+            mismatches += adjacency.offsets != expected_adjacency.offsets || adjacency.indices != expected_adjacency.indices;
+            for (size_t i = 0; i < points.size(); ++i) {
+                mismatches += tree.count_within(points[i], radius, SIZE_MAX, true) != expected.degree(i);
+                mismatches += tree.count_within(points[i], radius, 3, true) != std::min<size_t>(3, expected.degree(i));
+            }
+        }
+        std::cout << "KD-tree self_join vs pdist_threshold: " << mismatches << " mismatches" << std::endl;
+        failures += mismatches;
+    }
+
+    DynamicKDTree<double> dynamic_tree = DynamicKDTree<double>(4);
+    std::vector<size_t> dynamic_ids;
+    for (size_t i = 0; i < data.size(); ++i) {
+        dynamic_ids.push_back(dynamic_tree.insert(data.at(i)));
+    }
+    for (size_t i = 0; i < dynamic_ids.size(); i += 2) {
+        dynamic_tree.remove(dynamic_ids.at(i));
+    }
+    std::vector<std::pair<double, size_t> > dynamic_nearest = dynamic_tree.nearest_k(data.front(), 3);
+    for (size_t i = 0; i < dynamic_nearest.size(); ++i) {
+        std::cout << "Dynamic KD-tree: Neighbor #" << i << " - Point #" << dynamic_nearest.at(i).second << " : " << dynamic_nearest.at(i).first << std::endl;
+    }
+
+    NNDescent<double> knn_graph = NNDescent<double>(data, 3);
+    for (size_t i = 0; i < knn_graph.size(); ++i) {
+        std::cout << "NN-Descent: Row #" << i << " - " << data.at(i).at(0) << " : Neighbors";
+        for (size_t j = 0; j < knn_graph.neighbors(); ++j) {
+            std::cout << " #" << knn_graph.indices().at(i * knn_graph.neighbors() + j);
+        }
+        std::cout << std::endl;
+    }
+    std::vector<int> knn_labels = db_clf.predict_graph(knn_graph.threshold_graph<double>(epsilon));
+    std::cout << "NN-Descent DBSCAN: ";
+    print_vector<int>(knn_labels);
+    std::vector<int> knn_hdbscan_labels = hdbscan_clf.predict_graph(knn_graph.indices(), knn_graph.distances(), knn_graph.neighbors());
+    std::cout << "NN-Descent HDBSCAN: ";
+    print_vector<int>(knn_hdbscan_labels);
+
+    {
+        // over the complete graph the spanning tree is the exact one, so
+        // the single-linkage merge heights must add up to the same weight
+        const std::vector<std::vector<double> > points = clumped_points(400, 2, 13);
+        KDTree<double> tree(points);
+        std::vector<size_t> graph_indices;
+        std::vector<double> graph_distances;
+        tree.all_nearest_k(points.size() - 1, graph_indices, graph_distances);
+        density::HDBSCAN<double> tree_clf = density::HDBSCAN<double>(5, 10);
+        density::HDBSCAN<double> graph_clf = density::HDBSCAN<double>(5, 10);
+        tree_clf.predict(points);
+        graph_clf.predict_graph(graph_indices, graph_distances, points.size() - 1);
+        double tree_weight = 0.0, graph_weight = 0.0;
+        for (const density::LinkageNode &merge: tree_clf.getSingleLinkageTree()) {
+            tree_weight += merge.distance;
+        }
+        for (const density::LinkageNode &merge: graph_clf.getSingleLinkageTree()) {
+            graph_weight += merge.distance;
+        }
+        size_t mismatches = std::fabs(tree_weight - graph_weight) > 1e-9 * tree_weight;
+        for (size_t i = 0; i < points.size(); ++i) {
+            mismatches += std::fabs(tree_clf.getCoreDistances()[i] - graph_clf.getCoreDistances()[i]) > 1e-12;
+        }
+        std::cout << "HDBSCAN graph vs points: " << mismatches << " mismatches" << std::endl;
+        failures += mismatches;
+    }
+
+    if (failures > 0) {
+        std::cout << failures << " brute-force mismatches" << std::endl;
+        return 1;
+    }
     return 0;
 }
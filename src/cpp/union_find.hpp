@@ -0,0 +1,63 @@
+#ifndef UNION_FIND_H
+#define UNION_FIND_H
+
+#include <vector>
+#include <numeric>
+#include <utility>
+
+namespace density {
+
+    class UnionFind {
+        // Disjoint sets over 0..n-1 with union by size and path halving.
+
+    private:
+        std::vector<size_t> m_parent;
+        std::vector<size_t> m_size;
+
+    public:
+        UnionFind() {};
+        explicit UnionFind(const size_t size): m_parent(size), m_size(size, 1) {
+            std::iota(m_parent.begin(), m_parent.end(), 0);
+        }
+
+        size_t size() const {
+            return m_parent.size();
+        }
+
+        size_t add() {
+            size_t index = m_parent.size();
+            m_parent.push_back(index);
+            m_size.push_back(1);
+            return index;
+        }
+
+        size_t find(size_t index) {
+            while (m_parent[index] != index) {
+                m_parent[index] = m_parent[m_parent[index]];
+                index = m_parent[index];
+            }
+            return index;
+        }
+
+        // root of the merged set
+        size_t unite(size_t a, size_t b) {
+            a = find(a);
+            b = find(b);
+            if (a == b) {
+                return a;
+            }
+            if (m_size[a] < m_size[b]) {
+                std::swap(a, b);
+            }
+            m_parent[b] = a;
+            m_size[a] += m_size[b];
+            return a;
+        }
+
+        size_t set_size(const size_t index) {
+            return m_size[find(index)];
+        }
+    };
+}
+
+#endif /* UNION_FIND_H */
@@ -0,0 +1,380 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "vptree.hpp"
+
+template <typename T, typename Distance>
+void VPTree<T, Distance>::make_tree(
+    std::pair<double, size_t> *work,
+    const std::vector<T> *point_array,
+    const size_t node,
+    const size_t begin,
+    const size_t end,
+    const size_t level
+) {
+    if (level == m_levels || begin == end) {
+        return;
+    }
+
+    // the vantage is the point farthest from an arbitrary one, which tends
+    // to sit on the edge of the range and spread the distances out; large
+    // ranges are sampled at about a thousand evenly strided rows
+    const size_t dims = m_dims;
+    const size_t stride = std::max<size_t>(1, (end - begin) / 1024);
+    const T *first = point_array[work[begin].second].data();
+    size_t vantage = begin;
+    double farthest = -1;
+    for (size_t i = begin; i < end; i += stride) {
+        double d = m_distance(first, point_array[work[i].second].data(), dims);
+        if (d > farthest) {
+            farthest = d;
+            vantage = i;
+        }
+    }
+    std::swap(work[begin], work[vantage]);
+    const T *pt = point_array[work[begin].second].data();
+    for (size_t i = begin + 1; i < end; i++) {
+        work[i].first = m_distance(pt, point_array[work[i].second].data(), dims);
+    }
+
+    const size_t middle = begin + 1 + (end - begin - 1) / 2;
+    if (middle < end) {
+        std::nth_element(work + begin + 1, work + middle, work + end);
+    }
+    double *bounds = &m_owned_bounds[4 * node];
+    bounds[0] = bounds[2] = std::numeric_limits<double>::infinity();
+    bounds[1] = bounds[3] = -std::numeric_limits<double>::infinity();
+    for (size_t i = begin + 1; i < end; i++) {
+        const size_t half = i < middle ? 0 : 2;
+        bounds[half] = std::min(bounds[half], work[i].first);
+        bounds[half + 1] = std::max(bounds[half + 1], work[i].first);
+    }
+
+    // subtrees cover disjoint ranges, so they are built as independent tasks
+    #pragma omp task if(end - begin > 2000)
+    make_tree(work, point_array, 2 * node + 1, begin + 1, middle, level + 1);
+    #pragma omp task if(end - begin > 2000)
+    make_tree(work, point_array, 2 * node + 2, middle, end, level + 1);
+}
+
+template <typename T, typename Distance>
+const T *VPTree<T, Distance>::point(const size_t &position) const {
+    return m_points.data() + position * m_dims;
+}
+
+template <typename T, typename Distance>
+double VPTree<T, Distance>::bound(const size_t &node, const size_t &half, const double &d) const {
+    const double *bounds = &m_bounds[4 * node + 2 * half];
+    return std::max(0.0, std::max(bounds[0] - d, d - bounds[1]));
+}
+
+template <typename T, typename Distance>
+VPTree<T, Distance>::VPTree() : m_dims(0), m_leaf_size(16), m_levels(0), m_distance() {}
+
+template <typename T, typename Distance>
+VPTree<T, Distance>::VPTree(const std::vector< std::vector<T> > &point_array, const Distance &distance, const size_t &leaf_size)
+    : m_dims(point_array.empty() ? 0 : point_array.front().size()), m_leaf_size(leaf_size), m_levels(0), m_distance(distance) {
+    assert(leaf_size > 0);
+    const size_t length = point_array.size();
+    // every level takes out a vantage point and halves the rest, until
+    // every bucket holds at most leaf_size points
+    while ((length >> m_levels) > m_leaf_size) {
+        m_levels++;
+    }
+    m_owned_bounds.resize(4 * ((size_t(1) << m_levels) - 1));
+
+    std::vector< std::pair<double, size_t> > work(length);
+    for (size_t i = 0; i < length; i++) {
+        work[i] = std::pair<double, size_t>(0, i);
+    }
+    if (length > 0) {
+        #pragma omp parallel if(length > 2000)
+        #pragma omp single
+        make_tree(work.data(), point_array.data(), 0, 0, length, 0);
+    }
+
+    m_owned_order.resize(length);
+    m_owned_points.resize(length * m_dims);
+    long int i = 0;
+    #pragma omp parallel for if(length > 2000)
+    for (i = 0; i < static_cast<long int>(length); i++) {
+        m_owned_order[i] = work[i].second;
+        std::copy(point_array[work[i].second].begin(), point_array[work[i].second].end(), m_owned_points.begin() + i * m_dims);
+    }
+    bind();
+}
+
+template <typename T, typename Distance>
+void VPTree<T, Distance>::bind() {
+    m_points = index_file::View<T>(m_owned_points);
+    m_order = index_file::View<size_t>(m_owned_order);
+    m_bounds = index_file::View<double>(m_owned_bounds);
+}
+
+template <typename T, typename Distance>
+VPTree<T, Distance>::VPTree(const VPTree &other)
+    : m_dims(other.m_dims), m_leaf_size(other.m_leaf_size), m_levels(other.m_levels), m_distance(other.m_distance),
+      m_points(other.m_points), m_order(other.m_order), m_bounds(other.m_bounds), m_owned_points(other.m_owned_points),
+      m_owned_order(other.m_owned_order), m_owned_bounds(other.m_owned_bounds), m_file(other.m_file) {
+    // distances such as lambdas can be copied but not assigned
+    if (m_order.data() == other.m_owned_order.data()) {
+        bind();
+    }
+}
+
+template <typename T, typename Distance>
+VPTree<T, Distance> &VPTree<T, Distance>::operator=(const VPTree &other) {
+    // views of a mapped file stay valid, as the copy shares the mapping
+    m_dims = other.m_dims;
+    m_leaf_size = other.m_leaf_size;
+    m_levels = other.m_levels;
+    m_distance = other.m_distance;
+    m_points = other.m_points;
+    m_order = other.m_order;
+    m_bounds = other.m_bounds;
+    m_owned_points = other.m_owned_points;
+    m_owned_order = other.m_owned_order;
+    m_owned_bounds = other.m_owned_bounds;
+    m_file = other.m_file;
+    if (m_order.data() == other.m_owned_order.data()) {
+        bind();
+    }
+    return *this;
+}
+
+template <typename T, typename Distance>
+void VPTree<T, Distance>::save(const std::string &path) const {
+    std::vector<uint64_t> params = {m_dims, m_leaf_size, m_levels, size()};
+    std::vector<std::pair<const void *, size_t> > sections = {
+        std::make_pair(static_cast<const void *>(m_points.data()), m_points.size() * sizeof(T)),
+        std::make_pair(static_cast<const void *>(m_order.data()), m_order.size() * sizeof(size_t)),
+        std::make_pair(static_cast<const void *>(m_bounds.data()), m_bounds.size() * sizeof(double))
+    };
+    index_file::write(path, index_file::make_header<T>(index_file::Kind::VP_TREE, params), sections);
+}
+
+template <typename T, typename Distance>
+VPTree<T, Distance> VPTree<T, Distance>::load(const std::string &path, const Distance &distance) {
+    VPTree<T, Distance> tree(std::vector<std::vector<T> >(), distance);
+    tree.m_file = index_file::File(path, index_file::Kind::VP_TREE, sizeof(T), std::is_floating_point<T>::value);
+    tree.m_dims = tree.m_file.param(0);
+    tree.m_leaf_size = tree.m_file.param(1);
+    tree.m_levels = tree.m_file.param(2);
+    const size_t length = tree.m_file.param(3);
+    tree.m_points = tree.m_file.template section<T>(0, length * tree.m_dims);
+    tree.m_order = tree.m_file.template section<size_t>(1, length);
+    tree.m_bounds = tree.m_file.template section<double>(2, 4 * ((size_t(1) << tree.m_levels) - 1));
+    return tree;
+}
+
+template <typename T, typename Distance>
+size_t VPTree<T, Distance>::size() const {
+    return m_order.size();
+}
+
+template <typename T, typename Distance>
+size_t VPTree<T, Distance>::dimensions() const {
+    return m_dims;
+}
+
+template <typename T, typename Distance>
+double VPTree<T, Distance>::distance(const std::vector<T> &a, const std::vector<T> &b) const {
+    return m_distance(a.data(), b.data(), a.size());
+}
+
+template <typename T, typename Distance>
+template <typename Accept>
+void VPTree<T, Distance>::nearest_k_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const T *pt,
+    const size_t &k,
+    Accept &accept,
+    std::pair<double, size_t> *heap,
+    size_t &size
+) const {
+    if (begin == end) {
+        return;
+    }
+    const size_t leaf_end = level == m_levels ? end : begin + 1;
+    double d = 0;
+    for (size_t i = begin; i < leaf_end; i++) {
+        d = m_distance(point(i), pt, m_dims);
+        if (!accept(i)) {
+            continue;
+        }
+        std::pair<double, size_t> candidate(d, m_order[i]);
+        if (size < k) {
+            heap[size++] = candidate;
+            std::push_heap(heap, heap + size);
+        } else if (candidate < heap[0]) {
+            std::pop_heap(heap, heap + k);
+            heap[k - 1] = candidate;
+            std::push_heap(heap, heap + k);
+        }
+    }
+    if (level == m_levels) {
+        return;
+    }
+
+    // d is the distance to the vantage; visit the half whose shell is
+    // closer first, and the other only if it can still improve the heap
+    const size_t middle = begin + 1 + (end - begin - 1) / 2;
+    const double inner = bound(node, 0, d), outer = bound(node, 1, d);
+    if (inner <= outer) {
+        nearest_k_(2 * node + 1, begin + 1, middle, level + 1, pt, k, accept, heap, size);
+        if (size < k || outer <= heap[0].first) {
+            nearest_k_(2 * node + 2, middle, end, level + 1, pt, k, accept, heap, size);
+        }
+    } else {
+        nearest_k_(2 * node + 2, middle, end, level + 1, pt, k, accept, heap, size);
+        if (size < k || inner <= heap[0].first) {
+            nearest_k_(2 * node + 1, begin + 1, middle, level + 1, pt, k, accept, heap, size);
+        }
+    }
+}
+
+template <typename T, typename Distance>
+size_t VPTree<T, Distance>::nearest_index(const std::vector<T> &pt) const {
+    std::vector< std::pair<double, size_t> > nearest = nearest_k(pt, 1);
+    return nearest.empty() ? std::numeric_limits<size_t>::max() : nearest.front().second;
+}
+
+template <typename T, typename Distance>
+std::vector< std::pair<double, size_t> > VPTree<T, Distance>::nearest_k(const std::vector<T> &pt, const size_t &k) const {
+    std::vector< std::pair<double, size_t> > output(k);
+    size_t size = 0;
+    auto accept = [](const size_t) { return true; };
+    if (k > 0) {
+        nearest_k_(0, 0, this->size(), 0, pt.data(), k, accept, output.data(), size);
+    }
+    std::sort_heap(output.begin(), output.begin() + size);
+    output.resize(size);
+    return output;
+}
+
+template <typename T, typename Distance>
+void VPTree<T, Distance>::nearest_k_batch(
+    const std::vector<std::vector<T> > &points,
+    const size_t &k,
+    std::vector<size_t> &indices,
+    std::vector<double> &distances
+) const {
+    const size_t count = points.size();
+    indices.resize(count * k);
+    distances.resize(count * k);
+    if (k == 0) {
+        return;
+    }
+    #pragma omp parallel if(count > 2000)
+    {
+        // one heap per thread, reused for every query it runs
+        std::vector< std::pair<double, size_t> > heap(k);
+        auto accept = [](const size_t) { return true; };
+        long int i = 0;
+        #pragma omp for schedule(dynamic, 256)
+        for (i = 0; i < static_cast<long int>(count); i++) {
+            size_t size = 0;
+            nearest_k_(0, 0, this->size(), 0, points[i].data(), k, accept, heap.data(), size);
+            std::sort_heap(heap.begin(), heap.begin() + size);
+            for (size_t j = 0; j < k; j++) {
+                indices[i * k + j] = j < size ? heap[j].second : std::numeric_limits<size_t>::max();
+                distances[i * k + j] = j < size ? heap[j].first : std::numeric_limits<double>::infinity();
+            }
+        }
+    }
+}
+
+template <typename T, typename Distance>
+template <typename Visitor>
+void VPTree<T, Distance>::neighborhood_(
+    const size_t &node,
+    const size_t &begin,
+    const size_t &end,
+    const size_t &level,
+    const T *pt,
+    const double &rad,
+    Visitor &visit
+) const {
+    if (begin == end) {
+        return;
+    }
+    const size_t leaf_end = level == m_levels ? end : begin + 1;
+    double d = 0;
+    for (size_t i = begin; i < leaf_end; i++) {
+        d = m_distance(point(i), pt, m_dims);
+        if (d <= rad) {
+            visit(i, d);
+        }
+    }
+    if (level == m_levels) {
+        return;
+    }
+
+    const size_t middle = begin + 1 + (end - begin - 1) / 2;
+    if (bound(node, 0, d) <= rad) {
+        neighborhood_(2 * node + 1, begin + 1, middle, level + 1, pt, rad, visit);
+    }
+    if (bound(node, 1, d) <= rad) {
+        neighborhood_(2 * node + 2, middle, end, level + 1, pt, rad, visit);
+    }
+}
+
+template <typename T, typename Distance>
+template <typename Visitor>
+void VPTree<T, Distance>::neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) const {
+    auto visit_position = [this, &visit](const size_t position, const double d) {
+        visit(m_order[position], d);
+    };
+    neighborhood_(0, 0, size(), 0, pt.data(), rad, visit_position);
+}
+
+template <typename T, typename Distance>
+std::vector<size_t> VPTree<T, Distance>::neighborhood_indices(const std::vector<T> &pt, const double &rad) const {
+    std::vector<size_t> output;
+    neighborhood_visit(pt, rad, [&output](const size_t index, const double) {
+        output.push_back(index);
+    });
+    return output;
+}
+
+template <typename T, typename Distance>
+size_t VPTree<T, Distance>::count_within(const std::vector<T> &pt, const double &rad) const {
+    size_t count = 0;
+    neighborhood_visit(pt, rad, [&count](const size_t, const double) {
+        count++;
+    });
+    return count;
+}
+
+template <typename T, typename Distance>
+template <typename S>
+pairwise::CSRMatrix<S> VPTree<T, Distance>::threshold_graph(const S &threshold, const bool include_self) const {
+    const size_t count = size();
+    std::vector<std::vector<pairwise::Edge<S> > > buffers(pairwise::thread_count());
+    long int i = 0;
+    // queries in tree order, so neighboring queries touch the same leaves;
+    // every pair is kept once, by its smaller index
+    #pragma omp parallel for if(count > 2000) schedule(dynamic, 256)
+    for (i = 0; i < static_cast<long int>(count); i++) {
+        std::vector<pairwise::Edge<S> > &buffer = buffers[pairwise::thread_id()];
+        const size_t index = m_order[i];
+        auto visit = [this, &buffer, &index, &threshold](const size_t position, const double d) {
+            const S value = static_cast<S>(d);
+            if (m_order[position] > index && value < threshold) {
+                pairwise::Edge<S> edge = {index, m_order[position], value};
+                buffer.push_back(edge);
+            }
+        };
+        neighborhood_(0, 0, count, 0, point(i), static_cast<double>(threshold), visit);
+    }
+    return pairwise::edges_to_csr<S>(count, buffers, true, include_self);
+}
@@ -0,0 +1,118 @@
+#pragma once
+
+#include <limits>
+#include <utility>
+#include <vector>
+
+#include "../distance.hpp"
+#include "../index_file.hpp"
+#include "../pairwise.hpp"
+
+// Vantage-point tree over any metric given as a functor
+// distance(row1, row2, dims) (see the functors of distance.hpp).  Every
+// internal node takes the first point of its range as vantage point and
+// splits the rest at the median distance to it into an inner and an outer
+// half; the shell [low, high] of distances from the vantage to each half is
+// kept, and by the triangle inequality no point of a half is closer to a
+// query than max(low - d, d - high), d being the query's distance to the
+// vantage.  Like KDTree the tree is implicit: node i has children 2i + 1
+// and 2i + 2, ranges are recomputed on the way down, the points are stored
+// flat in tree order and leaves are buckets of at most leaf_size points.
+// As with KDTree the arrays are read through views, so a saved tree can be
+// mapped and queried in place.
+template <typename T, typename Distance = distance::Euclidean>
+class VPTree {
+    size_t m_dims;
+    size_t m_leaf_size;
+    // depth of the leaves, and the internal nodes above them
+    size_t m_levels;
+    Distance m_distance;
+    index_file::View<T> m_points;
+    index_file::View<size_t> m_order;
+    // inner low, inner high, outer low, outer high of every internal node
+    index_file::View<double> m_bounds;
+    // what the views are over: the built arrays, or the mapped file
+    std::vector<T> m_owned_points;
+    std::vector<size_t> m_owned_order;
+    std::vector<double> m_owned_bounds;
+    index_file::File m_file;
+
+    // work holds (distance to the range's vantage, input index) of every
+    // position while building; pointers and indices by value, as the
+    // subtrees are built in tasks that outlive the caller's frame
+    void make_tree(std::pair<double, size_t> *work, const std::vector<T> *point_array,
+                   const size_t node, const size_t begin, const size_t end,
+                   const size_t level);
+
+    const T *point(const size_t &position) const;
+
+    // lower bound on the distance from a point at distance d of the vantage
+    // of node to any point of its inner (0) or outer (1) half
+    double bound(const size_t &node, const size_t &half, const double &d) const;
+
+    // points the views at the owned arrays
+    void bind();
+
+   public:
+    VPTree();
+    explicit VPTree(const std::vector<std::vector<T> > &point_array, const Distance &distance = Distance(),
+                    const size_t &leaf_size = 16);
+    VPTree(const VPTree &other);
+    VPTree(VPTree &&other) = default;
+    VPTree &operator=(const VPTree &other);
+    VPTree &operator=(VPTree &&other) = default;
+
+    // Writes the tree to a versioned binary file (see index_file.hpp).  The
+    // distance is not saved; load must be given the one the tree was built
+    // with.
+    void save(const std::string &path) const;
+
+    // Maps a file written by save and queries it in place.  Throws
+    // std::runtime_error if the file is not a VPTree of T written on a
+    // compatible machine.
+    static VPTree load(const std::string &path, const Distance &distance = Distance());
+
+    size_t size() const;
+    size_t dimensions() const;
+
+    double distance(const std::vector<T> &a, const std::vector<T> &b) const;
+
+   private:
+    template <typename Accept>
+    void nearest_k_(const size_t &node, const size_t &begin, const size_t &end,
+                    const size_t &level, const T *pt, const size_t &k,
+                    Accept &accept, std::pair<double, size_t> *heap,
+                    size_t &size) const;
+
+    template <typename Visitor>
+    void neighborhood_(const size_t &node, const size_t &begin, const size_t &end,
+                       const size_t &level, const T *pt, const double &rad,
+                       Visitor &visit) const;
+
+   public:
+    // index of the nearest point, std::numeric_limits<size_t>::max() if empty
+    size_t nearest_index(const std::vector<T> &pt) const;
+
+    // k nearest points as (distance, index), closest first
+    std::vector< std::pair<double, size_t> > nearest_k(const std::vector<T> &pt, const size_t &k) const;
+
+    // k nearest points of every query in parallel, as flat row-major
+    // n x k arrays of indices and distances, closest first, padded with
+    // std::numeric_limits<size_t>::max() and infinity.
+    void nearest_k_batch(const std::vector<std::vector<T> > &points, const size_t &k,
+                         std::vector<size_t> &indices, std::vector<double> &distances) const;
+
+    // Calls visit(index, distance) for every point within rad of pt.
+    template <typename Visitor>
+    void neighborhood_visit(const std::vector<T> &pt, const double &rad, Visitor visit) const;
+
+    std::vector<size_t> neighborhood_indices(const std::vector<T> &pt, const double &rad) const;
+
+    size_t count_within(const std::vector<T> &pt, const double &rad) const;
+
+    // Pairs of indexed points closer than threshold (strictly), in both
+    // directions, as the pairwise::pdist_threshold of the indexed points
+    // would return them; rows are searched in parallel.
+    template <typename S>
+    pairwise::CSRMatrix<S> threshold_graph(const S &threshold, const bool include_self = true) const;
+};
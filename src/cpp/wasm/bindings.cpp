@@ -83,8 +83,20 @@ EMSCRIPTEN_BINDINGS(highp) {
         .function("getEpsilon", &wasm::cluster::DBPack<double>::getEpsilon)
         .function("setMinPoints", &wasm::cluster::DBPack<double>::setMinPoints)
         .function("getMinPoints", &wasm::cluster::DBPack<double>::getMinPoints)
-        .function("predict", &DBPack<double>::predict);
+        .function("predict", &DBPack<double>::predict)
+        .function("predictUnsorted", &DBPack<double>::predictUnsorted);
     
+    // Binding for OPTICS class
+    class_<wasm::cluster::OPTICS<double>>("OPTICS")
+        .constructor<double, long int>()
+        .function("getEpsilon", &wasm::cluster::OPTICS<double>::getEpsilon)
+        .function("getMinPoints", &wasm::cluster::OPTICS<double>::getMinPoints)
+        .function("fit", &wasm::cluster::OPTICS<double>::fit)
+        .function("extractDBSCAN", &wasm::cluster::OPTICS<double>::extractDBSCAN)
+        .function("getOrdering", &wasm::cluster::OPTICS<double>::getOrdering)
+        .function("getReachability", &wasm::cluster::OPTICS<double>::getReachability)
+        .function("predict", &wasm::cluster::OPTICS<double>::predict);
+
     // Binding for CoreDBPack class
     class_<wasm::cluster::fuzzy::CoreDBPack<double, long int>>("CoreDBPack")
         .constructor<double, long int, long int>()
@@ -94,7 +106,8 @@ EMSCRIPTEN_BINDINGS(highp) {
         .function("getMinPoints", &wasm::cluster::fuzzy::CoreDBPack<double, long int>::getMinPoints)
         .function("setMaxPoints", &wasm::cluster::fuzzy::CoreDBPack<double, long int>::setMaxPoints)
         .function("getMaxPoints", &wasm::cluster::fuzzy::CoreDBPack<double, long int>::getMaxPoints)
-        .function("predict", &wasm::cluster::fuzzy::CoreDBPack<double, long int>::predict);
+        .function("predict", &wasm::cluster::fuzzy::CoreDBPack<double, long int>::predict)
+        .function("predictCSR", &wasm::cluster::fuzzy::CoreDBPack<double, long int>::predictCSR);
 
     // Binding for BorderDBPack class
     class_<wasm::cluster::fuzzy::BorderDBPack<double, long int>>("BorderDBPack")
@@ -105,7 +118,8 @@ EMSCRIPTEN_BINDINGS(highp) {
         .function("getMaxEpsilon", &wasm::cluster::fuzzy::BorderDBPack<double, long int>::getMaxEpsilon)
         .function("setMinPoints", &wasm::cluster::fuzzy::BorderDBPack<double, long int>::setMinPoints)
         .function("getMinPoints", &wasm::cluster::fuzzy::BorderDBPack<double, long int>::getMinPoints)
-        .function("predict", &wasm::cluster::fuzzy::BorderDBPack<double, long int>::predict);
+        .function("predict", &wasm::cluster::fuzzy::BorderDBPack<double, long int>::predict)
+        .function("predictCSR", &wasm::cluster::fuzzy::BorderDBPack<double, long int>::predictCSR);
 }
 
 int main() {
@@ -2,6 +2,7 @@
 #define WASM_DBSCAN_H
 
 #include "../dbscan.cpp"
+#include "../optics.cpp"
 
 #include <emscripten/val.h>
 #include "../distance.cpp"
@@ -64,16 +65,22 @@ namespace wasm {
                 }
 
                 emscripten::val predict(emscripten::val jsData) {
-                    std::vector<std::vector<T>> data = wasm::utility::array2DToVec<T>(jsData);
+                    std::vector<T> data = wasm::utility::arrayToVec<T>(jsData);
                     auto clusters = this->m_instance->predict(data);
                     return wasm::utility::vecToArray<int>(clusters);
                 }
 
+                emscripten::val predictUnsorted(emscripten::val jsData) {
+                    std::vector<T> data = wasm::utility::arrayToVec<T>(jsData);
+                    auto clusters = this->m_instance->predict_unsorted(data);
+                    return wasm::utility::vecToArray<int>(clusters);
+                }
+
                 void setEpsilon(const T value) {
                     this->m_instance->setEpsilon(value);
                 }
 
-                long int getEpsilon() {
+                T getEpsilon() {
                     return this->m_instance->getEpsilon();
                 }
 
@@ -89,6 +96,54 @@ namespace wasm {
             private:
                 density::DBPack<T> * m_instance;
         };
+
+        template <typename T>
+        class OPTICS {
+            // fit once, then extractDBSCAN for any epsilon up to the
+            // generating one without re-running the neighborhood queries
+            public:
+                OPTICS(const T epsilon, const long int min_points) {
+                    m_instance = new density::OPTICS<T>(epsilon, min_points);
+                }
+
+                void fit(emscripten::val jsData) {
+                    std::vector<std::vector<T>> data = wasm::utility::array2DToVec<T>(jsData);
+                    this->m_instance->fit(data);
+                }
+
+                emscripten::val extractDBSCAN(const T epsilon) {
+                    if (epsilon > this->m_instance->getFittedEpsilon()) {
+                        throw std::invalid_argument("epsilon must not exceed the generating epsilon");
+                    }
+                    auto clusters = this->m_instance->extract_dbscan(epsilon);
+                    return wasm::utility::vecToArray<int>(clusters);
+                }
+
+                emscripten::val predict(emscripten::val jsData) {
+                    std::vector<std::vector<T>> data = wasm::utility::array2DToVec<T>(jsData);
+                    auto clusters = this->m_instance->predict(data);
+                    return wasm::utility::vecToArray<int>(clusters);
+                }
+
+                emscripten::val getOrdering() {
+                    return wasm::utility::vecToArray<size_t>(this->m_instance->getOrdering());
+                }
+
+                emscripten::val getReachability() {
+                    return wasm::utility::vecToArray<double>(this->m_instance->getReachability());
+                }
+
+                T getEpsilon() {
+                    return this->m_instance->getEpsilon();
+                }
+
+                long int getMinPoints() {
+                    return this->m_instance->getMinPoints();
+                }
+
+            private:
+                density::OPTICS<T> * m_instance;
+        };
     }
 }
 
@@ -35,6 +35,21 @@ namespace wasm {
                         return jsClusters;
                     }
 
+                    // memberships as {offsets, clusters, values}: point i
+                    // belongs to clusters[offsets[i]..offsets[i + 1]) with the
+                    // matching values, as Uint32Array, Int32Array and
+                    // Float32Array
+                    emscripten::val predictCSR(emscripten::val jsData) {
+                        std::vector<T1> data = wasm::utility::arrayToVec<T1>(jsData);
+                        const density::fuzzy::Memberships<float, int> memberships = this->m_instance->predict_csr(data);
+
+                        emscripten::val jsMemberships = emscripten::val::object();
+                        jsMemberships.set("offsets", wasm::utility::vecToTypedArrayCopy(memberships.offsets));
+                        jsMemberships.set("clusters", wasm::utility::vecToTypedArrayCopy(memberships.clusters));
+                        jsMemberships.set("values", wasm::utility::vecToTypedArrayCopy(memberships.values));
+                        return jsMemberships;
+                    }
+
                     void setMinEpsilon(const T1 value) {
                         this->m_instance->setMinEpsilon(value);
                     }
@@ -83,6 +98,21 @@ namespace wasm {
                         return jsClusters;
                     }
 
+                    // memberships as {offsets, clusters, values}: point i
+                    // belongs to clusters[offsets[i]..offsets[i + 1]) with the
+                    // matching values, as Uint32Array, Int32Array and
+                    // Float32Array
+                    emscripten::val predictCSR(emscripten::val jsData) {
+                        std::vector<T1> data = wasm::utility::arrayToVec<T1>(jsData);
+                        const density::fuzzy::Memberships<float, int> memberships = this->m_instance->predict_csr(data);
+
+                        emscripten::val jsMemberships = emscripten::val::object();
+                        jsMemberships.set("offsets", wasm::utility::vecToTypedArrayCopy(memberships.offsets));
+                        jsMemberships.set("clusters", wasm::utility::vecToTypedArrayCopy(memberships.clusters));
+                        jsMemberships.set("values", wasm::utility::vecToTypedArrayCopy(memberships.values));
+                        return jsMemberships;
+                    }
+
                     void setMinEpsilon(const T1 value) {
                         this->m_instance->setMinEpsilon(value);
                     }
@@ -78,6 +78,13 @@ namespace wasm {
         }
 
 
+        // typed array of the matching type (Float32Array for float, ...)
+        // holding a copy of data, valid after data is gone
+        template <typename T>
+        emscripten::val vecToTypedArrayCopy(const std::vector<T>& data) {
+            return emscripten::val(emscripten::typed_memory_view(data.size(), data.data())).call<emscripten::val>("slice");
+        }
+
         template <class T1, class T2>
         emscripten::val mapToObject(const std::map<T1, T2>& cppMap) {
             emscripten::val jsObj = emscripten::val::object();
@@ -1,6 +1,7 @@
  %module fuzzy
  %{
  /* Put header files here or function declarations like below */
+ #include "../src/cpp/memberships.hpp"
  #include "../src/cpp/fuzzy.hpp"
  %}
 
@@ -10,11 +11,17 @@
  namespace std {
      %template(vectori) std::vector<int>;
      %template(vectord) std::vector<double>;
+     %template(vectorf) std::vector<float>;
+     %template(vectorsize) std::vector<size_t>;
      %template(VecVecdouble) std::vector< std::vector<double> >;
      %template(MapID) std::map<int, double>;
      %template(VectorMap) std::vector<std::map<int, double> >;
  }
 
+%include "../src/cpp/memberships.hpp"
+
+ %template(FuzzyMemberships) density::fuzzy::Memberships<float, int>;
+
 %include "../src/cpp/fuzzy.hpp"
 
  %template(FuzzyBaseDBSCAN) density::fuzzy::BaseDBSCAN<double>;
@@ -17,3 +17,4 @@
  %include "../src/cpp/moving.hpp"
 
  %template(NormalMovingDBSCAN) density::moving::MovingDBSCAN<double>;
+ %template(TrajectoryIndexdouble) density::moving::TrajectoryIndex<double>;